@@ -7,18 +7,170 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <random>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#if !defined(DKM_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define DKM_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DKM_SIMD_TARGET(isa)
+#else
+#define DKM_SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
 /*
 DKM - A k-means implementation that is generic across variable data dimensions.
 */
 namespace dkm {
 
+/*
+The method used to pick the initial means, set through `clustering_parameters`.
+* plusplus; [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B), which makes one pass over the data
+  for each mean. This is the default.
+* scalable_plusplus; [k-means||](https://arxiv.org/abs/1203.6402), which oversamples candidate means in a
+  few passes over the data and reclusters them. It makes far fewer passes than kmeans++, but each one
+  measures the distances to about 2k new candidates, so it does several times as much work in total and
+  is usually slower than kmeans++.
+* afkmc2; [AFK-MC²](https://arxiv.org/abs/1602.03330), which approximates kmeans++ with short Markov
+  chains after a single pass over the data. This is the cheapest option when seeding is repeated many
+  times, such as when picking the best of several restarts.
+*/
+enum class initialization {
+	plusplus,
+	scalable_plusplus,
+	afkmc2
+};
+
+/*
+The method used to calculate the distances from the data points to the means when assigning points to
+clusters, set through `clustering_parameters`.
+* direct; calculate each distance directly. This is the default.
+* blocked; calculate the distances as ||x||^2 - 2 x.c + ||c||^2 with a cache-blocked matrix multiply in
+  double, caching the norms of the data points. With a hundred or so dimensions and hundreds of clusters
+  this is several times faster for double and integer data, but only about as fast as the SIMD kernels of
+  the direct calculation for float data, and much slower for low dimensional data. It is used by
+  `kmeans_lloyd` and `kmeans_lloyd_parallel`.
+*/
+enum class distance_engine {
+	direct,
+	blocked
+};
+
+/*
+The method used to update the means after each assignment step, set through `clustering_parameters`.
+* full; recalculate each mean from all of the points in its cluster. This is the default.
+* incremental; keep a running sum and size for each cluster, and only add and subtract the points that
+  changed cluster. Once the clusters settle only a few points move each iteration, so the update costs
+  much less than a full pass. The sums are held in double precision (for float data), but may still
+  drift from a full recalculation over many iterations; a recompute interval can be set to
+  periodically recalculate them from scratch. It is used by `kmeans_lloyd` and `kmeans_lloyd_parallel`.
+*/
+enum class mean_update {
+	full,
+	incremental
+};
+
+/*
+How the assignment step of `kmeans_lloyd_parallel` is shared out between threads, set through
+`clustering_parameters`.
+* even; the data is split into one contiguous part per thread, each with its own partial sums, so the
+  means only depend on the number of threads. This is the default.
+* dynamic; the data is split into chunks of the chunk size, which the threads take as they come free.
+  This keeps every thread busy when some of them are slowed down (e.g. by other work on the same cores),
+  but which thread sums each chunk depends on timing, so the means may differ in the last bits between
+  runs.
+*/
+enum class parallel_schedule {
+	even,
+	dynamic
+};
+
+/*
+How `kmeans_lloyd` and `kmeans_lloyd_parallel` hold the points they read in every iteration, set through
+`clustering_parameters`. Storing a copy of the points in fewer bits cuts the memory traffic of each
+iteration, which is what limits the speed of large, high dimensional data sets.
+* full; the points are read in place, in T. This is the default.
+* single; the points are copied into float, halving their size when T is double.
+* half; the points are copied into IEEE 754 half precision (float16), with 11 significant bits and a
+  largest value of 65504.
+* bfloat16; the points are copied into bfloat16, with 8 significant bits and the range of float.
+The points are converted back to T a block at a time as they are read, and the distances, sums and means
+are calculated in T and accumulate_t<T> as usual, so only the precision of the points themselves is
+reduced. The initial means are picked from the points in T.
+*/
+enum class point_storage {
+	full,
+	single,
+	half,
+	bfloat16
+};
+
+/*
+A non-owning view of data points held in a buffer (one point per row), for use with the runtime
+dimension overloads of the clustering functions. The buffer must outlive the view.
+
+Consecutive rows start `stride` values apart, which defaults to the number of columns. A larger
+stride selects a subset of the columns of a wider table, or skips the padding at the end of each row
+(e.g. a row-major Eigen matrix or a memory-mapped record array), without copying the data.
+
+Consecutive values of a row start `col_stride` values apart, which defaults to one. A column-major
+matrix (e.g. an Eigen matrix in its default layout, or the columns of a column store laid out one after
+another) is viewed with a stride of one and a col_stride of its number of rows, or its leading
+dimension. The rows of such a view aren't contiguous, so the clustering functions gather them into a
+small scratch buffer a block at a time, rather than copying the whole matrix.
+*/
+template <typename T>
+class matrix_view {
+public:
+	matrix_view(const T* data, size_t rows, size_t cols) :
+	_data(data), _rows(rows), _cols(cols), _stride(cols), _col_stride(1)
+	{}
+
+	matrix_view(const T* data, size_t rows, size_t cols, size_t stride) :
+	_data(data), _rows(rows), _cols(cols), _stride(stride), _col_stride(1)
+	{
+		assert(stride >= cols);
+	}
+
+	matrix_view(const T* data, size_t rows, size_t cols, size_t stride, size_t col_stride) :
+	_data(data), _rows(rows), _cols(cols), _stride(stride), _col_stride(col_stride)
+	{
+		// The rows and columns mustn't overlap, in either a row-major or a column-major layout
+		assert(stride >= cols * col_stride || col_stride >= rows * stride);
+	}
+
+	const T* data() const { return _data; }
+	size_t rows() const { return _rows; }
+	size_t cols() const { return _cols; }
+	size_t stride() const { return _stride; }
+	size_t col_stride() const { return _col_stride; }
+	// Whether the values of each row are next to each other, so that row() can be used
+	bool contiguous_rows() const { return _col_stride == 1; }
+	const T* row(size_t i) const {
+		assert(contiguous_rows());
+		return _data + i * _stride;
+	}
+	T value(size_t i, size_t d) const { return _data[i * _stride + d * _col_stride]; }
+
+private:
+	const T* _data;
+	size_t _rows;
+	size_t _cols;
+	size_t _stride;
+	size_t _col_stride;
+};
+
 /*
 These functions are all private implementation details and shouldn't be referenced outside of this
 file.
@@ -64,179 +216,2636 @@ T distance(const std::array<T, N>& point_a, const std::array<T, N>& point_b) {
 }
 
 /*
-Calculate the smallest distance between each of the data points and any of the input means.
+The dimension used by the functions on flat data when the dimension is only known at runtime. These
+functions take the dimension N as a template parameter, so that the loops over the dimensions can be
+unrolled when it is known at compile time, along with the number of columns in the data.
+*/
+const size_t dynamic_dimension = 0;
+
+template <size_t N>
+size_t flat_dimension(size_t cols) {
+	return N == dynamic_dimension ? cols : N;
+}
+
+/*
+Calculate the square of the difference between two values for signed types
+*/
+template <typename T>
+typename std::enable_if<!std::is_unsigned<T>::value, T>::type squared_difference(T a, T b) {
+	auto delta = a - b;
+	return delta * delta;
+}
+
+/*
+Calculate the square of the difference between two values for unsigned types
+Uses conditional subtraction to avoid unsigned underflow.
+*/
+template <typename T>
+typename std::enable_if<std::is_unsigned<T>::value, T>::type squared_difference(T a, T b) {
+	T diff = a >= b ? a - b : b - a;
+	return diff * diff;
+}
+
+/*
+Calculate the square of the distance between two points held in flat buffers.
 */
 template <typename T, size_t N>
-std::vector<T> closest_distance(
-	const std::vector<std::array<T, N>>& means, const std::vector<std::array<T, N>>& data) {
-	std::vector<T> distances;
-	distances.reserve(data.size());
-	for (auto& d : data) {
-		T closest = distance_squared(d, means[0]);
-		for (auto& m : means) {
-			T distance = distance_squared(d, m);
-			if (distance < closest)
-				closest = distance;
+T distance_squared(const T* point_a, const T* point_b, size_t cols) {
+	const size_t dimension = flat_dimension<N>(cols);
+	T d_squared = T();
+	for (size_t i = 0; i < dimension; ++i) {
+		d_squared += squared_difference(point_a[i], point_b[i]);
+	}
+	return d_squared;
+}
+
+/*
+A vector of fixed-size arrays is already a flat, row-major buffer, so it can be viewed without copying.
+*/
+template <typename T, size_t N>
+matrix_view<T> view_of(const std::vector<std::array<T, N>>& data) {
+	static_assert(sizeof(std::array<T, N>) == N * sizeof(T), "std::array is expected to have no padding");
+	return matrix_view<T>(data.empty() ? nullptr : data.front().data(), data.size(), N);
+}
+
+/*
+View a flat, row-major buffer of points with the given number of columns, such as the means.
+*/
+template <typename T>
+matrix_view<T> view_of(const std::vector<T>& values, size_t cols) {
+	return matrix_view<T>(values.data(), values.size() / cols, cols);
+}
+
+/*
+Copy a flat, row-major buffer of points into a vector of fixed-size arrays.
+*/
+template <typename T, size_t N>
+std::vector<std::array<T, N>> to_arrays(const std::vector<T>& values) {
+	std::vector<std::array<T, N>> points(values.size() / N);
+	for (size_t i = 0; i < points.size(); ++i) {
+		std::copy(values.begin() + i * N, values.begin() + (i + 1) * N, points[i].begin());
+	}
+	return points;
+}
+
+/*
+Append a point to a flat, row-major buffer of points.
+*/
+template <typename T>
+void append_row(std::vector<T>& values, const T* row, size_t cols) {
+	values.insert(values.end(), row, row + cols);
+}
+
+/*
+Append row i of the data to a flat, row-major buffer of points, whatever the layout of the data.
+*/
+template <typename T>
+void append_row(std::vector<T>& values, const matrix_view<T>& data, size_t i) {
+	for (size_t d = 0; d < data.cols(); ++d) {
+		values.push_back(data.value(i, d));
+	}
+}
+
+/*
+The number of rows `gather_rows` gathers at a time.
+*/
+const size_t gather_block_rows = 64;
+
+/*
+View the rows of the data from begin to end with the values of each row next to each other, as the
+distance calculations need. Rows which already are (see `matrix_view::contiguous_rows`) are viewed in
+place; otherwise they are copied into scratch, a column at a time so that column-major data is read in
+order. The loops over the data call this for blocks of gather_block_rows rows, so only that many are
+copied at once.
+*/
+template <typename T>
+matrix_view<T> gather_rows(const matrix_view<T>& data, size_t begin, size_t end, std::vector<T>& scratch) {
+	if (data.contiguous_rows()) {
+		return matrix_view<T>(data.data() + begin * data.stride(), end - begin, data.cols(), data.stride());
+	}
+	const size_t rows = end - begin;
+	const size_t cols = data.cols();
+	scratch.resize(rows * cols);
+	for (size_t d = 0; d < cols; ++d) {
+		const T* column = data.data() + begin * data.stride() + d * data.col_stride();
+		for (size_t i = 0; i < rows; ++i) {
+			scratch[i * cols + d] = column[i * data.stride()];
+		}
+	}
+	return matrix_view<T>(scratch.data(), rows, cols);
+}
+
+/*
+Check whether all of the data points are identical to the first.
+*/
+template <typename T>
+bool all_rows_equal(const matrix_view<T>& data) {
+	for (size_t i = 1; i < data.rows(); ++i) {
+		for (size_t d = 0; d < data.cols(); ++d) {
+			if (data.value(i, d) != data.value(0, d)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+Fill k means with copies of the first data point, writing them to means.
+*/
+template <typename T>
+void repeat_first_row(const matrix_view<T>& data, uint32_t k, std::vector<T>& means) {
+	means.clear();
+	for (uint32_t i = 0; i < k; ++i) {
+		append_row(means, data, 0);
+	}
+}
+
+template <typename T>
+std::vector<T> repeat_first_row(const matrix_view<T>& data, uint32_t k) {
+	std::vector<T> means;
+	means.reserve(k * data.cols());
+	repeat_first_row(data, k, means);
+	return means;
+}
+
+/*
+The type used to accumulate sums of values of type T; the prefix sums used to sample the kmeans++ means,
+and the sums of the points in each cluster. Float data is accumulated in double to limit rounding errors.
+*/
+template <typename T>
+using accumulate_t = typename std::conditional<std::is_same<T, long double>::value, long double, double>::type;
+
+/*
+The number of weights in each block of the prefix sums used to sample the kmeans++ means. The blocks
+don't depend on the number of threads, so the parallel prefix sums (and so the means sampled from them)
+are identical to the serial ones.
+*/
+const size_t prefix_sum_block = 4096;
+
+/*
+Calculate the inclusive prefix sums of the weights (the squared distances to the closest mean) for
+sampling. Each block is summed on its own and then offset by the total of the blocks before it, which is
+the order the parallel version adds them in.
+*/
+template <typename T>
+void weighted_prefix_sums(const std::vector<T>& weights, std::vector<accumulate_t<T>>& sums) {
+	using A = accumulate_t<T>;
+	sums.resize(weights.size());
+	A offset = A();
+	for (size_t begin = 0; begin < weights.size(); begin += prefix_sum_block) {
+		const size_t end = std::min(begin + prefix_sum_block, weights.size());
+		A sum = A();
+		for (size_t i = begin; i < end; ++i) {
+			sum += static_cast<A>(weights[i]);
+			sums[i] = sum;
+		}
+		for (size_t i = begin; i < end; ++i) {
+			sums[i] += offset;
+		}
+		offset += sum;
+	}
+}
+
+/*
+Pick a random index with probability proportional to its weight, given the prefix sums of the weights,
+by searching the sums for a uniformly distributed value between 0 and the total weight. The weights are
+never converted to integers, so small weights keep their probability.
+*/
+template <typename A, typename R>
+size_t sample_prefix_sums(const std::vector<A>& sums, R& rand_engine) {
+	const A total = sums.back();
+	const A scale = static_cast<A>(R::max() - R::min()) + 1;
+	const A target = static_cast<A>(rand_engine() - R::min()) / scale * total;
+	size_t index = static_cast<size_t>(std::upper_bound(sums.begin(), sums.end(), target) - sums.begin());
+	if (index == sums.size()) {
+		// The target was rounded up to the total weight, pick the last point with a non-zero weight
+		index = static_cast<size_t>(std::lower_bound(sums.begin(), sums.end(), total) - sums.begin());
+	}
+	return index;
+}
+
+/*
+Update the smallest distance between each of the data points and any of the means chosen so far, given
+the mean that was just added. Only the new mean needs to be compared, so each update is O(n).
+*/
+template <typename T, size_t N>
+void update_closest_distance(const T* mean, const matrix_view<T>& data, std::vector<T>& distances) {
+	std::vector<T> scratch;
+	for (size_t first = 0; first < data.rows(); first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, data.rows());
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			T distance = distance_squared<T, N>(points.row(i - first), mean, data.cols());
+			if (distance < distances[i])
+				distances[i] = distance;
 		}
-		distances.push_back(closest);
 	}
-	return distances;
 }
 
+/*
+The scratch space used to pick the kmeans++ means: the distance from each point to its closest mean, and
+their prefix sums (with the offset of each block for the parallel version). It is kept in `lloyd_buffers`,
+so that seeding a reused `kmeans_workspace` doesn't allocate.
+*/
+template <typename T>
+struct seeding_buffers {
+	std::vector<T> distances;
+	std::vector<accumulate_t<T>> sums;
+	std::vector<accumulate_t<T>> block_offsets;
+};
+
 /*
 This is an alternate initialization method based on the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
-initialization algorithm.
+initialization algorithm. The means are written to means in a flat, row-major buffer, using the storage
+in means and scratch.
 */
-template <typename T, typename S = uint64_t, size_t N>
-std::vector<std::array<T, N>> random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, S seed) {
+template <typename T, typename S, size_t N>
+void random_plusplus(const matrix_view<T>& data, uint32_t k, S seed, std::vector<T>& means, seeding_buffers<T>& scratch) {
 	assert(k > 0);
-	assert(data.size() > 0);
+	assert(data.rows() > 0);
+	means.clear();
 
-	// If data is empty then return an empty vector
-	if (data.empty()) {
-		return std::vector<std::array<T, N>>();
+	// If data is empty then return no means
+	if (data.rows() == 0) {
+		return;
 	}
 
 	// If all of the data points are identical then the distances will be zero, just fill the starting means with copies
 	// of the first element
-	if (std::all_of(data.begin(), data.end(), [&data](const std::array<T, N>& a) { return a == data[0]; })) {
-		return std::vector<std::array<T, N>>(k, data[0]);
+	if (all_rows_equal(data)) {
+		repeat_first_row(data, k, means);
+		return;
 	}
 
-	using input_size_t = typename std::array<T, N>::size_type;
-	std::vector<std::array<T, N>> means;
+	const size_t cols = data.cols();
+	means.reserve(k * cols);
 	// Using a very simple PRBS generator, parameters selected according to
 	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
 	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
 	// Select first mean at random from the set
 	{
-		std::uniform_int_distribution<input_size_t> uniform_generator(0, data.size() - 1);
-		means.push_back(data[uniform_generator(rand_engine)]);
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.rows() - 1);
+		append_row(means, data, uniform_generator(rand_engine));
 	}
 
+	// The distance to the closest mean for each data point, updated as each mean is added
+	std::vector<T>& distances = scratch.distances;
+	distances.assign(data.rows(), std::numeric_limits<T>::max());
 	for (uint32_t count = 1; count < k; ++count) {
-		// Calculate the distance to the closest mean for each data point
-		auto distances = details::closest_distance(means, data);
+		details::update_closest_distance<T, N>(&means[(count - 1) * cols], data, distances);
 		// Pick a random point weighted by the distance from existing means
-		// TODO: This might convert floating point weights to ints, distorting the distribution for small weights
-#if !defined(_MSC_VER) || _MSC_VER >= 1900
-		std::discrete_distribution<input_size_t> generator(distances.begin(), distances.end());
-#else  // MSVC++ older than 14.0
-		input_size_t i = 0;
-		std::discrete_distribution<input_size_t> generator(distances.size(), 0.0, 0.0, [&distances, &i](double) { return distances[i++]; });
-#endif
-		means.push_back(data[generator(rand_engine)]);
+		weighted_prefix_sums(distances, scratch.sums);
+		append_row(means, data, sample_prefix_sums(scratch.sums, rand_engine));
 	}
+}
+
+/*
+kmeans++ initialization, returning the means in a flat, row-major buffer.
+*/
+template <typename T, typename S, size_t N>
+std::vector<T> random_plusplus(const matrix_view<T>& data, uint32_t k, S seed) {
+	std::vector<T> means;
+	seeding_buffers<T> scratch;
+	random_plusplus<T, S, N>(data, k, seed, means, scratch);
 	return means;
 }
 
 /*
-Calculate the index of the mean a particular data point is closest to (euclidean distance)
+kmeans++ initialization for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::vector<std::array<T, N>> random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, S seed) {
+	return to_arrays<T, N>(random_plusplus<T, S, N>(view_of(data), k, seed));
+}
+
+/*
+The number of oversampling rounds used by k-means|| seeding, and the number of candidates sampled per
+round as a multiple of k. Bahmani et al. found that 5 rounds sampling 2k candidates each are enough for
+the final means to match the quality of kmeans++.
+*/
+const int scalable_plusplus_rounds = 5;
+const uint32_t scalable_plusplus_oversampling = 2;
+
+/*
+Update the squared distance from each data point to its closest candidate (and the index of that
+candidate), considering only the candidates from first_candidate onwards.
 */
 template <typename T, size_t N>
-uint32_t closest_mean(const std::array<T, N>& point, const std::vector<std::array<T, N>>& means) {
-	assert(!means.empty());
-	T smallest_distance = distance_squared(point, means[0]);
-	typename std::array<T, N>::size_type index = 0;
-	T distance;
-	for (size_t i = 1; i < means.size(); ++i) {
-		distance = distance_squared(point, means[i]);
-		if (distance < smallest_distance) {
-			smallest_distance = distance;
-			index = i;
+void scalable_plusplus_update(const matrix_view<T>& data,
+	const matrix_view<T>& candidates,
+	size_t first_candidate,
+	std::vector<T>& distances,
+	std::vector<uint32_t>& closest) {
+	std::vector<T> scratch;
+	for (size_t first = 0; first < data.rows(); first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, data.rows());
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			for (size_t c = first_candidate; c < candidates.rows(); ++c) {
+				T distance = distance_squared<T, N>(points.row(i - first), candidates.row(c), data.cols());
+				if (distance < distances[i]) {
+					distances[i] = distance;
+					closest[i] = static_cast<uint32_t>(c);
+				}
+			}
 		}
 	}
-	return static_cast<uint32_t>(index);
 }
 
 /*
-Calculate the index of the mean each data point is closest to (euclidean distance).
+The number of points in each block of the k-means|| sampling. Each block draws its random numbers from its
+own engine, seeded from the round and the index of the block, so the blocks can be sampled in any order
+(or in parallel) and pick the same candidates.
 */
-template <typename T, size_t N>
-std::vector<uint32_t> calculate_clusters(
-	const std::vector<std::array<T, N>>& data, const std::vector<std::array<T, N>>& means) {
-	std::vector<uint32_t> clusters;
-	for (auto& point : data) {
-		clusters.push_back(closest_mean(point, means));
+const size_t scalable_plusplus_block = 4096;
+
+/*
+Derive a seed for a part of a calculation (e.g. a restart, or a block of points) from the seed of the
+whole calculation, with the splitmix64 mixing function so that neighbouring parts get unrelated seeds.
+*/
+template <typename S>
+S derived_seed(S seed, uint64_t part) {
+	uint64_t z = static_cast<uint64_t>(seed) + (part + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return static_cast<S>(z ^ (z >> 31));
+}
+
+/*
+Add up the squared distances of the points from begin to end, the share of one block in the cost of the
+k-means|| candidates so far.
+*/
+template <typename T>
+double scalable_plusplus_block_cost(const std::vector<T>& distances, size_t begin, size_t end) {
+	double cost = 0;
+	for (size_t i = begin; i < end; ++i) {
+		cost += static_cast<double>(distances[i]);
 	}
-	return clusters;
+	return cost;
 }
 
 /*
-Calculate means based on data points and their cluster assignments.
+Sample each of the points from begin to end independently as a new candidate, with probability
+proportional to its squared distance from the closest existing candidate, appending the indices of the
+sampled points to picks. The random numbers come from an engine seeded with the round seed and the block.
 */
-template <typename T, size_t N>
-std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>>& data,
-	const std::vector<uint32_t>& clusters,
-	const std::vector<std::array<T, N>>& old_means,
-	uint32_t k) {
-	std::vector<std::array<T, N>> means(k);
-	std::vector<T> count(k, T());
-	for (size_t i = 0; i < std::min(clusters.size(), data.size()); ++i) {
-		auto& mean = means[clusters[i]];
-		count[clusters[i]] += 1;
-		for (size_t j = 0; j < std::min(data[i].size(), mean.size()); ++j) {
-			mean[j] += data[i][j];
+template <typename T, typename S>
+void scalable_plusplus_sample_block(const std::vector<T>& distances,
+	size_t begin,
+	size_t end,
+	double cost,
+	uint32_t oversampling,
+	S round_seed,
+	std::vector<size_t>& picks) {
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(
+		derived_seed(round_seed, begin / scalable_plusplus_block));
+	std::uniform_real_distribution<double> uniform_generator(0, 1);
+	for (size_t i = begin; i < end; ++i) {
+		if (uniform_generator(rand_engine) * cost < oversampling * static_cast<double>(distances[i])) {
+			picks.push_back(i);
 		}
 	}
-	for (size_t i = 0; i < k; ++i) {
-		if (count[i] == 0) {
-			means[i] = old_means[i];
-		} else {
-			for (size_t j = 0; j < means[i].size(); ++j) {
-				means[i][j] /= count[i];
-			}
-		}
+}
+
+/*
+Sample each data point independently as a new candidate, with probability proportional to its squared
+distance from the closest existing candidate, so that around `oversampling` candidates are added. The
+points are sampled in blocks of scalable_plusplus_block, which `random_scalable_plusplus_parallel` samples
+in parallel with the same results.
+*/
+template <typename T, typename R>
+void scalable_plusplus_sample(const matrix_view<T>& data,
+	const std::vector<T>& distances,
+	uint32_t oversampling,
+	R& rand_engine,
+	std::vector<T>& candidates) {
+	double cost = 0;
+	for (size_t begin = 0; begin < data.rows(); begin += scalable_plusplus_block) {
+		cost += scalable_plusplus_block_cost(distances, begin, std::min(begin + scalable_plusplus_block, data.rows()));
+	}
+	if (cost <= 0) {
+		return;
+	}
+	const auto round_seed = rand_engine();
+	std::vector<size_t> picks;
+	for (size_t begin = 0; begin < data.rows(); begin += scalable_plusplus_block) {
+		scalable_plusplus_sample_block(distances, begin, std::min(begin + scalable_plusplus_block, data.rows()), cost,
+			oversampling, round_seed, picks);
+	}
+	for (auto i : picks) {
+		append_row(candidates, data, i);
 	}
-	return means;
 }
 
-template <typename T, size_t N>
-std::vector<T> deltas(
-	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means)
-{
-	std::vector<T> distances;
-	distances.reserve(means.size());
-	assert(old_means.size() == means.size());
-	for (size_t i = 0; i < means.size(); ++i) {
-		distances.push_back(distance(means[i], old_means[i]));
+/*
+Pick a random index with probability proportional to its weight, or uniformly at random if every weight is
+zero, which happens when there are fewer distinct points than means. sums holds the prefix sums.
+*/
+template <typename T, typename R>
+size_t sample_weights(const std::vector<T>& weights, std::vector<accumulate_t<T>>& sums, R& rand_engine) {
+	weighted_prefix_sums(weights, sums);
+	if (!(sums.back() > 0)) {
+		std::uniform_int_distribution<size_t> uniform_generator(0, weights.size() - 1);
+		return uniform_generator(rand_engine);
 	}
-	return distances;
+	return sample_prefix_sums(sums, rand_engine);
 }
 
-template <typename T>
-bool deltas_below_limit(const std::vector<T>& deltas, T min_delta) {
-	for (T d : deltas) {
-		if (d > min_delta) {
-			return false;
+/*
+Recluster the k-means|| candidates down to k means with kmeans++, weighting each candidate by the number
+of data points closest to it.
+*/
+template <typename T, size_t N, typename R>
+std::vector<T> scalable_plusplus_recluster(const matrix_view<T>& candidates,
+	const std::vector<uint32_t>& closest,
+	uint32_t k,
+	R& rand_engine) {
+	const size_t cols = candidates.cols();
+	std::vector<double> weights(candidates.rows(), 0.0);
+	for (auto c : closest) {
+		weights[c] += 1;
+	}
+	std::vector<T> means;
+	means.reserve(k * cols);
+	std::vector<double> sums;
+	// Select the first mean weighted by the number of points closest to each candidate
+	size_t first = sample_weights(weights, sums, rand_engine);
+	append_row(means, candidates.row(first), cols);
+	std::vector<double> distances(candidates.rows());
+	for (size_t c = 0; c < candidates.rows(); ++c) {
+		distances[c] = static_cast<double>(distance_squared<T, N>(candidates.row(c), candidates.row(first), cols));
+	}
+	std::vector<double> probabilities(candidates.rows());
+	for (uint32_t count = 1; count < k; ++count) {
+		for (size_t c = 0; c < candidates.rows(); ++c) {
+			probabilities[c] = weights[c] * distances[c];
+		}
+		size_t next = sample_weights(probabilities, sums, rand_engine);
+		append_row(means, candidates.row(next), cols);
+		for (size_t c = 0; c < candidates.rows(); ++c) {
+			distances[c] = std::min(distances[c], static_cast<double>(distance_squared<T, N>(candidates.row(c), candidates.row(next), cols)));
 		}
 	}
-	return true;
+	return means;
 }
 
-} // namespace details
-
 /*
-clustering_parameters is the configuration used for running the kmeans_lloyd algorithm.
-
-It requires a k value for initialization, and can subsequently be configured with your choice
-of optional parameters, including:
-* Maximum iteration count; the algorithm will terminate if it reaches this iteration count
-  before converging on a solution. The results returned are the means and cluster assignments 
-  calculated in the last iteration before termination.
-* Minimum delta; the algorithm will terminate if the change in position of all means is
-  smaller than the specified distance.
-* Random seed; if present, this will be used in place of `std::random_device` for kmeans++
-  initialization. This can be used to ensure reproducible/deterministic behavior.
+This is an alternate initialization method based on the [k-means||](https://arxiv.org/abs/1203.6402)
+(scalable kmeans++) initialization algorithm. Instead of making k passes over the data to pick one mean
+at a time, it oversamples around 2k candidates in each of a small, fixed number of passes, then
+reclusters the weighted candidates down to k means. This makes it much faster than kmeans++ for large k.
 */
-template <typename T, typename S = uint64_t>
-class clustering_parameters {
-public:
-	explicit clustering_parameters(uint32_t k) :
-	_k(k),
+template <typename T, typename S, size_t N>
+std::vector<T> random_scalable_plusplus(const matrix_view<T>& data, uint32_t k, S seed) {
+	assert(k > 0);
+	assert(data.rows() > 0);
+
+	// If data is empty then return an empty vector
+	if (data.rows() == 0) {
+		return std::vector<T>();
+	}
+
+	// If all of the data points are identical then the distances will be zero, just fill the starting means with copies
+	// of the first element
+	if (all_rows_equal(data)) {
+		return repeat_first_row(data, k);
+	}
+
+	const size_t cols = data.cols();
+	std::vector<T> candidates;
+	// Using a very simple PRBS generator, parameters selected according to
+	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+	// Select first candidate at random from the set
+	{
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.rows() - 1);
+		append_row(candidates, data, uniform_generator(rand_engine));
+	}
+
+	std::vector<T> distances(data.rows(), std::numeric_limits<T>::max());
+	std::vector<uint32_t> closest(data.rows(), 0);
+	size_t updated = 0;
+	for (int round = 0; round < scalable_plusplus_rounds; ++round) {
+		scalable_plusplus_update<T, N>(data, view_of(candidates, cols), updated, distances, closest);
+		updated = candidates.size() / cols;
+		scalable_plusplus_sample(data, distances, scalable_plusplus_oversampling * k, rand_engine, candidates);
+	}
+	// Top up with kmeans++ picks in the unlikely case that too few candidates were sampled
+	std::vector<accumulate_t<T>> sums;
+	while (candidates.size() / cols < k) {
+		scalable_plusplus_update<T, N>(data, view_of(candidates, cols), updated, distances, closest);
+		updated = candidates.size() / cols;
+		append_row(candidates, data, sample_weights(distances, sums, rand_engine));
+	}
+	scalable_plusplus_update<T, N>(data, view_of(candidates, cols), updated, distances, closest);
+	return scalable_plusplus_recluster<T, N>(view_of(candidates, cols), closest, k, rand_engine);
+}
+
+/*
+k-means|| initialization for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::vector<std::array<T, N>> random_scalable_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, S seed) {
+	return to_arrays<T, N>(random_scalable_plusplus<T, S, N>(view_of(data), k, seed));
+}
+
+/*
+The length of the Markov chain used to pick each mean in AFK-MC² seeding. Bachem et al. found that a
+chain of 200 steps gives results close to kmeans++ regardless of the size of the data set.
+*/
+const uint32_t afkmc2_chain_length = 200;
+
+/*
+This is an alternate initialization method based on [AFK-MC²](https://arxiv.org/abs/1602.03330)
+(assumption-free k-MC²). After a single pass over the data to build a proposal distribution from the first
+mean, each of the remaining means is picked by a short Markov chain which approximates kmeans++ sampling.
+Each step of the chain only needs the distance from one point to the means chosen so far, so seeding is
+O(n + m * k^2) for a chain length of m, rather than the O(n * k) of kmeans++.
+*/
+template <typename T, typename S, size_t N>
+std::vector<T> random_afkmc2(const matrix_view<T>& data, uint32_t k, S seed) {
+	assert(k > 0);
+	assert(data.rows() > 0);
+
+	// If data is empty then return an empty vector
+	if (data.rows() == 0) {
+		return std::vector<T>();
+	}
+
+	// If all of the data points are identical then the distances will be zero, just fill the starting means with copies
+	// of the first element
+	if (all_rows_equal(data)) {
+		return repeat_first_row(data, k);
+	}
+
+	const size_t cols = data.cols();
+	std::vector<T> means;
+	means.reserve(k * cols);
+	// Using a very simple PRBS generator, parameters selected according to
+	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+	// Select first mean at random from the set
+	{
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.rows() - 1);
+		append_row(means, data, uniform_generator(rand_engine));
+	}
+
+	// The proposal distribution is a mix of the distance from the first mean and the uniform distribution
+	std::vector<double> proposal(data.rows());
+	double total = 0;
+	std::vector<T> scratch;
+	for (size_t first = 0; first < data.rows(); first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, data.rows());
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			proposal[i] = static_cast<double>(distance_squared<T, N>(points.row(i - first), &means[0], cols));
+			total += proposal[i];
+		}
+	}
+	for (auto& q : proposal) {
+		q = 0.5 * q / total + 0.5 / static_cast<double>(data.rows());
+	}
+	std::discrete_distribution<size_t> generator(proposal.begin(), proposal.end());
+	std::uniform_real_distribution<double> uniform_generator(0, 1);
+	auto closest_distance = [&data, &means, &scratch, cols](size_t i) {
+		const T* point = gather_rows(data, i, i + 1, scratch).row(0);
+		T closest = distance_squared<T, N>(point, &means[0], cols);
+		for (size_t m = 1; m < means.size() / cols; ++m) {
+			closest = std::min(closest, distance_squared<T, N>(point, &means[m * cols], cols));
+		}
+		return static_cast<double>(closest);
+	};
+
+	for (uint32_t count = 1; count < k; ++count) {
+		size_t x = generator(rand_engine);
+		double x_distance = closest_distance(x);
+		for (uint32_t step = 1; step < afkmc2_chain_length; ++step) {
+			size_t y = generator(rand_engine);
+			double y_distance = closest_distance(y);
+			// Metropolis-Hastings acceptance, rearranged to avoid dividing by a zero distance
+			if (uniform_generator(rand_engine) * x_distance * proposal[y] < y_distance * proposal[x]) {
+				x = y;
+				x_distance = y_distance;
+			}
+		}
+		append_row(means, data, x);
+	}
+	return means;
+}
+
+/*
+AFK-MC² initialization for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::vector<std::array<T, N>> random_afkmc2(const std::vector<std::array<T, N>>& data, uint32_t k, S seed) {
+	return to_arrays<T, N>(random_afkmc2<T, S, N>(view_of(data), k, seed));
+}
+
+/*
+Pick the initial means using the method selected in the clustering parameters, writing them to means.
+kmeans++ (the default) reuses the storage in means and scratch, so it doesn't allocate once they are
+large enough; the other methods allocate their candidates and proposal distributions on each call.
+*/
+template <typename T, typename S, size_t N>
+void initial_means(
+	const matrix_view<T>& data, uint32_t k, S seed, initialization method, std::vector<T>& means, seeding_buffers<T>& scratch) {
+	if (method == initialization::scalable_plusplus) {
+		means = random_scalable_plusplus<T, S, N>(data, k, seed);
+	} else if (method == initialization::afkmc2) {
+		means = random_afkmc2<T, S, N>(data, k, seed);
+	} else {
+		random_plusplus<T, S, N>(data, k, seed, means, scratch);
+	}
+}
+
+/*
+Pick the initial means using the method selected in the clustering parameters.
+*/
+template <typename T, typename S, size_t N>
+std::vector<T> initial_means(const matrix_view<T>& data, uint32_t k, S seed, initialization method) {
+	std::vector<T> means;
+	seeding_buffers<T> scratch;
+	initial_means<T, S, N>(data, k, seed, method, means, scratch);
+	return means;
+}
+
+/*
+Pick the initial means for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S, size_t N>
+std::vector<std::array<T, N>> initial_means(
+	const std::vector<std::array<T, N>>& data, uint32_t k, S seed, initialization method) {
+	return to_arrays<T, N>(initial_means<T, S, N>(view_of(data), k, seed, method));
+}
+
+/*
+Calculate the index of the mean a particular data point is closest to (euclidean distance)
+*/
+template <typename T, size_t N>
+uint32_t closest_mean(const std::array<T, N>& point, const std::vector<std::array<T, N>>& means) {
+	assert(!means.empty());
+	T smallest_distance = distance_squared(point, means[0]);
+	typename std::array<T, N>::size_type index = 0;
+	T distance;
+	for (size_t i = 1; i < means.size(); ++i) {
+		distance = distance_squared(point, means[i]);
+		if (distance < smallest_distance) {
+			smallest_distance = distance;
+			index = i;
+		}
+	}
+	return static_cast<uint32_t>(index);
+}
+
+/*
+Calculate the index of the mean a particular data point is closest to (euclidean distance), with the point
+and the means held in flat buffers. The squared distance to that mean is written to smallest_distance.
+*/
+template <typename T, size_t N>
+uint32_t closest_mean(const T* point, const matrix_view<T>& means, T& smallest_distance) {
+	assert(means.rows() > 0);
+	smallest_distance = distance_squared<T, N>(point, means.row(0), means.cols());
+	uint32_t index = 0;
+	for (size_t i = 1; i < means.rows(); ++i) {
+		T distance = distance_squared<T, N>(point, means.row(i), means.cols());
+		if (distance < smallest_distance) {
+			smallest_distance = distance;
+			index = static_cast<uint32_t>(i);
+		}
+	}
+	return index;
+}
+
+template <typename T, size_t N>
+uint32_t closest_mean(const T* point, const matrix_view<T>& means) {
+	T smallest_distance;
+	return closest_mean<T, N>(point, means, smallest_distance);
+}
+
+/*
+Explicit SIMD kernels for finding the closest mean to a point with float and double data on x86, chosen
+at runtime based on the instruction sets the CPU supports. Other data types and platforms use the generic
+`closest_mean`. Defining DKM_DISABLE_SIMD before including this header disables the kernels.
+*/
+enum class simd_level {
+	none,
+	sse2,
+	avx2,
+	avx512
+};
+
+/*
+Detect the widest instruction set supported by both the CPU and the operating system.
+*/
+inline simd_level detect_simd_level() {
+#if defined(DKM_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+	__cpuid(info, 1);
+	const bool sse2 = (info[3] & (1 << 26)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool avx2 = false;
+	bool avx512 = false;
+	if (max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+	if (avx512 && (xcr0 & 0xe6) == 0xe6) {
+		return simd_level::avx512;
+	}
+	if (avx && avx2 && (xcr0 & 0x6) == 0x6) {
+		return simd_level::avx2;
+	}
+	if (sse2) {
+		return simd_level::sse2;
+	}
+#elif defined(DKM_SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return simd_level::avx512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return simd_level::avx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return simd_level::sse2;
+	}
+#endif
+	return simd_level::none;
+}
+
+/*
+The widest instruction set supported, detected once.
+*/
+inline simd_level supported_simd_level() {
+	static const simd_level level = detect_simd_level();
+	return level;
+}
+
+/*
+The fewest means the SIMD kernels are used for; below this the cost of reducing the lanes to a single
+closest mean outweighs the speedup.
+*/
+const size_t simd_min_means = 8;
+
+/*
+The SIMD level to use when finding the closest of k means.
+*/
+inline simd_level simd_level_for(size_t k) {
+	return k < simd_min_means ? simd_level::none : supported_simd_level();
+}
+
+/*
+The number of values of type T held by a vector register at the given level.
+*/
+template <typename T>
+size_t simd_lanes(simd_level level) {
+	const size_t bytes = level == simd_level::avx512 ? 64 : level == simd_level::avx2 ? 32 : 16;
+	return bytes / sizeof(T);
+}
+
+/*
+The means laid out for the SIMD kernels; transposed into one row of padded_k values per dimension so the kernels can load
+the same dimension of several means at once. The number of means is padded to a multiple of the vector
+width with infinitely distant padding means.
+*/
+template <typename T>
+struct simd_means {
+	size_t padded_k;
+	std::vector<T> values;
+};
+
+/*
+Lay out the means for the SIMD kernels at the given level. This is done once per iteration, reusing the
+storage in prepared.
+*/
+template <typename T>
+void simd_prepare_means(const matrix_view<T>& means, simd_level level, simd_means<T>& prepared) {
+	const size_t lanes = simd_lanes<T>(level);
+	prepared.padded_k = (means.rows() + lanes - 1) / lanes * lanes;
+	prepared.values.assign(means.cols() * prepared.padded_k, std::numeric_limits<T>::infinity());
+	for (size_t j = 0; j < means.rows(); ++j) {
+		for (size_t d = 0; d < means.cols(); ++d) {
+			prepared.values[d * prepared.padded_k + j] = means.row(j)[d];
+		}
+	}
+}
+
+template <typename T>
+simd_means<T> simd_prepare_means(const matrix_view<T>& means, simd_level level) {
+	simd_means<T> prepared;
+	simd_prepare_means(means, level, prepared);
+	return prepared;
+}
+
+template <typename T, size_t N>
+simd_means<T> simd_prepare_means(const std::vector<std::array<T, N>>& means, simd_level level) {
+	return simd_prepare_means(view_of(means), level);
+}
+
+#if defined(DKM_SIMD_X86)
+/*
+The kernels compare a vector of means at a time against the point, keeping the closest distance and its
+index in each lane with a branchless compare and blend. The squared distances are summed in the same
+order with separate multiplies and adds, so they are identical to `distance_squared`. At the end the
+lanes are reduced to the lowest index with the closest distance, matching `closest_mean` on ties.
+*/
+template <size_t N>
+DKM_SIMD_TARGET("sse2")
+uint32_t closest_mean_sse2(const float* point, const float* means, size_t padded_k, size_t cols) {
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m128 best = _mm_set1_ps(std::numeric_limits<float>::infinity());
+	__m128i best_index = _mm_setzero_si128();
+	__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i step = _mm_set1_epi32(4);
+	for (size_t c = 0; c < padded_k; c += 4) {
+		__m128 sum = _mm_setzero_ps();
+		for (size_t d = 0; d < dimensions; ++d) {
+			__m128 delta = _mm_sub_ps(_mm_set1_ps(point[d]), _mm_loadu_ps(means + d * padded_k + c));
+			sum = _mm_add_ps(sum, _mm_mul_ps(delta, delta));
+		}
+		__m128i less = _mm_castps_si128(_mm_cmplt_ps(sum, best));
+		best = _mm_min_ps(sum, best);
+		best_index = _mm_or_si128(_mm_and_si128(less, index), _mm_andnot_si128(less, best_index));
+		index = _mm_add_epi32(index, step);
+	}
+	__m128 closest = _mm_min_ps(best, _mm_shuffle_ps(best, best, _MM_SHUFFLE(2, 3, 0, 1)));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m128i equal = _mm_castps_si128(_mm_cmpeq_ps(best, closest));
+	__m128i indices = _mm_or_si128(
+		_mm_and_si128(equal, best_index), _mm_andnot_si128(equal, _mm_set1_epi32(std::numeric_limits<int32_t>::max())));
+	// SSE2 has no unsigned or signed integer minimum, so select it with a compare
+	__m128i swapped = _mm_shuffle_epi32(indices, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128i lower = _mm_cmplt_epi32(swapped, indices);
+	indices = _mm_or_si128(_mm_and_si128(lower, swapped), _mm_andnot_si128(lower, indices));
+	swapped = _mm_shuffle_epi32(indices, _MM_SHUFFLE(1, 0, 3, 2));
+	lower = _mm_cmplt_epi32(swapped, indices);
+	indices = _mm_or_si128(_mm_and_si128(lower, swapped), _mm_andnot_si128(lower, indices));
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(indices));
+}
+
+template <size_t N>
+DKM_SIMD_TARGET("sse2")
+uint32_t closest_mean_sse2(const double* point, const double* means, size_t padded_k, size_t cols) {
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m128d best = _mm_set1_pd(std::numeric_limits<double>::infinity());
+	__m128d best_index = _mm_setzero_pd();
+	__m128d index = _mm_setr_pd(0, 1);
+	const __m128d step = _mm_set1_pd(2);
+	for (size_t c = 0; c < padded_k; c += 2) {
+		__m128d sum = _mm_setzero_pd();
+		for (size_t d = 0; d < dimensions; ++d) {
+			__m128d delta = _mm_sub_pd(_mm_set1_pd(point[d]), _mm_loadu_pd(means + d * padded_k + c));
+			sum = _mm_add_pd(sum, _mm_mul_pd(delta, delta));
+		}
+		__m128d less = _mm_cmplt_pd(sum, best);
+		best = _mm_min_pd(sum, best);
+		best_index = _mm_or_pd(_mm_and_pd(less, index), _mm_andnot_pd(less, best_index));
+		index = _mm_add_pd(index, step);
+	}
+	__m128d closest = _mm_min_pd(best, _mm_shuffle_pd(best, best, 1));
+	__m128d equal = _mm_cmpeq_pd(best, closest);
+	__m128d indices = _mm_or_pd(
+		_mm_and_pd(equal, best_index), _mm_andnot_pd(equal, _mm_set1_pd(std::numeric_limits<double>::infinity())));
+	indices = _mm_min_pd(indices, _mm_shuffle_pd(indices, indices, 1));
+	return static_cast<uint32_t>(_mm_cvtsd_f64(indices));
+}
+
+template <size_t N>
+DKM_SIMD_TARGET("avx2")
+uint32_t closest_mean_avx2(const float* point, const float* means, size_t padded_k, size_t cols) {
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m256 best = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+	__m256i best_index = _mm256_setzero_si256();
+	__m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i step = _mm256_set1_epi32(8);
+	for (size_t c = 0; c < padded_k; c += 8) {
+		__m256 sum = _mm256_setzero_ps();
+		for (size_t d = 0; d < dimensions; ++d) {
+			__m256 delta = _mm256_sub_ps(_mm256_set1_ps(point[d]), _mm256_loadu_ps(means + d * padded_k + c));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(delta, delta));
+		}
+		__m256 less = _mm256_cmp_ps(sum, best, _CMP_LT_OQ);
+		best = _mm256_blendv_ps(best, sum, less);
+		best_index = _mm256_blendv_epi8(best_index, index, _mm256_castps_si256(less));
+		index = _mm256_add_epi32(index, step);
+	}
+	__m128 closest = _mm_min_ps(_mm256_castps256_ps128(best), _mm256_extractf128_ps(best, 1));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(2, 3, 0, 1)));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m256 equal = _mm256_cmp_ps(best, _mm256_insertf128_ps(_mm256_castps128_ps256(closest), closest, 1), _CMP_EQ_OQ);
+	__m256i indices = _mm256_blendv_epi8(_mm256_set1_epi32(-1), best_index, _mm256_castps_si256(equal));
+	__m128i lowest = _mm_min_epu32(_mm256_castsi256_si128(indices), _mm256_extracti128_si256(indices, 1));
+	lowest = _mm_min_epu32(lowest, _mm_shuffle_epi32(lowest, _MM_SHUFFLE(2, 3, 0, 1)));
+	lowest = _mm_min_epu32(lowest, _mm_shuffle_epi32(lowest, _MM_SHUFFLE(1, 0, 3, 2)));
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(lowest));
+}
+
+template <size_t N>
+DKM_SIMD_TARGET("avx2")
+uint32_t closest_mean_avx2(const double* point, const double* means, size_t padded_k, size_t cols) {
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m256d best = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+	__m256d best_index = _mm256_setzero_pd();
+	__m256d index = _mm256_setr_pd(0, 1, 2, 3);
+	const __m256d step = _mm256_set1_pd(4);
+	for (size_t c = 0; c < padded_k; c += 4) {
+		__m256d sum = _mm256_setzero_pd();
+		for (size_t d = 0; d < dimensions; ++d) {
+			__m256d delta = _mm256_sub_pd(_mm256_set1_pd(point[d]), _mm256_loadu_pd(means + d * padded_k + c));
+			sum = _mm256_add_pd(sum, _mm256_mul_pd(delta, delta));
+		}
+		__m256d less = _mm256_cmp_pd(sum, best, _CMP_LT_OQ);
+		best = _mm256_blendv_pd(best, sum, less);
+		best_index = _mm256_blendv_pd(best_index, index, less);
+		index = _mm256_add_pd(index, step);
+	}
+	__m128d closest = _mm_min_pd(_mm256_castpd256_pd128(best), _mm256_extractf128_pd(best, 1));
+	closest = _mm_min_pd(closest, _mm_shuffle_pd(closest, closest, 1));
+	__m256d equal = _mm256_cmp_pd(best, _mm256_insertf128_pd(_mm256_castpd128_pd256(closest), closest, 1), _CMP_EQ_OQ);
+	__m256d indices = _mm256_blendv_pd(_mm256_set1_pd(std::numeric_limits<double>::infinity()), best_index, equal);
+	__m128d lowest = _mm_min_pd(_mm256_castpd256_pd128(indices), _mm256_extractf128_pd(indices, 1));
+	lowest = _mm_min_pd(lowest, _mm_shuffle_pd(lowest, lowest, 1));
+	return static_cast<uint32_t>(_mm_cvtsd_f64(lowest));
+}
+
+/*
+One 256-bit half of a 512-bit register. A masked extract is used because GCC 12 warns about the undefined
+source operand of the unmasked extract and the casts.
+*/
+template <int Half>
+DKM_SIMD_TARGET("avx512f")
+inline __m256d avx512_half(__m512d values) {
+	return _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xf, values, Half);
+}
+
+template <size_t N>
+DKM_SIMD_TARGET("avx512f,avx2")
+uint32_t closest_mean_avx512(const float* point, const float* means, size_t padded_k, size_t cols) {
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m512 best = _mm512_set1_ps(std::numeric_limits<float>::infinity());
+	__m512i best_index = _mm512_setzero_si512();
+	__m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512i step = _mm512_set1_epi32(16);
+	for (size_t c = 0; c < padded_k; c += 16) {
+		__m512 sum = _mm512_setzero_ps();
+		for (size_t d = 0; d < dimensions; ++d) {
+			__m512 delta = _mm512_sub_ps(_mm512_set1_ps(point[d]), _mm512_loadu_ps(means + d * padded_k + c));
+			sum = _mm512_add_ps(sum, _mm512_mul_ps(delta, delta));
+		}
+		__mmask16 less = _mm512_cmp_ps_mask(sum, best, _CMP_LT_OQ);
+		best = _mm512_mask_blend_ps(less, best, sum);
+		best_index = _mm512_mask_blend_epi32(less, best_index, index);
+		index = _mm512_add_epi32(index, step);
+	}
+	__m256 half = _mm256_min_ps(_mm256_castpd_ps(avx512_half<0>(_mm512_castps_pd(best))),
+		_mm256_castpd_ps(avx512_half<1>(_mm512_castps_pd(best))));
+	__m128 closest = _mm_min_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(2, 3, 0, 1)));
+	closest = _mm_min_ps(closest, _mm_shuffle_ps(closest, closest, _MM_SHUFFLE(1, 0, 3, 2)));
+	__mmask16 equal = _mm512_cmp_ps_mask(best, _mm512_set1_ps(_mm_cvtss_f32(closest)), _CMP_EQ_OQ);
+	__m512i indices = _mm512_mask_blend_epi32(equal, _mm512_set1_epi32(-1), best_index);
+	__m256i half_indices = _mm256_min_epu32(_mm256_castpd_si256(avx512_half<0>(_mm512_castsi512_pd(indices))),
+		_mm256_castpd_si256(avx512_half<1>(_mm512_castsi512_pd(indices))));
+	__m128i lowest = _mm_min_epu32(_mm256_castsi256_si128(half_indices), _mm256_extracti128_si256(half_indices, 1));
+	lowest = _mm_min_epu32(lowest, _mm_shuffle_epi32(lowest, _MM_SHUFFLE(2, 3, 0, 1)));
+	lowest = _mm_min_epu32(lowest, _mm_shuffle_epi32(lowest, _MM_SHUFFLE(1, 0, 3, 2)));
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(lowest));
+}
+
+template <size_t N>
+DKM_SIMD_TARGET("avx512f,avx2")
+uint32_t closest_mean_avx512(const double* point, const double* means, size_t padded_k, size_t cols) {
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m512d best = _mm512_set1_pd(std::numeric_limits<double>::infinity());
+	__m512d best_index = _mm512_setzero_pd();
+	__m512d index = _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m512d step = _mm512_set1_pd(8);
+	for (size_t c = 0; c < padded_k; c += 8) {
+		__m512d sum = _mm512_setzero_pd();
+		for (size_t d = 0; d < dimensions; ++d) {
+			__m512d delta = _mm512_sub_pd(_mm512_set1_pd(point[d]), _mm512_loadu_pd(means + d * padded_k + c));
+			sum = _mm512_add_pd(sum, _mm512_mul_pd(delta, delta));
+		}
+		__mmask8 less = _mm512_cmp_pd_mask(sum, best, _CMP_LT_OQ);
+		best = _mm512_mask_blend_pd(less, best, sum);
+		best_index = _mm512_mask_blend_pd(less, best_index, index);
+		index = _mm512_add_pd(index, step);
+	}
+	__m256d half = _mm256_min_pd(avx512_half<0>(best), avx512_half<1>(best));
+	__m128d closest = _mm_min_pd(_mm256_castpd256_pd128(half), _mm256_extractf128_pd(half, 1));
+	closest = _mm_min_pd(closest, _mm_shuffle_pd(closest, closest, 1));
+	__mmask8 equal = _mm512_cmp_pd_mask(best, _mm512_set1_pd(_mm_cvtsd_f64(closest)), _CMP_EQ_OQ);
+	__m512d indices = _mm512_mask_blend_pd(equal, _mm512_set1_pd(std::numeric_limits<double>::infinity()), best_index);
+	__m256d half_indices = _mm256_min_pd(avx512_half<0>(indices), avx512_half<1>(indices));
+	__m128d lowest = _mm_min_pd(_mm256_castpd256_pd128(half_indices), _mm256_extractf128_pd(half_indices, 1));
+	lowest = _mm_min_pd(lowest, _mm_shuffle_pd(lowest, lowest, 1));
+	return static_cast<uint32_t>(_mm_cvtsd_f64(lowest));
+}
+#endif
+
+/*
+Calculate the index of the mean a particular data point is closest to using the SIMD kernel for the given
+level, with the means laid out by `simd_prepare_means` for the same level.
+*/
+template <size_t N, typename T>
+uint32_t closest_mean_simd(const T* point, size_t cols, const simd_means<T>& prepared, simd_level level) {
+	switch (level) {
+#if defined(DKM_SIMD_X86)
+	case simd_level::avx512:
+		return closest_mean_avx512<N>(point, prepared.values.data(), prepared.padded_k, cols);
+	case simd_level::avx2:
+		return closest_mean_avx2<N>(point, prepared.values.data(), prepared.padded_k, cols);
+	case simd_level::sse2:
+		return closest_mean_sse2<N>(point, prepared.values.data(), prepared.padded_k, cols);
+#endif
+	default:
+		break;
+	}
+	(void)point;
+	(void)cols;
+	(void)prepared;
+	assert(false); // the generic closest_mean should be used when there is no SIMD support
+	return 0;
+}
+
+template <typename T, size_t N>
+uint32_t closest_mean_simd(const std::array<T, N>& point, const simd_means<T>& prepared, simd_level level) {
+	return closest_mean_simd<N>(point.data(), N, prepared, level);
+}
+
+/*
+Whether the SIMD kernels support the data type T.
+*/
+template <typename T>
+struct is_simd_type : std::integral_constant<bool, std::is_same<T, float>::value || std::is_same<T, double>::value> {};
+
+/*
+Calculate the index of the mean each data point from begin to end is closest to (euclidean distance). If
+distances isn't null, the squared distance from each point to that mean is stored in it as well. The
+prepared means and SIMD level are only used by the SIMD kernels.
+*/
+template <typename T, size_t N>
+typename std::enable_if<!is_simd_type<T>::value>::type calculate_clusters_range(const matrix_view<T>& data,
+	const matrix_view<T>& means,
+	const simd_means<T>&,
+	simd_level,
+	size_t begin,
+	size_t end,
+	uint32_t* clusters,
+	T* distances) {
+	T distance;
+	std::vector<T> scratch;
+	for (size_t first = begin; first < end; first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, end);
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			clusters[i] = closest_mean<T, N>(points.row(i - first), means, distances ? distances[i] : distance);
+		}
+	}
+}
+
+/*
+Calculate the index of the mean each data point from begin to end is closest to (euclidean distance),
+with the SIMD kernels at the given level and the means laid out in prepared. The kernels only find the
+index, so when distances isn't null the distance to the mean is calculated separately, while the point
+is still in cache.
+*/
+template <typename T, size_t N>
+typename std::enable_if<is_simd_type<T>::value>::type calculate_clusters_range(const matrix_view<T>& data,
+	const matrix_view<T>& means,
+	const simd_means<T>& prepared,
+	simd_level level,
+	size_t begin,
+	size_t end,
+	uint32_t* clusters,
+	T* distances) {
+	T distance;
+	std::vector<T> scratch;
+	for (size_t first = begin; first < end; first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, end);
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			const T* point = points.row(i - first);
+			if (level == simd_level::none) {
+				clusters[i] = closest_mean<T, N>(point, means, distances ? distances[i] : distance);
+				continue;
+			}
+			clusters[i] = closest_mean_simd<N>(point, data.cols(), prepared, level);
+			if (distances) {
+				distances[i] = distance_squared<T, N>(point, means.row(clusters[i]), data.cols());
+			}
+		}
+	}
+}
+
+/*
+Calculate the index of the mean each data point is closest to (euclidean distance), writing them to
+clusters, and the squared distances to them to distances if it isn't null. Uses the widest SIMD kernel the
+CPU supports when there are enough means, with the means laid out in prepared.
+*/
+template <typename T, size_t N>
+void calculate_clusters(const matrix_view<T>& data,
+	const matrix_view<T>& means,
+	std::vector<uint32_t>& clusters,
+	simd_means<T>& prepared,
+	T* distances = nullptr) {
+	clusters.resize(data.rows());
+	const simd_level level = is_simd_type<T>::value ? simd_level_for(means.rows()) : simd_level::none;
+	if (level != simd_level::none) {
+		simd_prepare_means(means, level, prepared);
+	}
+	calculate_clusters_range<T, N>(data, means, prepared, level, 0, data.rows(), clusters.data(), distances);
+}
+
+/*
+Calculate the index of the mean each data point is closest to (euclidean distance).
+*/
+template <typename T, size_t N>
+std::vector<uint32_t> calculate_clusters(const matrix_view<T>& data, const matrix_view<T>& means) {
+	std::vector<uint32_t> clusters;
+	simd_means<T> prepared;
+	calculate_clusters<T, N>(data, means, clusters, prepared);
+	return clusters;
+}
+
+template <typename T, size_t N>
+std::vector<uint32_t> calculate_clusters(
+	const std::vector<std::array<T, N>>& data, const std::vector<std::array<T, N>>& means) {
+	return calculate_clusters<T, N>(view_of(data), view_of(means));
+}
+
+template <typename T, size_t N>
+void deltas(const matrix_view<T>& old_means, const matrix_view<T>& means, std::vector<T>& distances) {
+	assert(old_means.rows() == means.rows());
+	distances.resize(means.rows());
+	for (size_t i = 0; i < means.rows(); ++i) {
+		distances[i] = static_cast<T>(std::sqrt(distance_squared<T, N>(means.row(i), old_means.row(i), means.cols())));
+	}
+}
+
+template <typename T, size_t N>
+std::vector<T> deltas(const matrix_view<T>& old_means, const matrix_view<T>& means) {
+	std::vector<T> distances;
+	deltas<T, N>(old_means, means, distances);
+	return distances;
+}
+
+template <typename T, size_t N>
+std::vector<T> deltas(
+	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means)
+{
+	return deltas<T, N>(view_of(old_means), view_of(means));
+}
+
+template <typename T>
+bool deltas_below_limit(const std::vector<T>& deltas, T min_delta) {
+	for (T d : deltas) {
+		if (d > min_delta) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+Check whether every mean has moved by no more than min_delta, using distances to hold the deltas.
+*/
+template <typename T, size_t N>
+bool deltas_below_limit(const matrix_view<T>& old_means, const matrix_view<T>& means, T min_delta, std::vector<T>& distances) {
+	deltas<T, N>(old_means, means, distances);
+	return deltas_below_limit(distances, min_delta);
+}
+
+/*
+The floating point type used to hold distance bounds in the accelerated algorithms. Integer data types
+use double so that the square root of the distance isn't truncated, which would break the bounds.
+*/
+template <typename T>
+using bound_t = typename std::conditional<std::is_floating_point<T>::value, T, double>::type;
+
+/*
+Calculate the (non-squared) distance between two points as a bound_t.
+*/
+template <typename T, size_t N>
+bound_t<T> bound_distance(const std::array<T, N>& point_a, const std::array<T, N>& point_b) {
+	return std::sqrt(static_cast<bound_t<T>>(distance_squared(point_a, point_b)));
+}
+
+/*
+Tile sizes for the blocked distance engine. Each micro-kernel call calculates the dot products between a
+tile of 4 points and 16 means in registers. The tiles are grouped into blocks of 64 points and panels of
+256 means so that the transposed means in a panel stay in cache while a block of points is processed.
+*/
+const size_t blocked_point_tile = 4;
+const size_t blocked_mean_tile = 16;
+const size_t blocked_point_block = 64;
+const size_t blocked_mean_panel = 256;
+
+/*
+The type the blocked distance engine calculates the norms and dot products in. The expansion cancels
+badly when the points are far from the origin, so float data is calculated in double; in float the
+rounding error swamps the gaps between the means and most points fall back to `closest_mean`.
+*/
+template <typename T>
+using blocked_t = accumulate_t<T>;
+
+/*
+The means laid out for the blocked distance engine; transposed into one row of padded_k values per dimension so the
+micro-kernel can stream a tile of means for each dimension, along with their squared norms and the largest
+of them, which bounds the rounding error of the expansion. The number of means is padded to a multiple of
+the mean tile size with padding means which are never closest.
+*/
+template <typename T>
+struct blocked_means {
+	size_t padded_k;
+	std::vector<blocked_t<T>> transposed;
+	std::vector<blocked_t<T>> norms;
+	blocked_t<T> max_norm;
+};
+
+/*
+Calculate the squared norm of each data point, writing them to norms. These don't change between
+iterations, so they are only calculated once.
+*/
+template <typename T, size_t N>
+void point_norms(const matrix_view<T>& data, std::vector<blocked_t<T>>& norms) {
+	const size_t dimension = flat_dimension<N>(data.cols());
+	norms.resize(data.rows());
+	std::vector<T> scratch;
+	for (size_t first = 0; first < data.rows(); first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, data.rows());
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			const T* point = points.row(i - first);
+			accumulate_t<T> norm = accumulate_t<T>();
+			for (size_t d = 0; d < dimension; ++d) {
+				norm += static_cast<accumulate_t<T>>(point[d]) * static_cast<accumulate_t<T>>(point[d]);
+			}
+			norms[i] = static_cast<blocked_t<T>>(norm);
+		}
+	}
+}
+
+template <typename T, size_t N>
+std::vector<blocked_t<T>> point_norms(const matrix_view<T>& data) {
+	std::vector<blocked_t<T>> norms;
+	point_norms<T, N>(data, norms);
+	return norms;
+}
+
+/*
+Lay out the means for the blocked distance engine. This is done once per iteration, reusing the storage
+in prepared.
+*/
+template <typename T, size_t N>
+void blocked_prepare_means(const matrix_view<T>& means, blocked_means<T>& prepared) {
+	using A = blocked_t<T>;
+	const size_t dimension = flat_dimension<N>(means.cols());
+	prepared.padded_k = (means.rows() + blocked_mean_tile - 1) / blocked_mean_tile * blocked_mean_tile;
+	prepared.transposed.assign(dimension * prepared.padded_k, A());
+	prepared.norms.assign(prepared.padded_k, std::numeric_limits<A>::max());
+	prepared.max_norm = A();
+	for (size_t j = 0; j < means.rows(); ++j) {
+		accumulate_t<T> norm = accumulate_t<T>();
+		for (size_t d = 0; d < dimension; ++d) {
+			prepared.transposed[d * prepared.padded_k + j] = static_cast<A>(means.row(j)[d]);
+			norm += static_cast<accumulate_t<T>>(means.row(j)[d]) * static_cast<accumulate_t<T>>(means.row(j)[d]);
+		}
+		prepared.norms[j] = static_cast<A>(norm);
+		prepared.max_norm = std::max(prepared.max_norm, prepared.norms[j]);
+	}
+}
+
+template <typename T, size_t N>
+blocked_means<T> blocked_prepare_means(const matrix_view<T>& means) {
+	blocked_means<T> prepared;
+	blocked_prepare_means<T, N>(means, prepared);
+	return prepared;
+}
+
+/*
+Micro-kernel for the blocked distance engine; calculate the dot products between a tile of R points
+starting at p0 and a tile of means, as a rank one update of the tile for each dimension. The tile is
+added up in a local array, which the compiler can keep in vector registers, and written to dots at the end.
+*/
+template <size_t R, typename T, size_t N>
+void blocked_dot_tile(const matrix_view<T>& data,
+	size_t p0,
+	const blocked_t<T>* transposed,
+	size_t padded_k,
+	blocked_t<T> (&dots)[blocked_point_tile][blocked_mean_tile]) {
+	using A = blocked_t<T>;
+	const size_t dimension = flat_dimension<N>(data.cols());
+	const T* points[R];
+	for (size_t p = 0; p < R; ++p) {
+		points[p] = data.row(p0 + p);
+	}
+	A tile[R][blocked_mean_tile] = {};
+	for (size_t d = 0; d < dimension; ++d) {
+		const A* row = transposed + d * padded_k;
+		for (size_t p = 0; p < R; ++p) {
+			const A x = static_cast<A>(points[p][d]);
+			for (size_t c = 0; c < blocked_mean_tile; ++c) {
+				tile[p][c] += x * row[c];
+			}
+		}
+	}
+	for (size_t p = 0; p < R; ++p) {
+		for (size_t c = 0; c < blocked_mean_tile; ++c) {
+			dots[p][c] = tile[p][c];
+		}
+	}
+}
+
+/*
+The SIMD level the blocked distance engine's micro-kernel uses. The kernels calculate in double, so they
+are only used when blocked_t<T> is double, and there are only AVX2 and AVX-512 kernels; with SSE2 the
+generic kernel is just as fast.
+*/
+template <typename T>
+simd_level blocked_simd_level() {
+	const simd_level level = std::is_same<blocked_t<T>, double>::value ? supported_simd_level() : simd_level::none;
+	return level == simd_level::sse2 ? simd_level::none : level;
+}
+
+#if defined(DKM_SIMD_X86)
+/*
+SIMD micro-kernels for the blocked distance engine; calculate the dot products between the
+blocked_point_tile points and a tile of means, like `blocked_dot_tile`, with the whole tile held in
+vector registers. A short tile repeats one of its points, and the extra rows of dots are ignored. They
+are written out for tiles of 4 points by 16 means.
+*/
+template <typename T, size_t N>
+DKM_SIMD_TARGET("avx2")
+void blocked_dot_tile_avx2(const T* const (&points)[blocked_point_tile],
+	size_t cols,
+	const double* transposed,
+	size_t padded_k,
+	double (&dots)[blocked_point_tile][blocked_mean_tile]) {
+	static_assert(blocked_point_tile == 4 && blocked_mean_tile == 16, "The kernel is written for 4 by 16 tiles");
+	const size_t dimensions = flat_dimension<N>(cols);
+	// Sixteen accumulators would fill every AVX2 register, so the tile is done in two halves
+	for (size_t c = 0; c < blocked_mean_tile; c += 8) {
+		__m256d sum00 = _mm256_setzero_pd(), sum01 = _mm256_setzero_pd();
+		__m256d sum10 = _mm256_setzero_pd(), sum11 = _mm256_setzero_pd();
+		__m256d sum20 = _mm256_setzero_pd(), sum21 = _mm256_setzero_pd();
+		__m256d sum30 = _mm256_setzero_pd(), sum31 = _mm256_setzero_pd();
+		for (size_t d = 0; d < dimensions; ++d) {
+			const double* row = transposed + d * padded_k + c;
+			const __m256d means0 = _mm256_loadu_pd(row);
+			const __m256d means1 = _mm256_loadu_pd(row + 4);
+			__m256d x = _mm256_set1_pd(static_cast<double>(points[0][d]));
+			sum00 = _mm256_add_pd(sum00, _mm256_mul_pd(x, means0));
+			sum01 = _mm256_add_pd(sum01, _mm256_mul_pd(x, means1));
+			x = _mm256_set1_pd(static_cast<double>(points[1][d]));
+			sum10 = _mm256_add_pd(sum10, _mm256_mul_pd(x, means0));
+			sum11 = _mm256_add_pd(sum11, _mm256_mul_pd(x, means1));
+			x = _mm256_set1_pd(static_cast<double>(points[2][d]));
+			sum20 = _mm256_add_pd(sum20, _mm256_mul_pd(x, means0));
+			sum21 = _mm256_add_pd(sum21, _mm256_mul_pd(x, means1));
+			x = _mm256_set1_pd(static_cast<double>(points[3][d]));
+			sum30 = _mm256_add_pd(sum30, _mm256_mul_pd(x, means0));
+			sum31 = _mm256_add_pd(sum31, _mm256_mul_pd(x, means1));
+		}
+		_mm256_storeu_pd(&dots[0][c], sum00);
+		_mm256_storeu_pd(&dots[0][c + 4], sum01);
+		_mm256_storeu_pd(&dots[1][c], sum10);
+		_mm256_storeu_pd(&dots[1][c + 4], sum11);
+		_mm256_storeu_pd(&dots[2][c], sum20);
+		_mm256_storeu_pd(&dots[2][c + 4], sum21);
+		_mm256_storeu_pd(&dots[3][c], sum30);
+		_mm256_storeu_pd(&dots[3][c + 4], sum31);
+	}
+}
+
+template <typename T, size_t N>
+DKM_SIMD_TARGET("avx512f")
+void blocked_dot_tile_avx512(const T* const (&points)[blocked_point_tile],
+	size_t cols,
+	const double* transposed,
+	size_t padded_k,
+	double (&dots)[blocked_point_tile][blocked_mean_tile]) {
+	static_assert(blocked_point_tile == 4 && blocked_mean_tile == 16, "The kernel is written for 4 by 16 tiles");
+	const size_t dimensions = flat_dimension<N>(cols);
+	__m512d sum00 = _mm512_setzero_pd(), sum01 = _mm512_setzero_pd();
+	__m512d sum10 = _mm512_setzero_pd(), sum11 = _mm512_setzero_pd();
+	__m512d sum20 = _mm512_setzero_pd(), sum21 = _mm512_setzero_pd();
+	__m512d sum30 = _mm512_setzero_pd(), sum31 = _mm512_setzero_pd();
+	for (size_t d = 0; d < dimensions; ++d) {
+		const double* row = transposed + d * padded_k;
+		const __m512d means0 = _mm512_loadu_pd(row);
+		const __m512d means1 = _mm512_loadu_pd(row + 8);
+		__m512d x = _mm512_set1_pd(static_cast<double>(points[0][d]));
+		sum00 = _mm512_fmadd_pd(x, means0, sum00);
+		sum01 = _mm512_fmadd_pd(x, means1, sum01);
+		x = _mm512_set1_pd(static_cast<double>(points[1][d]));
+		sum10 = _mm512_fmadd_pd(x, means0, sum10);
+		sum11 = _mm512_fmadd_pd(x, means1, sum11);
+		x = _mm512_set1_pd(static_cast<double>(points[2][d]));
+		sum20 = _mm512_fmadd_pd(x, means0, sum20);
+		sum21 = _mm512_fmadd_pd(x, means1, sum21);
+		x = _mm512_set1_pd(static_cast<double>(points[3][d]));
+		sum30 = _mm512_fmadd_pd(x, means0, sum30);
+		sum31 = _mm512_fmadd_pd(x, means1, sum31);
+	}
+	_mm512_storeu_pd(&dots[0][0], sum00);
+	_mm512_storeu_pd(&dots[0][8], sum01);
+	_mm512_storeu_pd(&dots[1][0], sum10);
+	_mm512_storeu_pd(&dots[1][8], sum11);
+	_mm512_storeu_pd(&dots[2][0], sum20);
+	_mm512_storeu_pd(&dots[2][8], sum21);
+	_mm512_storeu_pd(&dots[3][0], sum30);
+	_mm512_storeu_pd(&dots[3][8], sum31);
+}
+#endif
+
+/*
+Calculate the dot products between the tile of points starting at p0 (rows of them, up to
+blocked_point_tile) and a tile of means, with the SIMD micro-kernel for level if there is one.
+*/
+template <typename T, size_t N>
+void blocked_dot_tile(const matrix_view<T>& data,
+	size_t p0,
+	size_t rows,
+	const blocked_t<T>* transposed,
+	size_t padded_k,
+	simd_level level,
+	blocked_t<T> (&dots)[blocked_point_tile][blocked_mean_tile]) {
+#if defined(DKM_SIMD_X86)
+	if (level != simd_level::none) {
+		const T* points[blocked_point_tile];
+		for (size_t p = 0; p < blocked_point_tile; ++p) {
+			points[p] = data.row(p0 + std::min(p, rows - 1));
+		}
+		if (level == simd_level::avx512) {
+			blocked_dot_tile_avx512<T, N>(points, data.cols(), transposed, padded_k, dots);
+		} else {
+			blocked_dot_tile_avx2<T, N>(points, data.cols(), transposed, padded_k, dots);
+		}
+		return;
+	}
+#else
+	(void)level;
+#endif
+	switch (rows) {
+	case 4: blocked_dot_tile<4, T, N>(data, p0, transposed, padded_k, dots); break;
+	case 3: blocked_dot_tile<3, T, N>(data, p0, transposed, padded_k, dots); break;
+	case 2: blocked_dot_tile<2, T, N>(data, p0, transposed, padded_k, dots); break;
+	default: blocked_dot_tile<1, T, N>(data, p0, transposed, padded_k, dots); break;
+	}
+}
+
+/*
+Settle a near tie in the blocked distance engine for one point, given the closest two expansion distances
+and the index of the closest in each lane of the mean tile. Only the means whose expansion distance is
+within limit can be closest in T, so when no lane has two of them, just the closest mean of each lane is
+measured with `distance_squared`; otherwise every mean is, with `closest_mean`. Ties go to the lowest
+index either way.
+*/
+template <typename T, size_t N>
+uint32_t blocked_settle_tie(const T* point,
+	const matrix_view<T>& means,
+	blocked_t<T> limit,
+	const blocked_t<T> (&best)[blocked_mean_tile],
+	const blocked_t<T> (&second)[blocked_mean_tile],
+	const uint32_t (&best_index)[blocked_mean_tile],
+	T* distance) {
+	T smallest_distance = T();
+	for (size_t c = 0; c < blocked_mean_tile; ++c) {
+		if (second[c] <= limit) {
+			const uint32_t closest = closest_mean<T, N>(point, means, smallest_distance);
+			if (distance) {
+				*distance = smallest_distance;
+			}
+			return closest;
+		}
+	}
+	uint32_t closest = std::numeric_limits<uint32_t>::max();
+	for (size_t c = 0; c < blocked_mean_tile; ++c) {
+		if (best[c] <= limit) {
+			const T candidate = distance_squared<T, N>(point, means.row(best_index[c]), means.cols());
+			if (closest == std::numeric_limits<uint32_t>::max() || candidate < smallest_distance
+				|| (candidate == smallest_distance && best_index[c] < closest)) {
+				smallest_distance = candidate;
+				closest = best_index[c];
+			}
+		}
+	}
+	if (distance) {
+		*distance = smallest_distance;
+	}
+	return closest;
+}
+
+/*
+Calculate the index of the mean each data point from begin to end is closest to, using the expansion
+||x - c||^2 = ||x||^2 - 2 x.c + ||c||^2 with the dot products calculated by a register-blocked kernel.
+The expansion loses precision when the points are far from the origin compared to the distances between
+them, so any point where the closest two means are within the rounding error of each other (either of the
+expansion, or of `distance_squared` in T) is settled with `blocked_settle_tie` instead. The results are
+therefore the same as `calculate_clusters`.
+*/
+template <typename T, size_t N>
+void blocked_calculate_clusters_range(const matrix_view<T>& data,
+	const std::vector<blocked_t<T>>& point_norms,
+	const matrix_view<T>& means,
+	const blocked_means<T>& prepared,
+	size_t begin,
+	size_t end,
+	uint32_t* clusters,
+	T* distances = nullptr) {
+	using A = blocked_t<T>;
+	const size_t padded_k = prepared.padded_k;
+	const A dimension = static_cast<A>(flat_dimension<N>(data.cols()));
+	const A data_tolerance = 2 * (dimension + 2) * static_cast<A>(std::numeric_limits<bound_t<T>>::epsilon());
+	const A expansion_tolerance = 2 * (dimension + 2) * std::numeric_limits<A>::epsilon();
+	const simd_level level = blocked_simd_level<T>();
+	// The closest two means and the index of the closest are kept for each lane of the mean tile, so that
+	// each tile is folded in with elementwise minimums the compiler can vectorize, and the lanes are only
+	// compared with each other once all of the means have been seen.
+	A best[blocked_point_block][blocked_mean_tile];
+	A second[blocked_point_block][blocked_mean_tile];
+	uint32_t best_index[blocked_point_block][blocked_mean_tile];
+	std::vector<T> scratch;
+	for (size_t block = begin; block < end; block += blocked_point_block) {
+		const size_t block_end = std::min(block + blocked_point_block, end);
+		const matrix_view<T> points = gather_rows(data, block, block_end, scratch);
+		for (size_t i = 0; i < blocked_point_block; ++i) {
+			for (size_t c = 0; c < blocked_mean_tile; ++c) {
+				best[i][c] = std::numeric_limits<A>::max();
+				second[i][c] = std::numeric_limits<A>::max();
+				best_index[i][c] = static_cast<uint32_t>(c);
+			}
+		}
+		for (size_t panel = 0; panel < padded_k; panel += blocked_mean_panel) {
+			const size_t panel_end = std::min(panel + blocked_mean_panel, padded_k);
+			for (size_t p0 = block; p0 < block_end; p0 += blocked_point_tile) {
+				const size_t rows = std::min(blocked_point_tile, block_end - p0);
+				for (size_t c0 = panel; c0 < panel_end; c0 += blocked_mean_tile) {
+					A dots[blocked_point_tile][blocked_mean_tile];
+					const A* transposed = &prepared.transposed[c0];
+					const A* mean_norms = &prepared.norms[c0];
+					blocked_dot_tile<T, N>(points, p0 - block, rows, transposed, padded_k, level, dots);
+					for (size_t p = 0; p < rows; ++p) {
+						const size_t i = p0 + p - block;
+						const A norm = point_norms[p0 + p];
+						for (size_t c = 0; c < blocked_mean_tile; ++c) {
+							const A distance = norm - 2 * dots[p][c] + mean_norms[c];
+							const bool closer = distance < best[i][c];
+							const A displaced = closer ? best[i][c] : distance;
+							second[i][c] = displaced < second[i][c] ? displaced : second[i][c];
+							best_index[i][c] = closer ? static_cast<uint32_t>(c0 + c) : best_index[i][c];
+							best[i][c] = closer ? distance : best[i][c];
+						}
+					}
+				}
+			}
+		}
+		for (size_t p = block; p < block_end; ++p) {
+			const size_t i = p - block;
+			size_t lane = 0;
+			for (size_t c = 1; c < blocked_mean_tile; ++c) {
+				if (best[i][c] < best[i][lane]) {
+					lane = c;
+				}
+			}
+			const A closest = best[i][lane];
+			A runner_up = second[i][lane];
+			for (size_t c = 0; c < blocked_mean_tile; ++c) {
+				if (c != lane) {
+					runner_up = std::min(runner_up, best[i][c]);
+				}
+			}
+			const uint32_t closest_index = best_index[i][lane];
+			const A tolerance = data_tolerance * 2 * std::abs(closest)
+				+ expansion_tolerance * (point_norms[p] + prepared.max_norm);
+			if (runner_up - closest <= tolerance) {
+				clusters[p] = blocked_settle_tie<T, N>(points.row(i), means, closest + tolerance, best[i], second[i],
+					best_index[i], distances ? &distances[p] : nullptr);
+			} else {
+				clusters[p] = closest_index;
+				if (distances) {
+					// The expansion isn't exact, so the distance is calculated directly
+					distances[p] = distance_squared<T, N>(points.row(i), means.row(closest_index), data.cols());
+				}
+			}
+		}
+	}
+}
+
+/*
+Calculate the index of the mean each data point is closest to with the blocked distance engine, given
+the squared norms of the data points from `point_norms`, writing them to clusters, and the squared
+distances to them to distances if it isn't null. The means are laid out in prepared.
+*/
+template <typename T, size_t N>
+void blocked_calculate_clusters(const matrix_view<T>& data,
+	const std::vector<blocked_t<T>>& point_norms,
+	const matrix_view<T>& means,
+	std::vector<uint32_t>& clusters,
+	blocked_means<T>& prepared,
+	T* distances = nullptr) {
+	clusters.resize(data.rows());
+	blocked_prepare_means<T, N>(means, prepared);
+	blocked_calculate_clusters_range<T, N>(data, point_norms, means, prepared, 0, data.rows(), clusters.data(), distances);
+}
+
+template <typename T, size_t N>
+std::vector<uint32_t> blocked_calculate_clusters(const matrix_view<T>& data,
+	const std::vector<blocked_t<T>>& point_norms,
+	const matrix_view<T>& means) {
+	std::vector<uint32_t> clusters;
+	blocked_means<T> prepared;
+	blocked_calculate_clusters<T, N>(data, point_norms, means, clusters, prepared);
+	return clusters;
+}
+
+/*
+Calculate the sum of the points in each cluster and the number of points in each cluster from scratch,
+for incremental mean updates. The sums are held in a flat k * cols buffer.
+*/
+template <typename T, size_t N>
+void calculate_cluster_sums(const matrix_view<T>& data,
+	const std::vector<uint32_t>& clusters,
+	uint32_t k,
+	std::vector<accumulate_t<T>>& sums,
+	std::vector<size_t>& sizes) {
+	const size_t cols = data.cols();
+	const size_t dimension = flat_dimension<N>(cols);
+	sums.assign(k * cols, accumulate_t<T>());
+	sizes.assign(k, 0);
+	const size_t rows = std::min(clusters.size(), data.rows());
+	std::vector<T> scratch;
+	for (size_t first = 0; first < rows; first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, rows);
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			accumulate_t<T>* sum = &sums[clusters[i] * cols];
+			const T* point = points.row(i - first);
+			++sizes[clusters[i]];
+			for (size_t d = 0; d < dimension; ++d) {
+				sum[d] += point[d];
+			}
+		}
+	}
+}
+
+/*
+Move the points whose cluster changed from previous_clusters to clusters between the running sums and
+sizes of their old and new clusters.
+*/
+template <typename T, size_t N>
+void update_cluster_sums(const matrix_view<T>& data,
+	const std::vector<uint32_t>& previous_clusters,
+	const std::vector<uint32_t>& clusters,
+	std::vector<accumulate_t<T>>& sums,
+	std::vector<size_t>& sizes) {
+	const size_t cols = data.cols();
+	const size_t dimension = flat_dimension<N>(cols);
+	for (size_t i = 0; i < data.rows(); ++i) {
+		const uint32_t from = previous_clusters[i];
+		const uint32_t to = clusters[i];
+		if (from == to) {
+			continue;
+		}
+		accumulate_t<T>* from_sum = &sums[from * cols];
+		accumulate_t<T>* to_sum = &sums[to * cols];
+		--sizes[from];
+		++sizes[to];
+		// Only the points that moved are read, so they are read in place rather than gathered
+		for (size_t d = 0; d < dimension; ++d) {
+			const T value = data.value(i, d);
+			from_sum[d] -= value;
+			to_sum[d] += value;
+		}
+	}
+}
+
+/*
+Calculate the means from the running sums and sizes of each cluster, writing them to means. Empty
+clusters keep their old mean.
+*/
+template <typename T, size_t N>
+void means_from_sums(const std::vector<accumulate_t<T>>& sums,
+	const std::vector<size_t>& sizes,
+	const matrix_view<T>& old_means,
+	std::vector<T>& means) {
+	const size_t cols = old_means.cols();
+	const size_t dimension = flat_dimension<N>(cols);
+	means.resize(sizes.size() * cols);
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		T* mean = &means[i * cols];
+		if (sizes[i] == 0) {
+			std::copy(old_means.row(i), old_means.row(i) + cols, mean);
+		} else {
+			const accumulate_t<T>* sum = &sums[i * cols];
+			for (size_t d = 0; d < dimension; ++d) {
+				mean[d] = static_cast<T>(sum[d] / static_cast<accumulate_t<T>>(sizes[i]));
+			}
+		}
+	}
+}
+
+/*
+Calculate means based on data points and their cluster assignments, writing them to means. The points in
+each cluster are added up in accumulate_t<T> in sums and counted in sizes, so the means of large clusters
+of float points don't lose precision, and the counts stay exact.
+*/
+template <typename T, size_t N>
+void calculate_means(const matrix_view<T>& data,
+	const std::vector<uint32_t>& clusters,
+	const matrix_view<T>& old_means,
+	uint32_t k,
+	std::vector<T>& means,
+	std::vector<accumulate_t<T>>& sums,
+	std::vector<size_t>& sizes) {
+	calculate_cluster_sums<T, N>(data, clusters, k, sums, sizes);
+	means_from_sums<T, N>(sums, sizes, old_means, means);
+}
+
+/*
+Calculate means based on data points and their cluster assignments.
+*/
+template <typename T, size_t N>
+std::vector<T> calculate_means(const matrix_view<T>& data,
+	const std::vector<uint32_t>& clusters,
+	const matrix_view<T>& old_means,
+	uint32_t k) {
+	std::vector<T> means;
+	std::vector<accumulate_t<T>> sums;
+	std::vector<size_t> sizes;
+	calculate_means<T, N>(data, clusters, old_means, k, means, sums, sizes);
+	return means;
+}
+
+template <typename T, size_t N>
+std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>>& data,
+	const std::vector<uint32_t>& clusters,
+	const std::vector<std::array<T, N>>& old_means,
+	uint32_t k) {
+	return to_arrays<T, N>(calculate_means<T, N>(view_of(data), clusters, view_of(old_means), k));
+}
+
+/*
+Calculate how far each mean has moved since the previous iteration.
+*/
+template <typename T, size_t N>
+std::vector<bound_t<T>> mean_shifts(
+	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means) {
+	assert(old_means.size() == means.size());
+	std::vector<bound_t<T>> shifts;
+	shifts.reserve(means.size());
+	for (size_t i = 0; i < means.size(); ++i) {
+		shifts.push_back(bound_distance(means[i], old_means[i]));
+	}
+	return shifts;
+}
+
+/*
+Calculate half of the distance between every pair of means as a flat k * k matrix, along with half of
+the distance from each mean to its closest neighbouring mean. A point closer to its mean than either of
+these values can't be closer to the other mean(s) (triangle inequality).
+*/
+template <typename T, size_t N>
+void half_mean_distances(const std::vector<std::array<T, N>>& means,
+	std::vector<bound_t<T>>& half_distances,
+	std::vector<bound_t<T>>& half_closest) {
+	const size_t k = means.size();
+	half_distances.assign(k * k, bound_t<T>());
+	half_closest.assign(k, std::numeric_limits<bound_t<T>>::max());
+	for (size_t i = 0; i < k; ++i) {
+		for (size_t j = i + 1; j < k; ++j) {
+			auto half = bound_distance(means[i], means[j]) / 2;
+			half_distances[i * k + j] = half;
+			half_distances[j * k + i] = half;
+			half_closest[i] = std::min(half_closest[i], half);
+			half_closest[j] = std::min(half_closest[j], half);
+		}
+	}
+}
+
+/*
+Calculate half of the distance from each mean to its closest neighbouring mean.
+*/
+template <typename T, size_t N>
+std::vector<bound_t<T>> half_closest_mean_distances(const std::vector<std::array<T, N>>& means) {
+	std::vector<bound_t<T>> half_closest(means.size(), std::numeric_limits<bound_t<T>>::max());
+	for (size_t i = 0; i < means.size(); ++i) {
+		for (size_t j = i + 1; j < means.size(); ++j) {
+			auto half = bound_distance(means[i], means[j]) / 2;
+			half_closest[i] = std::min(half_closest[i], half);
+			half_closest[j] = std::min(half_closest[j], half);
+		}
+	}
+	return half_closest;
+}
+
+/*
+Per-point bounds used by Elkan's algorithm; an upper bound on the distance to the assigned mean, and a
+lower bound on the distance to every mean (n * k values). The upper bound is stale when the means have
+moved since it was last calculated exactly.
+*/
+template <typename T>
+struct elkan_bounds {
+	std::vector<bound_t<T>> upper;
+	std::vector<bound_t<T>> lower;
+	std::vector<uint8_t> stale;
+};
+
+/*
+Assign each point to its closest mean by calculating every distance, initializing the Elkan bounds.
+*/
+template <typename T, size_t N>
+void elkan_initialize(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	elkan_bounds<T>& bounds) {
+	const size_t k = means.size();
+	clusters.assign(data.size(), 0);
+	bounds.upper.assign(data.size(), bound_t<T>());
+	bounds.lower.assign(data.size() * k, bound_t<T>());
+	bounds.stale.assign(data.size(), 0);
+	for (size_t i = 0; i < data.size(); ++i) {
+		auto lower = &bounds.lower[i * k];
+		for (size_t j = 0; j < k; ++j) {
+			lower[j] = bound_distance(data[i], means[j]);
+			if (j == 0 || lower[j] < bounds.upper[i]) {
+				bounds.upper[i] = lower[j];
+				clusters[i] = static_cast<uint32_t>(j);
+			}
+		}
+	}
+}
+
+/*
+Loosen the Elkan bounds to account for the means moving by the given shifts.
+*/
+template <typename T>
+void elkan_update_bounds(
+	elkan_bounds<T>& bounds, const std::vector<uint32_t>& clusters, const std::vector<bound_t<T>>& shifts) {
+	const size_t k = shifts.size();
+	for (size_t i = 0; i < clusters.size(); ++i) {
+		auto lower = &bounds.lower[i * k];
+		for (size_t j = 0; j < k; ++j) {
+			lower[j] = std::max(lower[j] - shifts[j], bound_t<T>());
+		}
+		bounds.upper[i] += shifts[clusters[i]];
+		bounds.stale[i] = 1;
+	}
+}
+
+/*
+Reassign points to their closest mean, skipping every distance calculation that the Elkan bounds show
+can't change the assignment. A mean at exactly the same distance as the assigned one can still take the
+point if it has a lower index, so the bounds only skip a mean when it's strictly further away, and ties
+go to the lowest index as in `calculate_clusters`.
+*/
+template <typename T, size_t N>
+void elkan_calculate_clusters(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	elkan_bounds<T>& bounds) {
+	const size_t k = means.size();
+	std::vector<bound_t<T>> half_distances;
+	std::vector<bound_t<T>> half_closest;
+	half_mean_distances(means, half_distances, half_closest);
+	for (size_t i = 0; i < data.size(); ++i) {
+		uint32_t assigned = clusters[i];
+		auto upper = bounds.upper[i];
+		if (upper < half_closest[assigned]) {
+			continue;
+		}
+		bool stale = bounds.stale[i] != 0;
+		auto lower = &bounds.lower[i * k];
+		for (uint32_t j = 0; j < k; ++j) {
+			if (j == assigned || upper < lower[j] || upper < half_distances[assigned * k + j]) {
+				continue;
+			}
+			if (stale) {
+				upper = bound_distance(data[i], means[assigned]);
+				lower[assigned] = upper;
+				stale = false;
+				if (upper < lower[j] || upper < half_distances[assigned * k + j]) {
+					continue;
+				}
+			}
+			lower[j] = bound_distance(data[i], means[j]);
+			if (lower[j] < upper || (lower[j] == upper && j < assigned)) {
+				assigned = j;
+				upper = lower[j];
+			}
+		}
+		clusters[i] = assigned;
+		bounds.upper[i] = upper;
+		bounds.stale[i] = stale ? 1 : 0;
+	}
+}
+
+/*
+Per-point bounds used by Hamerly's algorithm; an upper bound on the distance to the assigned mean, and a
+single lower bound on the distance to the second closest mean.
+*/
+template <typename T>
+struct hamerly_bounds {
+	std::vector<bound_t<T>> upper;
+	std::vector<bound_t<T>> lower;
+};
+
+/*
+Find the closest mean to a point by calculating every distance, recording the distance to the closest
+and second closest means.
+*/
+template <typename T, size_t N>
+void hamerly_assign_point_exact(const std::array<T, N>& point,
+	const std::vector<std::array<T, N>>& means,
+	uint32_t& cluster,
+	bound_t<T>& upper,
+	bound_t<T>& lower) {
+	bound_t<T> closest = std::numeric_limits<bound_t<T>>::max();
+	bound_t<T> second = std::numeric_limits<bound_t<T>>::max();
+	for (size_t j = 0; j < means.size(); ++j) {
+		auto distance = bound_distance(point, means[j]);
+		if (distance < closest) {
+			second = closest;
+			closest = distance;
+			cluster = static_cast<uint32_t>(j);
+		} else if (distance < second) {
+			second = distance;
+		}
+	}
+	upper = closest;
+	lower = second;
+}
+
+/*
+Reassign a single point to its closest mean, skipping the scan over the means when the Hamerly bounds
+show that the assignment can't change. The bounds only skip the scan when every other mean is strictly
+further away, so a mean with a lower index at exactly the same distance takes the point, as in
+`calculate_clusters`.
+*/
+template <typename T, size_t N>
+void hamerly_assign_point(const std::array<T, N>& point,
+	const std::vector<std::array<T, N>>& means,
+	const std::vector<bound_t<T>>& half_closest,
+	uint32_t& cluster,
+	bound_t<T>& upper,
+	bound_t<T>& lower) {
+	auto limit = std::max(half_closest[cluster], lower);
+	if (upper < limit) {
+		return;
+	}
+	// Tighten the upper bound and try again before falling back to checking every mean
+	upper = bound_distance(point, means[cluster]);
+	if (upper < limit) {
+		return;
+	}
+	hamerly_assign_point_exact(point, means, cluster, upper, lower);
+}
+
+/*
+Loosen the bounds of a single point to account for the means moving by the given shifts. The lower bound
+only needs to move by the largest shift of any mean other than the assigned one.
+*/
+template <typename B>
+void hamerly_update_point_bounds(uint32_t cluster,
+	const std::vector<B>& shifts,
+	uint32_t largest_shift_index,
+	B largest_shift,
+	B second_largest_shift,
+	B& upper,
+	B& lower) {
+	upper += shifts[cluster];
+	lower -= cluster == largest_shift_index ? second_largest_shift : largest_shift;
+}
+
+/*
+Find the largest and second largest shifts, as used to update the Hamerly lower bounds.
+*/
+template <typename T>
+void largest_shifts(const std::vector<T>& shifts, uint32_t& largest_index, T& largest, T& second_largest) {
+	largest_index = 0;
+	largest = T();
+	second_largest = T();
+	for (size_t j = 0; j < shifts.size(); ++j) {
+		if (shifts[j] > largest) {
+			second_largest = largest;
+			largest = shifts[j];
+			largest_index = static_cast<uint32_t>(j);
+		} else if (shifts[j] > second_largest) {
+			second_largest = shifts[j];
+		}
+	}
+}
+
+/*
+Assign each point to its closest mean by calculating every distance, initializing the Hamerly bounds.
+*/
+template <typename T, size_t N>
+void hamerly_initialize(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	hamerly_bounds<T>& bounds) {
+	clusters.assign(data.size(), 0);
+	bounds.upper.assign(data.size(), bound_t<T>());
+	bounds.lower.assign(data.size(), bound_t<T>());
+	for (size_t i = 0; i < data.size(); ++i) {
+		hamerly_assign_point_exact(data[i], means, clusters[i], bounds.upper[i], bounds.lower[i]);
+	}
+}
+
+/*
+Move the means' shifts into the Hamerly bounds and reassign each point to its closest mean.
+*/
+template <typename T, size_t N>
+void hamerly_calculate_clusters(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& old_means,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	hamerly_bounds<T>& bounds) {
+	auto shifts = mean_shifts(old_means, means);
+	uint32_t largest_index;
+	bound_t<T> largest, second_largest;
+	largest_shifts(shifts, largest_index, largest, second_largest);
+	auto half_closest = half_closest_mean_distances(means);
+	for (size_t i = 0; i < data.size(); ++i) {
+		hamerly_update_point_bounds(
+			clusters[i], shifts, largest_index, largest, second_largest, bounds.upper[i], bounds.lower[i]);
+		hamerly_assign_point(data[i], means, half_closest, clusters[i], bounds.upper[i], bounds.lower[i]);
+	}
+}
+
+/*
+The grouping of the means used by the Yinyang algorithm; the group each mean belongs to, and the means
+belonging to each group.
+*/
+struct yinyang_groups {
+	std::vector<uint32_t> group;
+	std::vector<std::vector<uint32_t>> members;
+};
+
+/*
+Per-point bounds used by the Yinyang algorithm; an upper bound on the distance to the assigned mean, and
+a lower bound on the distance to every mean in each group other than the assigned one (n * t values).
+*/
+template <typename T>
+struct yinyang_bounds {
+	std::vector<bound_t<T>> upper;
+	std::vector<bound_t<T>> lower;
+};
+
+/*
+Split the means into roughly k / 10 groups by running a few iterations of k-means over the means
+themselves, so that means close to each other end up in the same group.
+*/
+template <typename T, typename S, size_t N>
+yinyang_groups yinyang_make_groups(const std::vector<std::array<T, N>>& means, S seed) {
+	const uint32_t k = static_cast<uint32_t>(means.size());
+	const uint32_t t = std::max<uint32_t>(1, (k + 9) / 10);
+	yinyang_groups groups;
+	if (t == 1) {
+		groups.group.assign(k, 0);
+	} else {
+		auto group_means = random_plusplus(means, t, seed);
+		for (int i = 0; i < 5; ++i) {
+			groups.group = calculate_clusters(means, group_means);
+			group_means = calculate_means(means, groups.group, group_means, t);
+		}
+	}
+	groups.members.assign(t, std::vector<uint32_t>());
+	for (uint32_t j = 0; j < k; ++j) {
+		groups.members[groups.group[j]].push_back(j);
+	}
+	return groups;
+}
+
+/*
+Find the closest mean to a point by calculating every distance, recording the distance to the closest
+mean in each group (other than the assigned mean) as the lower bounds.
+*/
+template <typename T, size_t N>
+void yinyang_assign_point_exact(const std::array<T, N>& point,
+	const std::vector<std::array<T, N>>& means,
+	const yinyang_groups& groups,
+	uint32_t& cluster,
+	bound_t<T>& upper,
+	bound_t<T>* lower) {
+	const size_t t = groups.members.size();
+	std::fill(lower, lower + t, std::numeric_limits<bound_t<T>>::max());
+	upper = std::numeric_limits<bound_t<T>>::max();
+	for (size_t j = 0; j < means.size(); ++j) {
+		auto distance = bound_distance(point, means[j]);
+		if (distance < upper) {
+			if (j != 0) {
+				auto& old_lower = lower[groups.group[cluster]];
+				old_lower = std::min(old_lower, upper);
+			}
+			upper = distance;
+			cluster = static_cast<uint32_t>(j);
+		} else {
+			auto& group_lower = lower[groups.group[j]];
+			group_lower = std::min(group_lower, distance);
+		}
+	}
+}
+
+/*
+Reassign a single point to its closest mean. The scan over the means is skipped entirely when the upper
+bound is below every group's lower bound (global filter), and otherwise only the groups whose lower bound
+is below the distance to the best mean found so far are scanned (group filter). The filters only skip
+means that are strictly further away, and a mean at exactly the same distance as the best one takes the
+point if it has a lower index, so ties go to the lowest index as in `calculate_clusters`.
+*/
+template <typename T, size_t N>
+void yinyang_assign_point(const std::array<T, N>& point,
+	const std::vector<std::array<T, N>>& means,
+	const yinyang_groups& groups,
+	uint32_t& cluster,
+	bound_t<T>& upper,
+	bound_t<T>* lower) {
+	const size_t t = groups.members.size();
+	auto global_lower = *std::min_element(lower, lower + t);
+	if (upper < global_lower) {
+		return;
+	}
+	// Tighten the upper bound and try again before falling back to the group filter
+	upper = bound_distance(point, means[cluster]);
+	if (upper < global_lower) {
+		return;
+	}
+	for (size_t g = 0; g < t; ++g) {
+		if (upper < lower[g]) {
+			continue;
+		}
+		// Find the closest and second closest means in this group, excluding the current best. The members
+		// are in order, so the closest is the lowest index of those at the same distance
+		bound_t<T> closest = std::numeric_limits<bound_t<T>>::max();
+		bound_t<T> second = std::numeric_limits<bound_t<T>>::max();
+		uint32_t closest_index = 0;
+		for (auto j : groups.members[g]) {
+			if (j == cluster) {
+				continue;
+			}
+			auto distance = bound_distance(point, means[j]);
+			if (distance < closest) {
+				second = closest;
+				closest = distance;
+				closest_index = j;
+			} else if (distance < second) {
+				second = distance;
+			}
+		}
+		if (closest < upper || (closest == upper && closest_index < cluster)) {
+			// The previous best mean now counts towards the lower bound of its group
+			auto old_group = groups.group[cluster];
+			if (old_group == g) {
+				second = std::min(second, upper);
+			} else {
+				lower[old_group] = std::min(lower[old_group], upper);
+			}
+			cluster = closest_index;
+			upper = closest;
+			lower[g] = second;
+		} else {
+			lower[g] = closest;
+		}
+	}
+}
+
+/*
+Calculate the largest shift of any mean in each group.
+*/
+template <typename B>
+std::vector<B> yinyang_group_shifts(const std::vector<B>& shifts, const yinyang_groups& groups) {
+	std::vector<B> group_shifts(groups.members.size(), B());
+	for (size_t j = 0; j < shifts.size(); ++j) {
+		auto& group_shift = group_shifts[groups.group[j]];
+		group_shift = std::max(group_shift, shifts[j]);
+	}
+	return group_shifts;
+}
+
+/*
+Loosen the bounds of a single point to account for the means moving by the given shifts.
+*/
+template <typename B>
+void yinyang_update_point_bounds(uint32_t cluster,
+	const std::vector<B>& shifts,
+	const std::vector<B>& group_shifts,
+	B& upper,
+	B* lower) {
+	upper += shifts[cluster];
+	for (size_t g = 0; g < group_shifts.size(); ++g) {
+		lower[g] -= group_shifts[g];
+	}
+}
+
+/*
+Assign each point to its closest mean by calculating every distance, initializing the Yinyang bounds.
+*/
+template <typename T, size_t N>
+void yinyang_initialize(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	const yinyang_groups& groups,
+	std::vector<uint32_t>& clusters,
+	yinyang_bounds<T>& bounds) {
+	const size_t t = groups.members.size();
+	clusters.assign(data.size(), 0);
+	bounds.upper.assign(data.size(), bound_t<T>());
+	bounds.lower.assign(data.size() * t, bound_t<T>());
+	for (size_t i = 0; i < data.size(); ++i) {
+		yinyang_assign_point_exact(data[i], means, groups, clusters[i], bounds.upper[i], &bounds.lower[i * t]);
+	}
+}
+
+/*
+Move the means' shifts into the Yinyang bounds and reassign each point to its closest mean.
+*/
+template <typename T, size_t N>
+void yinyang_calculate_clusters(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& old_means,
+	const std::vector<std::array<T, N>>& means,
+	const yinyang_groups& groups,
+	std::vector<uint32_t>& clusters,
+	yinyang_bounds<T>& bounds) {
+	const size_t t = groups.members.size();
+	auto shifts = mean_shifts(old_means, means);
+	auto group_shifts = yinyang_group_shifts(shifts, groups);
+	for (size_t i = 0; i < data.size(); ++i) {
+		auto lower = &bounds.lower[i * t];
+		yinyang_update_point_bounds(clusters[i], shifts, group_shifts, bounds.upper[i], lower);
+		yinyang_assign_point(data[i], means, groups, clusters[i], bounds.upper[i], lower);
+	}
+}
+
+/*
+A node of the kd-tree used by the filtering algorithm. Each node covers the points with indices
+`indices[begin]` to `indices[end - 1]` in the tree, and holds their bounding box, count and sum so that a
+whole subtree can be added to a mean in one step. The sum is kept in accumulate_t<T> so that large cells of
+float points don't lose precision, and integer points don't overflow. Leaf nodes have no children
+(left == right == 0).
+*/
+template <typename T, size_t N>
+struct kd_node {
+	std::array<T, N> lower;
+	std::array<T, N> upper;
+	std::array<accumulate_t<T>, N> sum;
+	size_t begin;
+	size_t end;
+	uint32_t left;
+	uint32_t right;
+};
+
+/*
+A kd-tree over the data points, stored as a flat vector of nodes with the root at index 0.
+*/
+template <typename T, size_t N>
+struct kd_tree {
+	std::vector<kd_node<T, N>> nodes;
+	std::vector<size_t> indices;
+};
+
+/*
+Build the kd-tree node covering the given range of indices, splitting at the median of the widest
+dimension of the bounding box until there are no more than leaf_size points in a node.
+*/
+template <typename T, size_t N>
+uint32_t kd_tree_build_node(
+	kd_tree<T, N>& tree, const std::vector<std::array<T, N>>& data, size_t begin, size_t end, size_t leaf_size) {
+	kd_node<T, N> node;
+	node.lower = data[tree.indices[begin]];
+	node.upper = node.lower;
+	node.sum = std::array<accumulate_t<T>, N>();
+	node.begin = begin;
+	node.end = end;
+	node.left = 0;
+	node.right = 0;
+	for (size_t i = begin; i < end; ++i) {
+		const auto& point = data[tree.indices[i]];
+		for (size_t d = 0; d < N; ++d) {
+			node.lower[d] = std::min(node.lower[d], point[d]);
+			node.upper[d] = std::max(node.upper[d], point[d]);
+			node.sum[d] += point[d];
+		}
+	}
+	size_t split = 0;
+	for (size_t d = 1; d < N; ++d) {
+		if (node.upper[d] - node.lower[d] > node.upper[split] - node.lower[split]) {
+			split = d;
+		}
+	}
+	auto index = static_cast<uint32_t>(tree.nodes.size());
+	tree.nodes.push_back(node);
+	// Stop splitting at small nodes, or when all of the points in the node are identical
+	if (end - begin <= leaf_size || node.upper[split] == node.lower[split]) {
+		return index;
+	}
+	size_t middle = begin + (end - begin) / 2;
+	std::nth_element(tree.indices.begin() + begin, tree.indices.begin() + middle, tree.indices.begin() + end,
+		[&data, split](size_t a, size_t b) { return data[a][split] < data[b][split]; });
+	auto left = kd_tree_build_node(tree, data, begin, middle, leaf_size);
+	auto right = kd_tree_build_node(tree, data, middle, end, leaf_size);
+	tree.nodes[index].left = left;
+	tree.nodes[index].right = right;
+	return index;
+}
+
+/*
+Build a kd-tree over every point in the data set.
+*/
+template <typename T, size_t N>
+kd_tree<T, N> kd_tree_build(const std::vector<std::array<T, N>>& data, size_t leaf_size = 8) {
+	kd_tree<T, N> tree;
+	tree.indices.resize(data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		tree.indices[i] = i;
+	}
+	if (!data.empty()) {
+		kd_tree_build_node(tree, data, 0, data.size(), leaf_size);
+	}
+	return tree;
+}
+
+/*
+Check whether candidate mean z can't be the closest mean to any point in a bounding box because mean z_star
+is always closer, by testing the corner of the box furthest in the direction from z_star towards z. Ties
+go to the lower index, matching `closest_mean`.
+*/
+template <typename T, size_t N>
+bool kd_tree_dominates(const std::vector<std::array<T, N>>& means,
+	uint32_t z_star,
+	uint32_t z,
+	const std::array<T, N>& lower,
+	const std::array<T, N>& upper) {
+	std::array<T, N> corner;
+	for (size_t d = 0; d < N; ++d) {
+		corner[d] = means[z][d] > means[z_star][d] ? upper[d] : lower[d];
+	}
+	T z_distance = distance_squared(means[z], corner);
+	T z_star_distance = distance_squared(means[z_star], corner);
+	return z_distance > z_star_distance || (z_distance == z_star_distance && z > z_star);
+}
+
+/*
+Pass the points under a kd-tree node to their closest means, accumulating the per-mean sums and counts.
+The candidate means for the node are `candidates[candidates_begin]` to the end of the vector; candidates
+which can't be the closest mean for any point in the node are filtered out before visiting the children,
+and once only one candidate remains the whole subtree is assigned to it.
+*/
+template <typename T, size_t N>
+void kd_tree_filter(const kd_tree<T, N>& tree,
+	const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	uint32_t node_index,
+	std::vector<uint32_t>& candidates,
+	size_t candidates_begin,
+	std::vector<std::array<accumulate_t<T>, N>>& sums,
+	std::vector<size_t>& counts,
+	std::vector<uint32_t>& clusters) {
+	const auto& node = tree.nodes[node_index];
+	const size_t candidates_end = candidates.size();
+	if (node.left == 0) {
+		for (size_t i = node.begin; i < node.end; ++i) {
+			const auto& point = data[tree.indices[i]];
+			uint32_t closest = candidates[candidates_begin];
+			T smallest_distance = distance_squared(point, means[closest]);
+			for (size_t c = candidates_begin + 1; c < candidates_end; ++c) {
+				T distance = distance_squared(point, means[candidates[c]]);
+				if (distance < smallest_distance) {
+					smallest_distance = distance;
+					closest = candidates[c];
+				}
+			}
+			clusters[tree.indices[i]] = closest;
+			counts[closest] += 1;
+			for (size_t d = 0; d < N; ++d) {
+				sums[closest][d] += point[d];
+			}
+		}
+		return;
+	}
+	// Find the candidate closest to the middle of the cell, then drop every candidate it dominates
+	std::array<T, N> middle;
+	for (size_t d = 0; d < N; ++d) {
+		middle[d] = node.lower[d] + (node.upper[d] - node.lower[d]) / 2;
+	}
+	uint32_t z_star = candidates[candidates_begin];
+	T smallest_distance = distance_squared(middle, means[z_star]);
+	for (size_t c = candidates_begin + 1; c < candidates_end; ++c) {
+		T distance = distance_squared(middle, means[candidates[c]]);
+		if (distance < smallest_distance) {
+			smallest_distance = distance;
+			z_star = candidates[c];
+		}
+	}
+	for (size_t c = candidates_begin; c < candidates_end; ++c) {
+		auto z = candidates[c];
+		if (z == z_star || !kd_tree_dominates(means, z_star, z, node.lower, node.upper)) {
+			candidates.push_back(z);
+		}
+	}
+	if (candidates.size() - candidates_end == 1) {
+		counts[z_star] += node.end - node.begin;
+		for (size_t d = 0; d < N; ++d) {
+			sums[z_star][d] += node.sum[d];
+		}
+		for (size_t i = node.begin; i < node.end; ++i) {
+			clusters[tree.indices[i]] = z_star;
+		}
+	} else {
+		kd_tree_filter(tree, data, means, node.left, candidates, candidates_end, sums, counts, clusters);
+		kd_tree_filter(tree, data, means, node.right, candidates, candidates_end, sums, counts, clusters);
+	}
+	candidates.resize(candidates_end);
+}
+
+/*
+Assign every point to its closest mean using the kd-tree, and calculate the new means from the
+assignments. The points are added up in accumulate_t<T>, and means with no points assigned keep their
+old value, as in `calculate_means`.
+*/
+template <typename T, size_t N>
+std::vector<std::array<T, N>> kd_tree_calculate_means(const kd_tree<T, N>& tree,
+	const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& old_means,
+	std::vector<uint32_t>& clusters) {
+	const size_t k = old_means.size();
+	std::vector<std::array<accumulate_t<T>, N>> sums(k);
+	std::vector<std::array<T, N>> means(k);
+	std::vector<size_t> counts(k, 0);
+	std::vector<uint32_t> candidates(k);
+	for (size_t j = 0; j < k; ++j) {
+		candidates[j] = static_cast<uint32_t>(j);
+	}
+	clusters.assign(data.size(), 0);
+	if (!tree.nodes.empty()) {
+		kd_tree_filter(tree, data, old_means, 0, candidates, 0, sums, counts, clusters);
+	}
+	for (size_t j = 0; j < k; ++j) {
+		if (counts[j] == 0) {
+			means[j] = old_means[j];
+		} else {
+			for (size_t d = 0; d < N; ++d) {
+				means[j][d] = static_cast<T>(sums[j][d] / static_cast<accumulate_t<T>>(counts[j]));
+			}
+		}
+	}
+	return means;
+}
+
+/*
+Draw a sample of points from the data set, uniformly at random with replacement, into sample, whose
+storage is reused between calls. Returns the sample, or the data set itself (without copying it) if the
+sample would cover the whole data set.
+*/
+template <typename T, size_t N, typename R>
+const std::vector<std::array<T, N>>& random_sample(const std::vector<std::array<T, N>>& data,
+	size_t size,
+	R& rand_engine,
+	std::vector<std::array<T, N>>& sample) {
+	if (size >= data.size()) {
+		return data;
+	}
+	std::uniform_int_distribution<size_t> uniform_generator(0, data.size() - 1);
+	sample.resize(size);
+	for (size_t i = 0; i < size; ++i) {
+		sample[i] = data[uniform_generator(rand_engine)];
+	}
+	return sample;
+}
+
+/*
+Move each mean towards the batch points assigned to it, using a per-mean learning rate of one over the
+number of points the mean has been assigned so far (Sculley's mini-batch update).
+*/
+template <typename T, size_t N>
+void minibatch_update(const std::vector<std::array<T, N>>& batch,
+	const std::vector<uint32_t>& batch_clusters,
+	std::vector<std::array<T, N>>& means,
+	std::vector<size_t>& counts) {
+	for (size_t i = 0; i < batch.size(); ++i) {
+		auto cluster = batch_clusters[i];
+		auto& mean = means[cluster];
+		counts[cluster] += 1;
+		T rate = T(1) / static_cast<T>(counts[cluster]);
+		for (size_t d = 0; d < N; ++d) {
+			mean[d] += rate * (batch[i][d] - mean[d]);
+		}
+	}
+}
+
+/*
+Move every mean which has been assigned fewer than ratio times the points of the busiest mean to a random
+point in the batch. The assignments are counted over a window of recent batches in window_counts, and the
+means are only checked once the window has `interval` batches and at least ten points for each mean, so
+the kmeans++ means aren't thrown away because they missed the handful of points in the first batches.
+Reassigned means take the smallest count of the means which were kept, so they don't jump away from their
+new position on the next batch.
+*/
+template <typename T, size_t N, typename R>
+void minibatch_reassign(const std::vector<std::array<T, N>>& batch,
+	const std::vector<uint32_t>& batch_clusters,
+	std::vector<std::array<T, N>>& means,
+	std::vector<size_t>& counts,
+	std::vector<size_t>& window_counts,
+	size_t& window_batches,
+	T ratio,
+	size_t interval,
+	R& rand_engine) {
+	window_counts.resize(means.size(), 0);
+	for (auto cluster : batch_clusters) {
+		window_counts[cluster] += 1;
+	}
+	window_batches += 1;
+	if (window_batches < interval || window_batches * batch.size() < 10 * means.size()) {
+		return;
+	}
+	auto limit = ratio * static_cast<T>(*std::max_element(window_counts.begin(), window_counts.end()));
+	size_t smallest_kept = std::numeric_limits<size_t>::max();
+	for (size_t j = 0; j < means.size(); ++j) {
+		if (static_cast<T>(window_counts[j]) >= limit) {
+			smallest_kept = std::min(smallest_kept, counts[j]);
+		}
+	}
+	std::uniform_int_distribution<size_t> uniform_generator(0, batch.size() - 1);
+	for (size_t j = 0; j < means.size(); ++j) {
+		if (static_cast<T>(window_counts[j]) < limit) {
+			means[j] = batch[uniform_generator(rand_engine)];
+			counts[j] = smallest_kept;
+		}
+	}
+	window_counts.assign(means.size(), 0);
+	window_batches = 0;
+}
+
+} // namespace details
+
+/*
+clustering_parameters is the configuration used for running the kmeans_lloyd algorithm.
+
+It requires a k value for initialization, and can subsequently be configured with your choice
+of optional parameters, including:
+* Maximum iteration count; the algorithm will terminate if it reaches this iteration count
+  before converging on a solution. The results returned are the means and cluster assignments 
+  calculated in the last iteration before termination.
+* Minimum delta; the algorithm will terminate if the change in position of all means is
+  smaller than the specified distance.
+* Random seed; if present, this will be used in place of `std::random_device` for kmeans++
+  initialization. This can be used to ensure reproducible/deterministic behavior.
+* Initialization; the method used to pick the initial means. Defaults to kmeans++, see the
+  `initialization` enum for the alternatives.
+* Distance engine; the method used to calculate distances when assigning points to clusters. Defaults to
+  calculating each distance directly, see the `distance_engine` enum for the alternatives.
+* Mean update; the method used to update the means after the points are assigned to clusters. Defaults
+  to recalculating each mean from all of its points, see the `mean_update` enum for the alternatives.
+* Recompute interval; with incremental mean updates, the running sums are recalculated from scratch
+  every this many iterations to limit floating point drift. Defaults to 0, which never recalculates
+  them.
+* Thread count; the most threads the parallel functions use for this clustering. Defaults to 0, which
+  uses every thread of the pool they run on.
+* Schedule; how the assignment step of `kmeans_lloyd_parallel` is shared out between the threads.
+  Defaults to even parts for each thread, see the `parallel_schedule` enum for the alternative.
+* Chunk size; the number of points in each chunk of the dynamic schedule. Defaults to 0, which uses
+  chunks of 1024 points.
+* CPU affinity; a list of CPU cores for the parallel functions to run on. They then run on a pool with
+  one thread pinned to each of the cores (shared by every clustering with the same list, and kept for
+  the most recently used lists only), and the calling thread is pinned to the cores until the call
+  returns. Defaults to an empty list, which runs on the pool passed to them without pinning any threads.
+  Pinning is only supported on Linux, and is ignored elsewhere.
+* Deterministic; the points are added up in fixed parts that only depend on the number of points, and
+  the parts are added together in order, so `kmeans_lloyd` and the parallel functions give bitwise
+  identical results on any number of threads. The schedule is ignored. Defaults to false.
+* NUMA nodes; the number of shards `kmeans_lloyd_parallel` splits the data into, one per NUMA node. Each
+  shard is copied into memory first touched by a thread on its node, and the threads of each node only
+  read their own shard and add up their own partial sums, which are combined once per iteration. When
+  the machine has fewer nodes than this the nodes are simulated, with the shards sharing every thread.
+  Defaults to 0, which reads the data in place. Ignored when the results are deterministic.
+* Point storage; the precision `kmeans_lloyd` and `kmeans_lloyd_parallel` store the points in, see the
+  `point_storage` enum. Defaults to full, which reads the points in place. Ignored with NUMA shards.
+*/
+template <typename T, typename S = uint64_t>
+class clustering_parameters {
+public:
+	explicit clustering_parameters(uint32_t k) :
+	_k(k),
 	_has_max_iter(false), _max_iter(),
 	_has_min_delta(false), _min_delta(),
-	_has_rand_seed(false), _rand_seed()
+	_has_rand_seed(false), _rand_seed(),
+	_initialization(initialization::plusplus),
+	_distance_engine(distance_engine::direct),
+	_mean_update(mean_update::full),
+	_recompute_interval(0),
+	_thread_count(0),
+	_schedule(parallel_schedule::even),
+	_chunk_size(0),
+	_deterministic(false),
+	_numa_nodes(0),
+	_point_storage(point_storage::full)
 	{}
 
 	void set_max_iteration(size_t max_iter)
@@ -245,37 +2854,884 @@ public:
 		_has_max_iter = true;
 	}
 
-	void set_min_delta(T min_delta)
-	{
-		_min_delta = min_delta;
-		_has_min_delta = true;
-	}
+	void set_min_delta(T min_delta)
+	{
+		_min_delta = min_delta;
+		_has_min_delta = true;
+	}
+
+	void set_random_seed(S rand_seed)
+	{
+		_rand_seed = rand_seed;
+		_has_rand_seed = true;
+	}
+
+	void set_initialization(initialization method)
+	{
+		_initialization = method;
+	}
+
+	void set_distance_engine(distance_engine engine)
+	{
+		_distance_engine = engine;
+	}
+
+	void set_mean_update(mean_update method)
+	{
+		_mean_update = method;
+	}
+
+	void set_recompute_interval(size_t recompute_interval)
+	{
+		_recompute_interval = recompute_interval;
+	}
+
+	void set_thread_count(size_t thread_count)
+	{
+		_thread_count = thread_count;
+	}
+
+	void set_schedule(parallel_schedule schedule)
+	{
+		_schedule = schedule;
+	}
+
+	void set_chunk_size(size_t chunk_size)
+	{
+		_chunk_size = chunk_size;
+	}
+
+	void set_cpu_affinity(const std::vector<int>& cores)
+	{
+		_cpu_affinity = cores;
+	}
+
+	void set_deterministic(bool deterministic)
+	{
+		_deterministic = deterministic;
+	}
+
+	void set_numa_nodes(size_t numa_nodes)
+	{
+		_numa_nodes = numa_nodes;
+	}
+
+	void set_point_storage(point_storage storage)
+	{
+		_point_storage = storage;
+	}
+
+	bool has_max_iteration() const { return _has_max_iter; }
+	bool has_min_delta() const { return _has_min_delta; }
+	bool has_random_seed() const { return _has_rand_seed; }
+
+	uint32_t get_k() const { return _k; };
+	size_t get_max_iteration() const { return _max_iter; }
+	T get_min_delta() const { return _min_delta; }
+	S get_random_seed() const { return _rand_seed; }
+	initialization get_initialization() const { return _initialization; }
+	distance_engine get_distance_engine() const { return _distance_engine; }
+	mean_update get_mean_update() const { return _mean_update; }
+	size_t get_recompute_interval() const { return _recompute_interval; }
+	size_t get_thread_count() const { return _thread_count; }
+	parallel_schedule get_schedule() const { return _schedule; }
+	size_t get_chunk_size() const { return _chunk_size; }
+	const std::vector<int>& get_cpu_affinity() const { return _cpu_affinity; }
+	bool get_deterministic() const { return _deterministic; }
+	size_t get_numa_nodes() const { return _numa_nodes; }
+	point_storage get_point_storage() const { return _point_storage; }
+
+private:
+	uint32_t _k;
+	bool _has_max_iter;
+	size_t _max_iter;
+	bool _has_min_delta;
+	T _min_delta;
+	bool _has_rand_seed;
+	S _rand_seed;
+	initialization _initialization;
+	distance_engine _distance_engine;
+	mean_update _mean_update;
+	size_t _recompute_interval;
+	size_t _thread_count;
+	parallel_schedule _schedule;
+	size_t _chunk_size;
+	std::vector<int> _cpu_affinity;
+	bool _deterministic;
+	size_t _numa_nodes;
+	point_storage _point_storage;
+};
+
+/*
+minibatch_parameters is the configuration used for running the kmeans_minibatch algorithm. It takes all
+of the options of `clustering_parameters`, except that the maximum iteration count is replaced by the
+batch count, along with:
+* Batch size; the number of points sampled (with replacement) for each batch. Defaults to 1024.
+* Batch count; the number of batches to run. Defaults to 100. If a minimum delta is set the algorithm
+  terminates early once no mean moves further than the minimum delta in a single batch.
+* Reassignment ratio; means which have been assigned fewer than this fraction of the points assigned to
+  the busiest mean over the recent batches are moved to a random point in the batch. Defaults to 0.01,
+  and a ratio of 0 disables reassignment.
+* Reassignment interval; the number of batches between checks for rarely used means. Defaults to 10. The
+  interval is stretched until the batches hold at least ten points for each mean, so means aren't
+  reassigned while k is large compared to the points seen.
+* Full pass; whether every point is labelled with its closest mean once the batches are finished.
+  Defaults to true. When disabled the returned labels are empty and the data is only ever touched
+  through the batches.
+*/
+template <typename T, typename S = uint64_t>
+class minibatch_parameters : public clustering_parameters<T, S> {
+public:
+	explicit minibatch_parameters(uint32_t k) :
+	clustering_parameters<T, S>(k),
+	_batch_size(1024),
+	_batch_count(100),
+	_reassignment_ratio(static_cast<T>(0.01)),
+	_reassignment_interval(10),
+	_full_pass(true)
+	{}
+
+	void set_batch_size(size_t batch_size) { _batch_size = batch_size; }
+	void set_batch_count(size_t batch_count) { _batch_count = batch_count; }
+	void set_reassignment_ratio(T reassignment_ratio) { _reassignment_ratio = reassignment_ratio; }
+	void set_reassignment_interval(size_t reassignment_interval) { _reassignment_interval = reassignment_interval; }
+	void set_full_pass(bool full_pass) { _full_pass = full_pass; }
+
+	size_t get_batch_size() const { return _batch_size; }
+	size_t get_batch_count() const { return _batch_count; }
+	T get_reassignment_ratio() const { return _reassignment_ratio; }
+	size_t get_reassignment_interval() const { return _reassignment_interval; }
+	bool get_full_pass() const { return _full_pass; }
+
+private:
+	size_t _batch_size;
+	size_t _batch_count;
+	T _reassignment_ratio;
+	size_t _reassignment_interval;
+	bool _full_pass;
+};
+
+namespace details {
+
+/*
+Convert a float to bfloat16 (the upper 16 bits of a float), rounding to the nearest value, with ties to
+even.
+*/
+inline uint16_t float_to_bfloat16(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	if ((bits & 0x7fffffff) > 0x7f800000) {
+		// Keep NaNs quiet rather than letting the rounding carry into the exponent
+		return static_cast<uint16_t>((bits >> 16) | 0x40);
+	}
+	bits += 0x7fff + ((bits >> 16) & 1);
+	return static_cast<uint16_t>(bits >> 16);
+}
+
+inline float bfloat16_to_float(uint16_t value) {
+	const uint32_t bits = static_cast<uint32_t>(value) << 16;
+	float result;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+/*
+Convert a float to IEEE 754 half precision, rounding to the nearest value, with ties to even. Values
+beyond the range of half precision become infinity, and those below it become subnormal or zero.
+*/
+inline uint16_t float_to_half(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+	uint32_t half;
+	if (bits >= 0x47800000u) {
+		// At least 65536, or infinity or NaN
+		half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+	} else if (bits < 0x38800000u) {
+		// Below the smallest normal half (2^-14): adding 0.5 lines the subnormal bits up with the bottom of
+		// the float's mantissa, and the float addition does the rounding
+		float shifted;
+		std::memcpy(&shifted, &bits, sizeof(shifted));
+		shifted += 0.5f;
+		std::memcpy(&half, &shifted, sizeof(half));
+		half -= 0x3f000000u;
+	} else {
+		const uint32_t odd = (bits >> 13) & 1;
+		bits += 0xc8000fffu + odd;
+		half = bits >> 13;
+	}
+	return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+inline float half_to_float(uint16_t value) {
+	const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	} else if (exponent != 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa == 0) {
+		bits = sign;
+	} else {
+		// Normalize the subnormal value
+		exponent = 113;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			--exponent;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	}
+	float result;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+/*
+Whether points of type T are copied for the given storage, rather than read in place.
+*/
+template <typename T>
+bool stores_compact_points(point_storage storage) {
+	return storage != point_storage::full && !(storage == point_storage::single && std::is_same<T, float>::value);
+}
+
+/*
+A copy of the points in the storage selected in the parameters, see `point_storage`. Points stored in
+float are held in singles, and those stored in 16 bits in halves, one row of cols values per point.
+*/
+struct compact_points {
+	point_storage storage = point_storage::full;
+	size_t cols = 0;
+	std::vector<float> singles;
+	std::vector<uint16_t> halves;
+};
+
+/*
+Size the compact copy of the data for the given storage.
+*/
+template <typename T>
+void resize_compact_points(const matrix_view<T>& data, point_storage storage, compact_points& points) {
+	points.storage = storage;
+	points.cols = data.cols();
+	if (storage == point_storage::single) {
+		points.singles.resize(data.rows() * data.cols());
+	} else {
+		points.halves.resize(data.rows() * data.cols());
+	}
+}
+
+/*
+Copy the points of the data from begin to end into the compact copy sized by `resize_compact_points`.
+*/
+template <typename T>
+void compress_points(const matrix_view<T>& data, size_t begin, size_t end, compact_points& points) {
+	const size_t cols = data.cols();
+	std::vector<T> scratch;
+	for (size_t first = begin; first < end; first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, end);
+		const matrix_view<T> block = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			const T* point = block.row(i - first);
+			for (size_t d = 0; d < cols; ++d) {
+				const float value = static_cast<float>(point[d]);
+				switch (points.storage) {
+				case point_storage::single: points.singles[i * cols + d] = value; break;
+				case point_storage::half: points.halves[i * cols + d] = float_to_half(value); break;
+				default: points.halves[i * cols + d] = float_to_bfloat16(value); break;
+				}
+			}
+		}
+	}
+}
+
+/*
+Convert the points of the compact copy from begin to end back to T in scratch, returning a view of them.
+*/
+template <typename T>
+matrix_view<T> decode_points(const compact_points& points, size_t begin, size_t end, std::vector<T>& scratch) {
+	const size_t cols = points.cols;
+	scratch.resize((end - begin) * cols);
+	const size_t first = begin * cols;
+	if (points.storage == point_storage::single) {
+		for (size_t j = 0; j < scratch.size(); ++j) {
+			scratch[j] = static_cast<T>(points.singles[first + j]);
+		}
+	} else if (points.storage == point_storage::half) {
+		for (size_t j = 0; j < scratch.size(); ++j) {
+			scratch[j] = static_cast<T>(half_to_float(points.halves[first + j]));
+		}
+	} else {
+		for (size_t j = 0; j < scratch.size(); ++j) {
+			scratch[j] = static_cast<T>(bfloat16_to_float(points.halves[first + j]));
+		}
+	}
+	return matrix_view<T>(scratch.data(), end - begin, cols);
+}
+
+/*
+The buffers a thread uses to decode a block of compact points, and the squared norms of the decoded
+points for the blocked distance engine.
+*/
+template <typename T>
+struct decoded_block {
+	std::vector<T> points;
+	std::vector<blocked_t<T>> norms;
+};
+
+/*
+The buffers used by each iteration of Lloyd's algorithm. They are sized on first use, and only grow
+when they are reused for a larger data set or more clusters; see `kmeans_workspace`.
+*/
+template <typename T>
+struct lloyd_buffers {
+	std::vector<T> means;
+	std::vector<T> old_means;
+	std::vector<T> old_old_means;
+	std::vector<T> deltas;
+	std::vector<uint32_t> clusters;
+	std::vector<uint32_t> previous_clusters;
+	std::vector<accumulate_t<T>> sums;
+	std::vector<size_t> sizes;
+	std::vector<blocked_t<T>> norms;
+	simd_means<T> simd;
+	blocked_means<T> blocked;
+	seeding_buffers<T> seeding;
+	// Partial sums of each part of the data for the parallel and deterministic mean updates, see
+	// `kmeans_lloyd_parallel` and `sum_parts`
+	std::vector<accumulate_t<T>> thread_sums;
+	// The squared distance from each point to its mean in the last assignment step, when requested
+	std::vector<T> distances;
+	// The copy of the points in reduced precision storage, and the block decoded by the serial algorithm
+	compact_points compact;
+	decoded_block<T> decoded;
+	// The number of iterations run by the last clustering, whether the means converged (rather than
+	// reaching the maximum iteration count), and whether it was abandoned before converging
+	size_t iterations = 0;
+	bool converged = false;
+	bool abandoned = false;
+};
+
+/*
+The inertia of a clustering as measured by `means_inertia` (the sum of the distances from each point to
+its mean), calculated from the squared distances kept in lloyd_buffers::distances.
+*/
+template <typename T>
+accumulate_t<T> kept_inertia(const std::vector<T>& distances) {
+	accumulate_t<T> inertia = 0;
+	for (T distance : distances) {
+		inertia += std::sqrt(static_cast<accumulate_t<T>>(distance));
+	}
+	return inertia;
+}
+
+/*
+Measure the squared distance from each point from begin to end to the mean of its cluster in
+buffers.means, into buffers.distances. The distances kept by the assignment step are to the means before
+the last update, so this is needed whenever the means moved in that update.
+*/
+template <typename T, size_t N>
+void distances_to_means(const matrix_view<T>& data, size_t begin, size_t end, lloyd_buffers<T>& buffers) {
+	const matrix_view<T> means = view_of(buffers.means, data.cols());
+	std::vector<T> scratch;
+	for (size_t first = begin; first < end; first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, end);
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			buffers.distances[i] = distance_squared<T, N>(points.row(i - first), means.row(buffers.clusters[i]), data.cols());
+		}
+	}
+}
+
+/*
+The distance, in values, between the blocks of partial sums of consecutive parts of the data. Each block
+holds the sums for each cluster (k * cols values) followed by the number of points in each cluster (k
+values), and is followed by at least a cache line of padding so that no two threads write to the same
+cache line.
+*/
+template <typename A>
+size_t thread_block_stride(size_t k, size_t cols) {
+	const size_t line = std::max<size_t>(64 / sizeof(A), 1);
+	return (k * cols + k + line - 1) / line * line + line;
+}
+
+/*
+The number of points in each part of the deterministic mean update, and the most parts the data is split
+into, which is also the most threads that can share the update.
+*/
+const size_t deterministic_part_points = 1024;
+const size_t deterministic_max_parts = 128;
+
+/*
+The number of parts the data is split into when the parameters ask for deterministic results. It only
+depends on the number of points, so the partial sums are the same however many threads add them up.
+*/
+inline size_t deterministic_parts(size_t rows) {
+	const size_t parts = (rows + deterministic_part_points - 1) / deterministic_part_points;
+	return std::max<size_t>(std::min(parts, deterministic_max_parts), 1);
+}
+
+/*
+The first row of the given part when the data is split into the given number of parts, each made of
+whole blocks of blocked_point_block points.
+*/
+inline size_t part_begin(size_t rows, size_t part, size_t parts) {
+	const size_t blocks = (rows + blocked_point_block - 1) / blocked_point_block;
+	return std::min(blocks * part / parts * blocked_point_block, rows);
+}
+
+/*
+Add the points from begin to end to the partial sums of their clusters in sums (k * cols values), and
+count them in counts. With changed_only, only the points whose cluster differs from previous_clusters are
+added: they are subtracted from their old cluster and added to their new one.
+*/
+template <typename A, typename T, size_t N>
+void accumulate_points(const matrix_view<T>& data,
+	const uint32_t* clusters,
+	const uint32_t* previous_clusters,
+	bool changed_only,
+	size_t begin,
+	size_t end,
+	A* sums,
+	A* counts) {
+	const size_t cols = data.cols();
+	const size_t dimension = flat_dimension<N>(cols);
+	std::vector<T> scratch;
+	for (size_t first = begin; first < end; first += gather_block_rows) {
+		const size_t last = std::min(first + gather_block_rows, end);
+		const matrix_view<T> points = gather_rows(data, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			const T* point = points.row(i - first);
+			A* sum = sums + clusters[i] * cols;
+			if (changed_only) {
+				if (clusters[i] == previous_clusters[i]) {
+					continue;
+				}
+				A* old_sum = sums + previous_clusters[i] * cols;
+				for (size_t d = 0; d < dimension; ++d) {
+					old_sum[d] -= point[d];
+				}
+				counts[previous_clusters[i]] -= 1;
+			}
+			for (size_t d = 0; d < dimension; ++d) {
+				sum[d] += point[d];
+			}
+			counts[clusters[i]] += 1;
+		}
+	}
+}
+
+/*
+Calculate the new means in buffers.means from the partial sums of the parts of the data, added up in the
+first block of buffers.thread_sums. The running sums in buffers.sums are either replaced (from_scratch, as
+they always are with full mean updates) or updated with the changes of an incremental mean update.
+*/
+template <typename T, size_t N>
+void means_from_partial_sums(const clustering_parameters<T>& parameters,
+	size_t cols,
+	bool from_scratch,
+	lloyd_buffers<T>& buffers) {
+	using A = accumulate_t<T>;
+	const size_t k = parameters.get_k();
+	const matrix_view<T> old_means = view_of(buffers.old_means, cols);
+	const A* sums = buffers.thread_sums.data();
+	const A* counts = sums + k * cols;
+	if (from_scratch || parameters.get_mean_update() == mean_update::full) {
+		buffers.sums.assign(sums, sums + k * cols);
+		buffers.sizes.assign(k, 0);
+	} else {
+		for (size_t j = 0; j < k * cols; ++j) {
+			buffers.sums[j] += sums[j];
+		}
+	}
+	for (size_t i = 0; i < k; ++i) {
+		buffers.sizes[i] = static_cast<size_t>(static_cast<long long>(buffers.sizes[i]) + static_cast<long long>(counts[i]));
+	}
+	means_from_sums<T, N>(buffers.sums, buffers.sizes, old_means, buffers.means);
+}
+
+/*
+Add the first values of each of the given number of blocks of partial sums, stride values apart, to the
+first block in order.
+*/
+template <typename A>
+void add_parts(std::vector<A>& partial, size_t stride, size_t values, size_t parts) {
+	for (size_t part = 1; part < parts; ++part) {
+		const A* other = &partial[part * stride];
+		for (size_t j = 0; j < values; ++j) {
+			partial[j] += other[j];
+		}
+	}
+}
+
+/*
+Add up the points of each of the given number of parts of the data in its own block of partial, then add
+the parts together in order, leaving the total in the first block. The same sums are calculated by the
+parallel mean update on any number of threads, see `kmeans_lloyd_parallel`.
+*/
+template <typename A, typename T, size_t N>
+void sum_parts(const matrix_view<T>& data,
+	uint32_t k,
+	bool changed_only,
+	size_t parts,
+	const lloyd_buffers<T>& buffers,
+	std::vector<A>& partial) {
+	const size_t cols = data.cols();
+	const size_t stride = thread_block_stride<A>(k, cols);
+	partial.resize(stride * parts);
+	for (size_t part = 0; part < parts; ++part) {
+		A* sums = &partial[part * stride];
+		std::fill(sums, sums + k * cols + k, A());
+		accumulate_points<A, T, N>(data, buffers.clusters.data(), buffers.previous_clusters.data(), changed_only,
+			part_begin(data.rows(), part, parts), part_begin(data.rows(), part + 1, parts), sums, sums + k * cols);
+	}
+	add_parts(partial, stride, k * cols + k, parts);
+}
+
+/*
+Lay out the means in buffers.old_means for the distance engine selected in the parameters, and size the
+buffers for an assignment step which adds up the given number of parts of the data in buffers.thread_sums.
+Returns the SIMD level to use, which is none unless the SIMD kernels are used.
+*/
+template <typename T, size_t N>
+simd_level prepare_iteration(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	size_t parts,
+	lloyd_buffers<T>& buffers) {
+	const size_t cols = data.cols();
+	const size_t k = parameters.get_k();
+	const matrix_view<T> means = view_of(buffers.old_means, cols);
+	simd_level level = simd_level::none;
+	if (parameters.get_distance_engine() == distance_engine::blocked) {
+		blocked_prepare_means<T, N>(means, buffers.blocked);
+	} else if (is_simd_type<T>::value) {
+		level = simd_level_for(k);
+		if (level != simd_level::none) {
+			simd_prepare_means(means, level, buffers.simd);
+		}
+	}
+	buffers.clusters.resize(data.rows());
+	buffers.thread_sums.resize(thread_block_stride<accumulate_t<T>>(k, cols) * parts);
+	return level;
+}
+
+/*
+Copy the data into buffers.compact if the parameters store the points in reduced precision, otherwise
+mark it as unused.
+*/
+template <typename T>
+bool prepare_compact_points(const matrix_view<T>& data, const clustering_parameters<T>& parameters, lloyd_buffers<T>& buffers) {
+	if (!stores_compact_points<T>(parameters.get_point_storage())) {
+		buffers.compact.storage = point_storage::full;
+		return false;
+	}
+	resize_compact_points(data, parameters.get_point_storage(), buffers.compact);
+	return true;
+}
+
+/*
+Assign the points from begin to end of the compact copy of the data to their closest means in
+buffers.old_means, laid out by `prepare_iteration`, and add them to the partial sums in sums (k * cols
+values followed by the k counts) as in `accumulate_points`. The points are decoded into block
+blocked_point_block points at a time. If distances isn't null, the squared distance from each point to
+its mean is stored in it as well.
+*/
+template <typename T, size_t N>
+void compact_assign_and_accumulate(distance_engine engine,
+	simd_level level,
+	bool changed_only,
+	size_t begin,
+	size_t end,
+	lloyd_buffers<T>& buffers,
+	accumulate_t<T>* sums,
+	T* distances,
+	decoded_block<T>& block) {
+	const size_t cols = buffers.compact.cols;
+	const matrix_view<T> means = view_of(buffers.old_means, cols);
+	const size_t k = means.rows();
+	for (size_t first = begin; first < end; first += blocked_point_block) {
+		const size_t last = std::min(first + blocked_point_block, end);
+		const matrix_view<T> points = decode_points(buffers.compact, first, last, block.points);
+		uint32_t* clusters = &buffers.clusters[first];
+		T* point_distances = distances ? distances + first : nullptr;
+		if (engine == distance_engine::blocked) {
+			point_norms<T, N>(points, block.norms);
+			blocked_calculate_clusters_range<T, N>(points, block.norms, means, buffers.blocked, 0, points.rows(), clusters, point_distances);
+		} else {
+			calculate_clusters_range<T, N>(points, means, buffers.simd, level, 0, points.rows(), clusters, point_distances);
+		}
+		accumulate_points<accumulate_t<T>, T, N>(points, clusters, changed_only ? &buffers.previous_clusters[first] : nullptr,
+			changed_only, 0, points.rows(), sums, sums + k * cols);
+	}
+}
+
+/*
+The assignment and update steps of iteration count of Lloyd's algorithm on the compact copy of the data,
+see `point_storage`. The points of each part of the data (a single part, or those of `deterministic_parts`
+when the parameters ask for deterministic results) are added up on their own, and the parts are added
+together in order, as in `kmeans_lloyd_parallel`.
+*/
+template <typename T, size_t N>
+void compact_iteration(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	size_t count,
+	lloyd_buffers<T>& buffers,
+	T* distances) {
+	using A = accumulate_t<T>;
+	const size_t k = parameters.get_k();
+	const size_t stride = thread_block_stride<A>(k, data.cols());
+	const size_t parts = parameters.get_deterministic() ? deterministic_parts(data.rows()) : 1;
+	const size_t interval = parameters.get_recompute_interval();
+	const bool from_scratch = parameters.get_mean_update() == mean_update::full
+		|| count == 0 || (interval > 0 && count % interval == 0);
+	const simd_level level = prepare_iteration<T, N>(data, parameters, parts, buffers);
+	for (size_t part = 0; part < parts; ++part) {
+		A* sums = &buffers.thread_sums[part * stride];
+		std::fill(sums, sums + k * data.cols() + k, A());
+		compact_assign_and_accumulate<T, N>(parameters.get_distance_engine(), level, !from_scratch,
+			part_begin(data.rows(), part, parts), part_begin(data.rows(), part + 1, parts), buffers, sums, distances, buffers.decoded);
+	}
+	add_parts(buffers.thread_sums, stride, k * data.cols() + k, parts);
+	means_from_partial_sums<T, N>(parameters, data.cols(), from_scratch, buffers);
+}
+
+/*
+Update the means after the assignment step of iteration count, either recalculating them from scratch or
+incrementally from the points that changed cluster, as selected in the parameters. The incremental sums
+are recalculated on the first iteration and then every recompute interval. When the parameters ask for
+deterministic results, the points are added up in the parts of `deterministic_parts`.
+*/
+template <typename T, size_t N>
+void update_means(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	size_t count,
+	lloyd_buffers<T>& buffers) {
+	const matrix_view<T> old_means = view_of(buffers.old_means, data.cols());
+	const size_t interval = parameters.get_recompute_interval();
+	if (parameters.get_deterministic()) {
+		const bool from_scratch = parameters.get_mean_update() == mean_update::full
+			|| count == 0 || (interval > 0 && count % interval == 0);
+		sum_parts<accumulate_t<T>, T, N>(data, parameters.get_k(), !from_scratch, deterministic_parts(data.rows()),
+			buffers, buffers.thread_sums);
+		means_from_partial_sums<T, N>(parameters, data.cols(), from_scratch, buffers);
+		return;
+	}
+	if (parameters.get_mean_update() == mean_update::full) {
+		calculate_means<T, N>(data, buffers.clusters, old_means, parameters.get_k(), buffers.means, buffers.sums, buffers.sizes);
+		return;
+	}
+	if (count == 0 || (interval > 0 && count % interval == 0)) {
+		calculate_cluster_sums<T, N>(data, buffers.clusters, parameters.get_k(), buffers.sums, buffers.sizes);
+	} else {
+		update_cluster_sums<T, N>(data, buffers.previous_clusters, buffers.clusters, buffers.sums, buffers.sizes);
+	}
+	means_from_sums<T, N>(buffers.sums, buffers.sizes, old_means, buffers.means);
+}
+
+/*
+Lloyd's algorithm on flat data, behind each of the `kmeans_lloyd` overloads. N is the dimension of the
+data, or `dynamic_dimension` if it is only known at runtime. The means (in a flat, row-major buffer) and
+the cluster assignments are left in buffers.means and buffers.clusters. The previous means are rotated
+through the buffers by swapping, so the iterations don't allocate once the buffers are large enough.
+With keep_distances, the squared distance from each point to the returned mean of its cluster is left in
+buffers.distances.
+*/
+template <typename T, typename S, size_t N>
+void kmeans_lloyd(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	lloyd_buffers<T>& buffers,
+	bool keep_distances = false) {
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.rows() >= parameters.get_k()); // there must be at least k data points
+	const size_t cols = data.cols();
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	initial_means<T, S, N>(data, parameters.get_k(), seed, parameters.get_initialization(), buffers.means, buffers.seeding);
+
+	std::vector<T>& means = buffers.means;
+	std::vector<T>& old_means = buffers.old_means;
+	std::vector<T>& old_old_means = buffers.old_old_means;
+	old_means.clear();
+	old_old_means.clear();
+	const bool compact = prepare_compact_points(data, parameters, buffers);
+	if (compact) {
+		compress_points(data, 0, data.rows(), buffers.compact);
+	} else if (parameters.get_distance_engine() == distance_engine::blocked) {
+		point_norms<T, N>(data, buffers.norms);
+	}
+	T* distances = nullptr;
+	if (keep_distances) {
+		buffers.distances.resize(data.rows());
+		distances = buffers.distances.data();
+	}
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	size_t count = 0;
+	bool converged = false;
+	do {
+		if (parameters.get_mean_update() == mean_update::incremental) {
+			// Keep the previous assignments to find the points which change cluster
+			buffers.previous_clusters.swap(buffers.clusters);
+		}
+		old_old_means.swap(old_means);
+		old_means.swap(means);
+		if (compact) {
+			// The compact points are assigned to the means in the same pass as they are added up
+			compact_iteration<T, N>(data, parameters, count, buffers, distances);
+		} else {
+			if (parameters.get_distance_engine() == distance_engine::blocked) {
+				blocked_calculate_clusters<T, N>(data, buffers.norms, view_of(old_means, cols), buffers.clusters, buffers.blocked, distances);
+			} else {
+				calculate_clusters<T, N>(data, view_of(old_means, cols), buffers.clusters, buffers.simd, distances);
+			}
+			update_means<T, N>(data, parameters, count, buffers);
+		}
+		++count;
+		converged = means == old_means || means == old_old_means
+			|| (parameters.has_min_delta() && deltas_below_limit<T, N>(
+				view_of(old_means, cols), view_of(means, cols), parameters.get_min_delta(), buffers.deltas));
+	} while (!converged && !(parameters.has_max_iteration() && count == parameters.get_max_iteration()));
+	if (keep_distances && means != old_means) {
+		// The means moved after the last assignment step, so measure the distances to the returned means
+		distances_to_means<T, N>(data, 0, data.rows(), buffers);
+	}
+	buffers.iterations = count;
+	buffers.converged = converged;
+	buffers.abandoned = false;
+}
+
+template <typename T, typename S, size_t N>
+std::tuple<std::vector<T>, std::vector<uint32_t>> kmeans_lloyd(
+	const matrix_view<T>& data, const clustering_parameters<T>& parameters) {
+	lloyd_buffers<T> buffers;
+	kmeans_lloyd<T, S, N>(data, parameters, buffers);
+	return std::tuple<std::vector<T>, std::vector<uint32_t>>(std::move(buffers.means), std::move(buffers.clusters));
+}
 
-	void set_random_seed(S rand_seed)
-	{
-		_rand_seed = rand_seed;
-		_has_rand_seed = true;
+/*
+Lloyd's algorithm on data with a dimension that is only known at runtime. The common dimensions are
+dispatched to implementations specialized for that dimension.
+*/
+template <typename T, typename S>
+void kmeans_lloyd_dynamic(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	lloyd_buffers<T>& buffers,
+	bool keep_distances) {
+	switch (data.cols()) {
+	case 1: return kmeans_lloyd<T, S, 1>(data, parameters, buffers, keep_distances);
+	case 2: return kmeans_lloyd<T, S, 2>(data, parameters, buffers, keep_distances);
+	case 3: return kmeans_lloyd<T, S, 3>(data, parameters, buffers, keep_distances);
+	case 4: return kmeans_lloyd<T, S, 4>(data, parameters, buffers, keep_distances);
+	case 8: return kmeans_lloyd<T, S, 8>(data, parameters, buffers, keep_distances);
+	case 16: return kmeans_lloyd<T, S, 16>(data, parameters, buffers, keep_distances);
+	case 32: return kmeans_lloyd<T, S, 32>(data, parameters, buffers, keep_distances);
+	case 64: return kmeans_lloyd<T, S, 64>(data, parameters, buffers, keep_distances);
+	case 128: return kmeans_lloyd<T, S, 128>(data, parameters, buffers, keep_distances);
+	default: return kmeans_lloyd<T, S, dynamic_dimension>(data, parameters, buffers, keep_distances);
 	}
+}
 
-	bool has_max_iteration() const { return _has_max_iter; }
-	bool has_min_delta() const { return _has_min_delta; }
-	bool has_random_seed() const { return _has_rand_seed; }
+/*
+The type of the means in a `kmeans_result`: a vector of fixed-size arrays when the dimension is known at
+compile time, or a flat, row-major vector when it is `dynamic_dimension`.
+*/
+template <typename T, size_t N>
+struct result_means {
+	using type = std::vector<std::array<T, N>>;
+	static type from(std::vector<T>& means) { return to_arrays<T, N>(means); }
+};
 
-	uint32_t get_k() const { return _k; };
-	size_t get_max_iteration() const { return _max_iter; }
-	T get_min_delta() const { return _min_delta; }
-	S get_random_seed() const { return _rand_seed; }
+template <typename T>
+struct result_means<T, dynamic_dimension> {
+	using type = std::vector<T>;
+	static type from(std::vector<T>& means) { return std::move(means); }
+};
+
+} // namespace details
+
+/*
+kmeans_workspace owns all of the memory used by the iterations of `kmeans_lloyd` and
+`kmeans_lloyd_parallel`, and holds the results of the last clustering it was used for. Passing the same
+workspace to repeated calls (e.g. clustering the colours of many small images) reuses its buffers, so
+once they have grown to fit the largest data set the iterations make no heap allocations. Only the
+initial means are allocated per call.
+
+N is the dimension of the data, or `details::dynamic_dimension` for the runtime dimension overloads, in
+which case the same workspace can be used for data of any dimension.
+*/
+template <typename T, size_t N = details::dynamic_dimension>
+class kmeans_workspace {
+public:
+	/*
+	The means calculated by the last clustering, one row per cluster.
+	*/
+	matrix_view<T> means() const { return details::view_of(_buffers.means, _cols); }
+
+	/*
+	The cluster number (0 to k-1) of each data point in the last clustering.
+	*/
+	const std::vector<uint32_t>& clusters() const { return _buffers.clusters; }
+
+	/*
+	Used by the clustering functions to run in this workspace.
+	*/
+	details::lloyd_buffers<T>& buffers(size_t cols) {
+		assert(N == details::dynamic_dimension || N == cols);
+		_cols = cols;
+		return _buffers;
+	}
 
 private:
-	uint32_t _k;
-	bool _has_max_iter;
-	size_t _max_iter;
-	bool _has_min_delta;
-	T _min_delta;
-	bool _has_rand_seed;
-	S _rand_seed;
+	details::lloyd_buffers<T> _buffers;
+	size_t _cols = details::flat_dimension<N>(1);
 };
 
+/*
+kmeans_result holds everything the clustering calculates, as returned by `kmeans_lloyd_result` and
+`kmeans_lloyd_parallel_result`. The distances are kept by the final assignment step as it finds each
+point's closest mean, so unlike `means_inertia` they usually need no further pass over the data. When the
+means still moved in the last update (the clustering stopped at the maximum iteration count or converged
+by the minimum delta), the distances to the returned means are measured in one more pass, without
+changing the clusters.
+
+N is the dimension of the data, or `details::dynamic_dimension` for the runtime dimension overloads, in
+which case the means are held in a flat, row-major vector (k * cols values).
+*/
+template <typename T, size_t N = details::dynamic_dimension>
+struct kmeans_result {
+	// The means for each cluster from 0 to k-1
+	typename details::result_means<T, N>::type means;
+	// The cluster number (0 to k-1) of each data point
+	std::vector<uint32_t> clusters;
+	// The squared distance from each data point to the returned mean of its cluster
+	std::vector<T> distances;
+	// The sum of the distances from each point to its mean, as defined by `means_inertia`
+	T inertia = T();
+	// The number of iterations run, and whether the means converged rather than the clustering stopping
+	// at the maximum iteration count
+	size_t iterations = 0;
+	bool converged = false;
+};
+
+namespace details {
+
+/*
+Move the results of the last clustering out of buffers into a `kmeans_result`.
+*/
+template <typename T, size_t N>
+kmeans_result<T, N> take_result(lloyd_buffers<T>& buffers) {
+	kmeans_result<T, N> result;
+	result.means = result_means<T, N>::from(buffers.means);
+	result.clusters = std::move(buffers.clusters);
+	result.inertia = static_cast<T>(kept_inertia(buffers.distances));
+	result.distances = std::move(buffers.distances);
+	result.iterations = buffers.iterations;
+	result.converged = buffers.converged;
+	return result;
+}
+
+} // namespace details
+
 /*
 Implementation of k-means generic across the data type and the dimension of each data item. Expects
 the data to be a vector of fixed-size arrays. Generic parameters are the type of the base data (T)
@@ -300,20 +3756,138 @@ used for initializing the means.
 */
 template <typename T, typename S = uint64_t, size_t N>
 std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	auto result = details::kmeans_lloyd<T, S, N>(details::view_of(data), parameters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(
+		details::to_arrays<T, N>(std::get<0>(result)), std::move(std::get<1>(result)));
+}
+
+/*
+Implementation of k-means for a vector of fixed-size arrays which runs in the given workspace, reusing
+its buffers from previous calls. The results are the same as for the overload above, and are read from
+the workspace's `means()` and `clusters()`. See `kmeans_workspace` for details.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+void kmeans_lloyd(const std::vector<std::array<T, N>>& data,
+	const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace) {
+	details::kmeans_lloyd<T, S, N>(details::view_of(data), parameters, workspace.buffers(N));
+}
+
+/*
+This overload exists to support legacy code which uses this signature of the kmeans_lloyd function.
+Any code still using this signature should move to the version of this function that uses a
+`clustering_parameters` struct for configuration.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<T, N>>& data, uint32_t k,
+	size_t max_iter = 0, T min_delta = -1.0) {
+	clustering_parameters<T> parameters(k);
+	if (max_iter != 0) {
+		parameters.set_max_iteration(max_iter);
+	}
+	if (min_delta != 0) {
+		parameters.set_min_delta(min_delta);
+	}
+	return kmeans_lloyd(data, parameters);
+}
+
+/*
+Implementation of k-means for data with a dimension that is only known at runtime, which runs in the
+given workspace, reusing its buffers from previous calls. The results are read from the workspace's
+`means()` and `clusters()`; see the overload below for the details of the data layout.
+*/
+template <typename T, typename S = uint64_t>
+void kmeans_lloyd(const matrix_view<T>& data, const clustering_parameters<T>& parameters, kmeans_workspace<T>& workspace) {
+	details::kmeans_lloyd_dynamic<T, S>(data, parameters, workspace.buffers(data.cols()), false);
+}
+
+/*
+Implementation of k-means for data with a dimension that is only known at runtime, such as a buffer
+shared with another library. Expects the data to be held in a row-major buffer (one point per row,
+with an optional row stride, see `matrix_view`) which is used in place, without copying. The results
+are the same as for the std::array overload with the same data and parameters. The common dimensions
+(1 to 4, 8, 16, 32, 64 and 128) are dispatched to implementations specialized for that dimension, and
+the rest share one implementation that loops over the dimensions at runtime.
+
+Returns a std::tuple containing:
+  0: A flat, row-major vector holding the means for each cluster from 0 to k-1 (k * cols values).
+  1: A vector containing the cluster number (0 to k-1) for each row of the input data.
+*/
+template <typename T, typename S = uint64_t>
+std::tuple<std::vector<T>, std::vector<uint32_t>> kmeans_lloyd(
+	const matrix_view<T>& data, const clustering_parameters<T>& parameters) {
+	kmeans_workspace<T> workspace;
+	kmeans_lloyd<T, S>(data, parameters, workspace);
+	auto& buffers = workspace.buffers(data.cols());
+	return std::tuple<std::vector<T>, std::vector<uint32_t>>(std::move(buffers.means), std::move(buffers.clusters));
+}
+
+template <typename T, typename S = uint64_t>
+std::tuple<std::vector<T>, std::vector<uint32_t>> kmeans_lloyd(
+	const T* data, size_t rows, size_t cols, const clustering_parameters<T>& parameters) {
+	return kmeans_lloyd<T, S>(matrix_view<T>(data, rows, cols), parameters);
+}
+
+/*
+Implementation of k-means for a vector of fixed-size arrays, like `kmeans_lloyd`, which also returns the
+distance from each point to its mean, the inertia of the clustering, the number of iterations and whether
+the means converged. See `kmeans_result` for details. The means and clusters are the same as those
+returned by `kmeans_lloyd`.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+kmeans_result<T, N> kmeans_lloyd_result(const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	details::lloyd_buffers<T> buffers;
+	details::kmeans_lloyd<T, S, N>(details::view_of(data), parameters, buffers, true);
+	return details::take_result<T, N>(buffers);
+}
+
+/*
+Implementation of k-means for data with a dimension that is only known at runtime which returns a
+`kmeans_result`, with the means in a flat, row-major vector. See `kmeans_lloyd_result` above.
+*/
+template <typename T, typename S = uint64_t>
+kmeans_result<T> kmeans_lloyd_result(const matrix_view<T>& data, const clustering_parameters<T>& parameters) {
+	details::lloyd_buffers<T> buffers;
+	details::kmeans_lloyd_dynamic<T, S>(data, parameters, buffers, true);
+	return details::take_result<T, details::dynamic_dimension>(buffers);
+}
+
+/*
+Implementation of k-means using [Elkan's algorithm](https://www.aaai.org/Papers/ICML/2003/ICML03-022.pdf),
+which uses the triangle inequality to avoid most of the distance calculations made by Lloyd's algorithm.
+It produces the same results as `kmeans_lloyd` and takes the same parameters, but keeps an upper bound
+and k lower bounds per point, so it needs O(n * k) additional memory. It works best on high dimensional
+data where distance calculations are expensive.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_elkan(
 	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
 	assert(parameters.get_k() > 0); // k must be greater than zero
 	assert(data.size() >= parameters.get_k()); // there must be at least k data points
 	std::random_device rand_device;
 	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
-	std::vector<std::array<T, N>> means = details::random_plusplus(data, parameters.get_k(), seed);
+	std::vector<std::array<T, N>> means = details::initial_means(data, parameters.get_k(), seed, parameters.get_initialization());
 
 	std::vector<std::array<T, N>> old_means;
 	std::vector<std::array<T, N>> old_old_means;
 	std::vector<uint32_t> clusters;
+	details::elkan_bounds<T> bounds;
 	// Calculate new means until convergence is reached or we hit the maximum iteration count
 	size_t count = 0;
 	do {
-		clusters = details::calculate_clusters(data, means);
+		if (count == 0) {
+			details::elkan_initialize(data, means, clusters, bounds);
+		} else {
+			details::elkan_update_bounds(bounds, clusters, details::mean_shifts(old_means, means));
+			details::elkan_calculate_clusters(data, means, clusters, bounds);
+		}
 		old_old_means = old_means;
 		old_means = means;
 		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
@@ -326,22 +3900,192 @@ std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
 }
 
 /*
-This overload exists to support legacy code which uses this signature of the kmeans_lloyd function.
-Any code still using this signature should move to the version of this function that uses a
-`clustering_parameters` struct for configuration.
+Implementation of k-means using [Hamerly's algorithm](https://doi.org/10.1137/1.9781611972801.12), which
+keeps a single upper and lower bound per point and skips the scan over the means whenever the bounds show
+that a point's assignment can't change. It produces the same results as `kmeans_lloyd` and takes the same
+parameters. Compared with `kmeans_elkan` it needs only O(n) additional memory and works best on low
+dimensional data with a moderate number of clusters.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
 */
-template <typename T, size_t N>
-std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
-	const std::vector<std::array<T, N>>& data, uint32_t k,
-	size_t max_iter = 0, T min_delta = -1.0) {
-	clustering_parameters<T> parameters(k);
-	if (max_iter != 0) {
-		parameters.set_max_iteration(max_iter);
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_hamerly(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::vector<std::array<T, N>> means = details::initial_means(data, parameters.get_k(), seed, parameters.get_initialization());
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<uint32_t> clusters;
+	details::hamerly_bounds<T> bounds;
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	size_t count = 0;
+	do {
+		if (count == 0) {
+			details::hamerly_initialize(data, means, clusters, bounds);
+		} else {
+			details::hamerly_calculate_clusters(data, old_means, means, clusters, bounds);
+		}
+		old_old_means = old_means;
+		old_means = means;
+		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
+		++count;
+	} while (means != old_means && means != old_old_means
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+/*
+Implementation of k-means using the [Yinyang algorithm](http://proceedings.mlr.press/v37/ding15.pdf),
+which splits the means into t = k / 10 groups and keeps an upper bound and one lower bound per group for
+each point. Whole groups of means are skipped whenever the bounds show none of them can be closer than the
+assigned mean. It produces the same results as `kmeans_lloyd` and takes the same parameters, needs O(n * t)
+additional memory, and works best when k is large.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_yinyang(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::vector<std::array<T, N>> means = details::initial_means(data, parameters.get_k(), seed, parameters.get_initialization());
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<uint32_t> clusters;
+	details::yinyang_groups groups = details::yinyang_make_groups(means, seed);
+	details::yinyang_bounds<T> bounds;
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	size_t count = 0;
+	do {
+		if (count == 0) {
+			details::yinyang_initialize(data, means, groups, clusters, bounds);
+		} else {
+			details::yinyang_calculate_clusters(data, old_means, means, groups, clusters, bounds);
+		}
+		old_old_means = old_means;
+		old_means = means;
+		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
+		++count;
+	} while (means != old_means && means != old_old_means
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+/*
+Implementation of k-means using the [filtering algorithm](https://doi.org/10.1109/TPAMI.2002.1017616)
+of Kanungo et al. A kd-tree is built over the data once, and each iteration walks the tree, filtering
+out the means that can't be closest to any point in each cell. Whole subtrees are assigned to a single
+mean at once, using sums calculated when the tree was built. It takes the same parameters and returns
+the same results as `kmeans_lloyd` (up to floating point rounding in the means), and works best on low
+dimensional data (2 to 8 dimensions) with many points.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_kdtree(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::vector<std::array<T, N>> means = details::initial_means(data, parameters.get_k(), seed, parameters.get_initialization());
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<uint32_t> clusters;
+	details::kd_tree<T, N> tree = details::kd_tree_build(data);
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	size_t count = 0;
+	do {
+		old_old_means = old_means;
+		old_means = means;
+		means = details::kd_tree_calculate_means(tree, data, old_means, clusters);
+		++count;
+	} while (means != old_means && means != old_old_means
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+/*
+Implementation of [mini-batch k-means](https://dl.acm.org/doi/10.1145/1772690.1772862) (Sculley, 2010).
+Each batch samples a small number of points, assigns them to their closest means, and moves the means
+towards them with a per-mean learning rate. The means are initialized with kmeans++ over a sample of three
+batches, so the cost of the algorithm depends on the batch size and count rather than the size of the data
+set. The results approximate those of `kmeans_lloyd`. Only floating point data types are supported.
+
+Takes a `minibatch_parameters` struct for algorithm configuration.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector, calculated in a full pass over the data after the last batch. This is empty if the full
+	 pass is disabled.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_minibatch(
+	const std::vector<std::array<T, N>>& data, const minibatch_parameters<T, S>& parameters) {
+	static_assert(std::is_floating_point<T>::value, "kmeans_minibatch requires a floating point data type");
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	assert(parameters.get_batch_size() > 0); // batches must contain at least one point
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+	// The batches are drawn into the same buffer, so the memory used doesn't depend on the batch count
+	std::vector<std::array<T, N>> sample;
+	auto sample_size = std::max<size_t>(3 * parameters.get_batch_size(), parameters.get_k());
+	std::vector<std::array<T, N>> means = details::initial_means(details::random_sample(data, sample_size, rand_engine, sample),
+		parameters.get_k(), seed, parameters.get_initialization());
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<uint32_t> batch_clusters;
+	details::simd_means<T> prepared;
+	std::vector<T> delta_buffer;
+	std::vector<size_t> counts(parameters.get_k(), 0);
+	std::vector<size_t> window_counts(parameters.get_k(), 0);
+	size_t window_batches = 0;
+	for (size_t count = 0; count < parameters.get_batch_count(); ++count) {
+		const auto& batch = details::random_sample(data, parameters.get_batch_size(), rand_engine, sample);
+		details::calculate_clusters<T, N>(details::view_of(batch), details::view_of(means), batch_clusters, prepared);
+		old_means = means;
+		details::minibatch_update(batch, batch_clusters, means, counts);
+		if (parameters.get_reassignment_ratio() > 0) {
+			details::minibatch_reassign(batch, batch_clusters, means, counts, window_counts, window_batches,
+				parameters.get_reassignment_ratio(), parameters.get_reassignment_interval(), rand_engine);
+		}
+		if (parameters.has_min_delta() && details::deltas_below_limit<T, N>(details::view_of(old_means),
+				details::view_of(means), parameters.get_min_delta(), delta_buffer)) {
+			break;
+		}
 	}
-	if (min_delta != 0) {
-		parameters.set_min_delta(min_delta);
+
+	std::vector<uint32_t> clusters;
+	if (parameters.get_full_pass()) {
+		clusters = details::calculate_clusters(data, means);
 	}
-	return kmeans_lloyd(data, parameters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
 }
 
 } // namespace dkm
@@ -6,114 +6,1782 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
+#include <condition_variable>
 #include <cstdint>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <string>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "dkm.hpp"
 
+#if !defined(DKM_DISABLE_AFFINITY) && defined(__linux__)
+#define DKM_THREAD_AFFINITY
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+DKM - A k-means implementation that is generic across variable data dimensions.
+*/
+namespace dkm {
+
+/*
+restart_policy sets when `get_best_means_parallel` abandons a restart which is clearly going to end up
+worse than the best restart so far, instead of running it until it converges:
+* Check iteration; the iteration after which the inertia of each restart is compared with the lowest
+  inertia of the restarts that have already finished. Defaults to 0, which never abandons a restart.
+* Abandon ratio; a restart is abandoned if its inertia at the check iteration is more than this multiple
+  of the lowest finished inertia. Defaults to 1.1. The inertia of a restart keeps falling as it
+  converges, so lower ratios abandon more restarts, at a higher risk of abandoning the one that would
+  have been the best.
+*/
+class restart_policy {
+public:
+	restart_policy() : _check_iteration(0), _abandon_ratio(1.1) {}
+
+	void set_check_iteration(size_t check_iteration) { _check_iteration = check_iteration; }
+	void set_abandon_ratio(double abandon_ratio) { _abandon_ratio = abandon_ratio; }
+
+	size_t get_check_iteration() const { return _check_iteration; }
+	double get_abandon_ratio() const { return _abandon_ratio; }
+
+private:
+	size_t _check_iteration;
+	double _abandon_ratio;
+};
+
+/*
+restart_report describes the restarts run by `get_best_means_parallel`: the number that finished and
+the number that were abandoned, the total number of iterations they ran, and an estimate of the number
+of iterations saved by abandoning restarts. The estimate assumes each abandoned restart would have run
+as many iterations as the average finished restart.
+*/
+struct restart_report {
+	uint32_t finished = 0;
+	uint32_t abandoned = 0;
+	size_t iterations = 0;
+	size_t iterations_saved = 0;
+};
+
+/*
+These functions are all private implementation details and shouldn't be referenced outside of this
+file.
+*/
+namespace details {
+
+#if defined(DKM_THREAD_AFFINITY)
+/*
+Pin a thread to the given CPU cores, returning whether it succeeded. Cores that don't exist are skipped.
+*/
+inline bool pin_thread(pthread_t thread, const std::vector<int>& cores) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int core : cores) {
+		if (core >= 0 && core < CPU_SETSIZE) {
+			CPU_SET(core, &set);
+		}
+	}
+	return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+#endif
+
+/*
+Pins the calling thread to the given CPU cores for the lifetime of the object, then restores the cores it
+was allowed to run on before. Does nothing if the list of cores is empty, or on other platforms than
+Linux.
+*/
+class scoped_affinity {
+public:
+	explicit scoped_affinity(const std::vector<int>& cores) {
+#if defined(DKM_THREAD_AFFINITY)
+		_pinned = !cores.empty() && pthread_getaffinity_np(pthread_self(), sizeof(_previous), &_previous) == 0
+			&& pin_thread(pthread_self(), cores);
+#else
+		(void)cores;
+#endif
+	}
+
+	~scoped_affinity() {
+#if defined(DKM_THREAD_AFFINITY)
+		if (_pinned) {
+			pthread_setaffinity_np(pthread_self(), sizeof(_previous), &_previous);
+		}
+#endif
+	}
+
+	scoped_affinity(const scoped_affinity&) = delete;
+	scoped_affinity& operator=(const scoped_affinity&) = delete;
+
+private:
+#if defined(DKM_THREAD_AFFINITY)
+	cpu_set_t _previous;
+	bool _pinned = false;
+#endif
+};
+
+} // namespace details
+
+/*
+thread_pool runs the parallel parts of the `_parallel` functions on a fixed set of threads. Each call to
+`parallel_for` is split into tasks which are shared out between the threads in contiguous ranges; a
+thread that runs out of tasks steals half of the remaining range of another thread. The calling thread
+runs tasks as well, so a pool of size n starts n - 1 threads, and a pool of size 1 runs everything on
+the calling thread.
+
+Calls from several threads at once (e.g. several clusterings running for different requests) share the
+pool's threads rather than each starting their own, so they never run more threads than the pool holds.
+Tasks may call `parallel_for` themselves, as `get_best_means_parallel` does to run each restart in
+parallel. Unless a pool is passed to them, the `_parallel` functions use `default_thread_pool()`.
+
+Loops that run one after another, such as the iterations of `kmeans_lloyd_parallel`, run on a `team`
+instead, which keeps its threads between the loops. The pool keeps the state of finished calls for
+reuse, so once it has run as many calls at once before, neither makes any allocations.
+*/
+class thread_pool {
+	struct job;
+
+public:
+	/*
+	A group of the pool's threads which runs a sequence of `parallel_for` loops, made by `run_team`. The
+	threads join the team once and wait at a barrier between the loops, rather than being handed a new job
+	for each loop. Only the thread which called `run_team` may start the loops; it runs tasks as well.
+	*/
+	class team {
+	public:
+		~team() {
+			if (_job != nullptr) {
+				_pool.close(*_job);
+			}
+		}
+
+		team(const team&) = delete;
+		team& operator=(const team&) = delete;
+
+		/*
+		The number of threads in the team, including the calling thread.
+		*/
+		size_t size() const { return _members; }
+
+		/*
+		Like `thread_pool::parallel_for`, on at most the given number of the team's threads (or all of them
+		if it's 0).
+		*/
+		template <typename F>
+		void parallel_for(size_t tasks, size_t threads, const F& body) {
+			parallel_for_slots(tasks, threads, [&body](size_t task, size_t) { body(task); });
+		}
+
+		template <typename F>
+		void parallel_for(size_t tasks, const F& body) {
+			parallel_for(tasks, 0, body);
+		}
+
+		/*
+		Like `thread_pool::parallel_for_slots`, on at most the given number of the team's threads (or all of
+		them if it's 0).
+		*/
+		template <typename F>
+		void parallel_for_slots(size_t tasks, size_t threads, const F& body) {
+			const size_t ranges = std::min(tasks, threads == 0 ? _members : std::min(threads, _members));
+			if (_job == nullptr || ranges <= 1) {
+				for (size_t task = 0; task < tasks; ++task) {
+					body(task, 0);
+				}
+				return;
+			}
+			job& work = *_job;
+			{
+				std::unique_lock<std::mutex> lock(work.mutex);
+				work.call = &call_body<F>;
+				work.body = &body;
+				work.phase_ranges = ranges;
+				// A thread may still be looking for tasks to steal from the last loop, so the ranges are
+				// written under their own locks
+				for (size_t r = 0; r < work.members; ++r) {
+					std::lock_guard<std::mutex> range_lock(work.ranges[r].mutex);
+					work.ranges[r].begin = r < ranges ? tasks * r / ranges : 0;
+					work.ranges[r].end = r < ranges ? tasks * (r + 1) / ranges : 0;
+				}
+				work.remaining = tasks;
+				work.cancelled = false;
+				++work.phase;
+			}
+			work.changed.notify_all();
+			// The calling thread takes the first range, and the team's threads take the rest
+			run(work, 0);
+			std::unique_lock<std::mutex> lock(work.mutex);
+			work.changed.wait(lock, [&] { return work.active == 0 && (work.remaining == 0 || work.cancelled); });
+			if (work.error) {
+				std::exception_ptr error = work.error;
+				work.error = nullptr;
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		friend class thread_pool;
+
+		team(thread_pool& pool, size_t members, bool single_loop)
+			: _pool(pool), _job(nullptr), _members(std::max<size_t>(members, 1)) {
+			if (_members > 1) {
+				_job = pool.open(_members, single_loop);
+			}
+		}
+
+		thread_pool& _pool;
+		job* _job;
+		size_t _members;
+	};
+
+	explicit thread_pool(size_t threads = std::max<unsigned>(std::thread::hardware_concurrency(), 1)) {
+		for (size_t i = 1; i < threads; ++i) {
+			_workers.emplace_back([this] { work(); });
+		}
+	}
+
+	/*
+	A pool with one thread for each of the given CPU cores, with each thread pinned to its core (on Linux).
+	The calling thread takes the place of the first core, and isn't pinned by the pool.
+	*/
+	explicit thread_pool(const std::vector<int>& cores) {
+		for (size_t i = 1; i < cores.size(); ++i) {
+			_workers.emplace_back([this] { work(); });
+#if defined(DKM_THREAD_AFFINITY)
+			details::pin_thread(_workers.back().native_handle(), std::vector<int>(1, cores[i]));
+#endif
+		}
+	}
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
+		for (std::thread& worker : _workers) {
+			worker.join();
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	/*
+	The number of threads running tasks, including the calling thread.
+	*/
+	size_t size() const { return _workers.size() + 1; }
+
+	/*
+	Call body(task) for each task from 0 to tasks - 1 on at most the given number of threads (or all of
+	the pool's threads if it's 0), returning once they have all finished. The tasks are run in parallel,
+	in no particular order, so each must be independent of the others. If a task throws, the tasks not yet
+	started are skipped and the exception is rethrown once the running ones have finished.
+	*/
+	template <typename F>
+	void parallel_for(size_t tasks, size_t threads, const F& body) {
+		parallel_for_slots(tasks, threads, [&body](size_t task, size_t) { body(task); });
+	}
+
+	template <typename F>
+	void parallel_for(size_t tasks, const F& body) {
+		parallel_for(tasks, 0, body);
+	}
+
+	/*
+	Like `parallel_for`, calling body(task, slot) where slot is the index (below the number of threads)
+	of the thread running the task within this call. Tasks with the same slot never run at the same time,
+	so they can share per-thread buffers without locking.
+	*/
+	template <typename F>
+	void parallel_for_slots(size_t tasks, size_t threads, const F& body) {
+		team single(*this, std::min(tasks, team_size(threads)), true);
+		single.parallel_for_slots(tasks, 0, body);
+	}
+
+	/*
+	Call body(team) on the calling thread with a team of at most the given number of threads (or all of
+	the pool's threads if it's 0), for a sequence of loops run on the same threads.
+	*/
+	template <typename F>
+	void run_team(size_t threads, const F& body) {
+		team members(*this, team_size(threads), false);
+		body(members);
+	}
+
+private:
+	/*
+	The tasks from begin to end that are still to be run by the thread that owns the range.
+	*/
+	struct task_range {
+		std::mutex mutex;
+		size_t begin = 0;
+		size_t end = 0;
+	};
+
+	/*
+	The state of one team: the threads that have joined it, and the loop it's running, with the tasks split
+	evenly between the first phase_ranges ranges. Each loop advances the phase. Apart from next_member
+	(which is guarded by the pool's mutex) and the ranges (guarded by their own), the fields are only
+	changed with mutex held, so the threads can wait on changed for them.
+	*/
+	struct job {
+		void reset(size_t member_count, bool single) {
+			if (capacity < member_count) {
+				ranges.reset(new task_range[member_count]);
+				capacity = member_count;
+			}
+			members = member_count;
+			single_loop = single;
+			next_member = 1;
+			phase_ranges = 0;
+			phase = 0;
+			attached = 0;
+			active = 0;
+			remaining = 0;
+			closed = false;
+			cancelled = false;
+			error = nullptr;
+		}
+
+		void (*call)(const void*, size_t, size_t) = nullptr;
+		const void* body = nullptr;
+		std::unique_ptr<task_range[]> ranges;
+		size_t capacity = 0;
+		size_t members = 0;
+		bool single_loop = false;
+		size_t next_member = 0;
+		size_t phase_ranges = 0;
+		size_t phase = 0;
+		size_t attached = 0;
+		size_t active = 0;
+		size_t remaining = 0;
+		bool closed = false;
+		std::atomic<bool> cancelled{false};
+		std::exception_ptr error;
+		std::mutex mutex;
+		std::condition_variable changed;
+	};
+
+	template <typename F>
+	static void call_body(const void* body, size_t task, size_t slot) {
+		(*static_cast<const F*>(body))(task, slot);
+	}
+
+	size_t team_size(size_t threads) const {
+		return threads == 0 ? size() : std::min(threads, size());
+	}
+
+	/*
+	Take a job from the ones kept for reuse (or make one) for a team of the given size, and queue it for
+	the pool's threads to join.
+	*/
+	job* open(size_t members, bool single_loop) {
+		job* work;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_idle.empty()) {
+				_owned.emplace_back(new job());
+				_idle.push_back(_owned.back().get());
+			}
+			work = _idle.back();
+			_idle.pop_back();
+			work->reset(members, single_loop);
+			_jobs.push_back(work);
+		}
+		_wake.notify_all();
+		return work;
+	}
+
+	/*
+	Stop any more threads joining a team, wait for the ones that joined to leave, and keep the job for
+	reuse. Runs when the team goes out of scope, including when a loop has thrown.
+	*/
+	void close(job& work) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto position = std::find(_jobs.begin(), _jobs.end(), &work);
+			if (position != _jobs.end()) {
+				_jobs.erase(position);
+			}
+		}
+		{
+			std::unique_lock<std::mutex> lock(work.mutex);
+			work.closed = true;
+			work.changed.notify_all();
+			work.changed.wait(lock, [&] { return work.attached == 0; });
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		_idle.push_back(&work);
+	}
+
+	/*
+	Take the next task from the front of a thread's own range.
+	*/
+	static bool take(job& work, size_t own, size_t& task) {
+		if (work.cancelled) {
+			return false;
+		}
+		task_range& range = work.ranges[own];
+		std::lock_guard<std::mutex> lock(range.mutex);
+		if (range.begin == range.end) {
+			return false;
+		}
+		task = range.begin++;
+		return true;
+	}
+
+	/*
+	Steal the back half of the remaining tasks of another range, running the first of them and keeping the
+	rest in own.
+	*/
+	static bool steal(job& work, size_t own, size_t& task) {
+		const size_t ranges = work.phase_ranges;
+		if (own >= ranges) {
+			return false;
+		}
+		for (size_t offset = 1; offset < ranges && !work.cancelled; ++offset) {
+			task_range& victim = work.ranges[(own + offset) % ranges];
+			size_t begin, end;
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (victim.begin == victim.end) {
+					continue;
+				}
+				begin = victim.begin + (victim.end - victim.begin) / 2;
+				end = victim.end;
+				victim.end = begin;
+			}
+			std::lock_guard<std::mutex> lock(work.ranges[own].mutex);
+			work.ranges[own].begin = begin + 1;
+			work.ranges[own].end = end;
+			task = begin;
+			return true;
+		}
+		return false;
+	}
+
+	/*
+	Run the tasks of the current loop from the given range, then those stolen from the other ranges, until
+	there are none left to start. The index of the range is the slot passed to the tasks. The first
+	exception thrown by a task is kept for the thread that started the loop, and cancels the rest.
+	*/
+	static void run(job& work, size_t own) {
+		size_t task;
+		while (take(work, own, task) || steal(work, own, task)) {
+			try {
+				work.call(work.body, task, own);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(work.mutex);
+				if (!work.error) {
+					work.error = std::current_exception();
+				}
+				work.cancelled = true;
+				work.changed.notify_all();
+				return;
+			}
+			std::lock_guard<std::mutex> lock(work.mutex);
+			if (--work.remaining == 0) {
+				work.changed.notify_all();
+			}
+		}
+	}
+
+	/*
+	Run a range of each loop of a team until it's closed, or of just the first loop if the team only runs
+	one. Loops with fewer ranges than the team has threads are skipped by the threads without a range. A
+	thread only joins a loop which still has tasks left: once a loop has finished, the thread that started
+	it may already be setting up the next one, so a thread that joins the team late, or wakes late, waits
+	for the next loop instead.
+	*/
+	static void serve(job& work, size_t own) {
+		std::unique_lock<std::mutex> lock(work.mutex);
+		size_t seen = work.remaining == 0 ? work.phase : 0;
+		for (;;) {
+			work.changed.wait(lock, [&] { return work.closed || work.phase != seen; });
+			if (work.closed) {
+				break;
+			}
+			seen = work.phase;
+			if (own < work.phase_ranges && work.remaining > 0 && !work.cancelled) {
+				++work.active;
+				lock.unlock();
+				run(work, own);
+				lock.lock();
+				if (--work.active == 0) {
+					work.changed.notify_all();
+				}
+			}
+			if (work.single_loop) {
+				break;
+			}
+		}
+		if (--work.attached == 0) {
+			work.changed.notify_all();
+		}
+	}
+
+	/*
+	The loop run by each of the pool's threads, joining the oldest team that still has room. The team is
+	then moved to the back of the queue, so that the threads are shared between concurrent teams.
+	*/
+	void work() {
+		for (;;) {
+			job* current;
+			size_t own;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+				if (_jobs.empty()) {
+					return;
+				}
+				current = _jobs.front();
+				_jobs.erase(_jobs.begin());
+				own = current->next_member++;
+				if (current->next_member < current->members) {
+					_jobs.push_back(current);
+				}
+				std::lock_guard<std::mutex> job_lock(current->mutex);
+				++current->attached;
+			}
+			serve(*current, own);
+		}
+	}
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::vector<job*> _jobs;
+	std::vector<job*> _idle;
+	std::vector<std::unique_ptr<job>> _owned;
+	bool _stopping = false;
+};
+
+/*
+The pool used by the `_parallel` functions when none is passed to them, shared by every caller in the
+process. It has one thread for each hardware thread.
+*/
+inline thread_pool& default_thread_pool() {
+	static thread_pool pool;
+	return pool;
+}
+
+namespace details {
+
+/*
+Read the CPU cores of each NUMA node of the machine from sysfs, skipping nodes without any cores. Empty
+on other platforms than Linux, or when the topology can't be read.
+*/
+inline std::vector<std::vector<int>> read_numa_nodes() {
+	std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+	for (int node = 0;; ++node) {
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!file) {
+			break;
+		}
+		// The cores are listed as comma separated ranges, e.g. "0-3,8-11"
+		std::vector<int> cores;
+		std::string range;
+		while (std::getline(file, range, ',')) {
+			if (range.find_first_of("0123456789") == std::string::npos) {
+				continue;
+			}
+			const size_t dash = range.find('-');
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int core = first; core <= last; ++core) {
+				cores.push_back(core);
+			}
+		}
+		if (!cores.empty()) {
+			nodes.push_back(cores);
+		}
+	}
+#endif
+	return nodes;
+}
+
+/*
+The CPU cores of each NUMA node of the machine, read on first use.
+*/
+inline const std::vector<std::vector<int>>& numa_nodes() {
+	static const std::vector<std::vector<int>> nodes = read_numa_nodes();
+	return nodes;
+}
+
+} // namespace details
+
+/*
+The number of NUMA nodes on the machine, for `clustering_parameters::set_numa_nodes`. Returns 1 when the
+topology can't be read.
+*/
+inline size_t numa_node_count() {
+	return std::max<size_t>(details::numa_nodes().size(), 1);
+}
+
+namespace details {
+
+/*
+The number of pools pinned to CPU cores kept by `affinity_pool` while no clustering is using them, on top
+of one for each NUMA node.
+*/
+const size_t affinity_pool_cache_size = 8;
+
+/*
+The pools created by `affinity_pool`, by their cores, with the order in which they were last used.
+*/
+struct affinity_pool_cache {
+	struct entry {
+		std::shared_ptr<thread_pool> pool;
+		uint64_t last_used = 0;
+	};
+
+	std::mutex mutex;
+	std::map<std::vector<int>, entry> pools;
+	uint64_t uses = 0;
+};
+
+inline affinity_pool_cache& affinity_pools() {
+	static affinity_pool_cache cache;
+	return cache;
+}
+
+/*
+The pool with one thread pinned to each of the given CPU cores, created on first use and shared by every
+clustering with the same cores. The pools are kept between clusterings, but once there are more than
+affinity_pool_cache_size (plus one per NUMA node), the least recently used pools that no clustering holds
+are destroyed, so that clusterings with varying cores don't leave pinned threads behind without bound.
+*/
+inline std::shared_ptr<thread_pool> affinity_pool(const std::vector<int>& cores) {
+	affinity_pool_cache& cache = affinity_pools();
+	const size_t limit = affinity_pool_cache_size + numa_nodes().size();
+	std::shared_ptr<thread_pool> pool;
+	// The evicted pools join their threads after the lock is released
+	std::vector<std::shared_ptr<thread_pool>> evicted;
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	affinity_pool_cache::entry& cached = cache.pools[cores];
+	if (!cached.pool) {
+		cached.pool = std::make_shared<thread_pool>(cores);
+	}
+	cached.last_used = ++cache.uses;
+	pool = cached.pool;
+	while (cache.pools.size() > limit) {
+		auto oldest = cache.pools.end();
+		for (auto candidate = cache.pools.begin(); candidate != cache.pools.end(); ++candidate) {
+			if (candidate->second.pool.use_count() == 1
+				&& (oldest == cache.pools.end() || candidate->second.last_used < oldest->second.last_used)) {
+				oldest = candidate;
+			}
+		}
+		if (oldest == cache.pools.end()) {
+			// Every pool is in use, so the cache stays over the limit until they are released
+			break;
+		}
+		evicted.push_back(std::move(oldest->second.pool));
+		cache.pools.erase(oldest);
+	}
+	return pool;
+}
+
+/*
+The number of pools held by `affinity_pool`.
+*/
+inline size_t affinity_pool_count() {
+	affinity_pool_cache& cache = affinity_pools();
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	return cache.pools.size();
+}
+
+/*
+A pointer to a pool owned by the caller, which doesn't keep it alive, for use alongside those returned by
+`affinity_pool`.
+*/
+inline std::shared_ptr<thread_pool> borrowed_pool(thread_pool& pool) {
+	return std::shared_ptr<thread_pool>(std::shared_ptr<thread_pool>(), &pool);
+}
+
+/*
+The pool to run a clustering on: the given pool, unless the parameters set the CPU affinity. The pinned
+pool is held until the returned pointer is released.
+*/
+template <typename T, typename S>
+std::shared_ptr<thread_pool> pool_for(const clustering_parameters<T, S>& parameters, thread_pool& pool) {
+	return parameters.get_cpu_affinity().empty() ? borrowed_pool(pool) : affinity_pool(parameters.get_cpu_affinity());
+}
+
+/*
+The number of threads a clustering runs on in the given pool, as limited by the parameters.
+*/
+template <typename T, typename S>
+size_t thread_count(const clustering_parameters<T, S>& parameters, const thread_pool& pool) {
+	const size_t threads = parameters.get_thread_count();
+	return threads == 0 ? pool.size() : std::min(threads, pool.size());
+}
+
+/*
+The number of points in each task of the parallel loops over the data. Each task costs a lock to hand out,
+so they are large enough for that to be negligible, while leaving enough tasks to balance the load.
+*/
+const size_t parallel_point_block = 1024;
+
+/*
+Call body(begin, end) for each block of block_size consecutive rows (the last may be shorter), running
+the blocks as tasks of the pool (or of a team of its threads) on at most the given number of threads.
+*/
+template <typename P, typename F>
+void parallel_for_blocks(P& pool, size_t threads, size_t rows, size_t block_size, const F& body) {
+	const size_t blocks = (rows + block_size - 1) / block_size;
+	pool.parallel_for(blocks, threads, [&](size_t b) {
+		const size_t begin = b * block_size;
+		body(begin, std::min(begin + block_size, rows));
+	});
+}
+
+/*
+This type alias represents the type used for measuring and indexing the length of the point data vector
+*/
+template <typename T, size_t N>
+using point_data_size_t = typename std::vector<std::array<T, N>>::size_type;
+
+
+/*
+Update the smallest distance from each data point to the means, given the mean that was just added, and
+calculate the prefix sums of the distances for sampling in the same pass. The result is identical to
+`update_closest_distance` followed by `weighted_prefix_sums`: each thread updates and sums whole blocks
+of prefix_sum_block points, a single thread adds up the block totals, and then each block is offset by
+the total of the blocks before it. block_offsets holds one value per block.
+*/
+template <typename T, size_t N, typename P>
+void update_closest_distance_prefix_sums_parallel(const T* mean,
+	const matrix_view<T>& data,
+	std::vector<T>& distances,
+	std::vector<accumulate_t<T>>& sums,
+	std::vector<accumulate_t<T>>& block_offsets,
+	P& pool,
+	size_t threads) {
+	using A = accumulate_t<T>;
+	parallel_for_blocks(pool, threads, data.rows(), prefix_sum_block, [&](size_t begin, size_t end) {
+		A sum = A();
+		std::vector<T> scratch;
+		for (size_t first = begin; first < end; first += gather_block_rows) {
+			const size_t last = std::min(first + gather_block_rows, end);
+			const matrix_view<T> points = gather_rows(data, first, last, scratch);
+			for (size_t i = first; i < last; ++i) {
+				T distance = distance_squared<T, N>(points.row(i - first), mean, data.cols());
+				if (distance < distances[i])
+					distances[i] = distance;
+				sum += static_cast<A>(distances[i]);
+				sums[i] = sum;
+			}
+		}
+		block_offsets[begin / prefix_sum_block] = sum;
+	});
+	A offset = A();
+	for (A& block_offset : block_offsets) {
+		const A total = block_offset;
+		block_offset = offset;
+		offset += total;
+	}
+	parallel_for_blocks(pool, threads, data.rows(), prefix_sum_block, [&](size_t begin, size_t end) {
+		const A block_offset = block_offsets[begin / prefix_sum_block];
+		for (size_t i = begin; i < end; ++i) {
+			sums[i] += block_offset;
+		}
+	});
+}
+
+/*
+This is an alternate initialization method based on the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
+initialization algorithm. The means are written to means in a flat, row-major buffer, using the storage in
+means and scratch. The distances and their prefix sums are calculated in parallel, and the means are
+sampled from them with a binary search, so the results are the same as `random_plusplus` for any number
+of threads. At most threads threads of the pool are used, or all of them if it's 0, kept in a team for all
+of the rounds.
+*/
+template <typename T, typename S, size_t N>
+void random_plusplus_parallel(const matrix_view<T>& data,
+	uint32_t k,
+	S seed,
+	std::vector<T>& means,
+	seeding_buffers<T>& scratch,
+	thread_pool& pool = default_thread_pool(),
+	size_t threads = 0) {
+	assert(k > 0);
+	assert(data.rows() > 0);
+	means.clear();
+
+	// If data is empty then return no means
+	if (data.rows() == 0) {
+		return;
+	}
+
+	// If all of the data points are identical then the distances will be zero, just fill the starting means with copies
+	// of the first element
+	if (all_rows_equal(data)) {
+		repeat_first_row(data, k, means);
+		return;
+	}
+
+	const size_t cols = data.cols();
+	means.reserve(k * cols);
+	// Using a very simple PRBS generator, parameters selected according to
+	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+
+	// Select first mean at random from the set
+	{
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.rows() - 1);
+		append_row(means, data, uniform_generator(rand_engine));
+	}
+
+	// The distance to the closest mean for each data point, updated as each mean is added
+	scratch.distances.assign(data.rows(), std::numeric_limits<T>::max());
+	scratch.sums.resize(data.rows());
+	scratch.block_offsets.resize((data.rows() + prefix_sum_block - 1) / prefix_sum_block);
+	pool.run_team(threads, [&](thread_pool::team& team) {
+		for (uint32_t count = 1; count < k; ++count) {
+			update_closest_distance_prefix_sums_parallel<T, N>(
+				&means[(count - 1) * cols], data, scratch.distances, scratch.sums, scratch.block_offsets, team, 0);
+			// Pick a random point weighted by the distance from existing means
+			append_row(means, data, sample_prefix_sums(scratch.sums, rand_engine));
+		}
+	});
+}
+
+/*
+Parallel kmeans++ initialization, returning the means in a flat, row-major buffer.
+*/
+template <typename T, typename S, size_t N>
+std::vector<T> random_plusplus_parallel(
+	const matrix_view<T>& data, uint32_t k, S seed, thread_pool& pool = default_thread_pool(), size_t threads = 0) {
+	std::vector<T> means;
+	seeding_buffers<T> scratch;
+	random_plusplus_parallel<T, S, N>(data, k, seed, means, scratch, pool, threads);
+	return means;
+}
+
+/*
+Parallel kmeans++ initialization for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::vector<std::array<T, N>> random_plusplus_parallel(
+	const std::vector<std::array<T, N>>& data, uint32_t k, S seed, thread_pool& pool = default_thread_pool(), size_t threads = 0) {
+	return to_arrays<T, N>(random_plusplus_parallel<T, S, N>(view_of(data), k, seed, pool, threads));
+}
+
+/*
+Update the squared distance from each data point to its closest candidate (and the index of that
+candidate), considering only the candidates from first_candidate onwards.
+*/
+template <typename T, size_t N>
+void scalable_plusplus_update_parallel(const matrix_view<T>& data,
+	const matrix_view<T>& candidates,
+	size_t first_candidate,
+	std::vector<T>& distances,
+	std::vector<uint32_t>& closest,
+	thread_pool& pool,
+	size_t threads) {
+	parallel_for_blocks(pool, threads, data.rows(), parallel_point_block, [&](size_t begin, size_t end) {
+		std::vector<T> scratch;
+		for (size_t first = begin; first < end; first += gather_block_rows) {
+			const size_t last = std::min(first + gather_block_rows, end);
+			const matrix_view<T> points = gather_rows(data, first, last, scratch);
+			for (size_t i = first; i < last; ++i) {
+				for (size_t c = first_candidate; c < candidates.rows(); ++c) {
+					T distance = distance_squared<T, N>(points.row(i - first), candidates.row(c), data.cols());
+					if (distance < distances[i]) {
+						distances[i] = distance;
+						closest[i] = static_cast<uint32_t>(c);
+					}
+				}
+			}
+		}
+	});
+}
+
+/*
+Sample the k-means|| candidates like `scalable_plusplus_sample`, with the cost and the samples of each
+block calculated in parallel. The block costs are added up, and the picks of the blocks appended, in the
+order of the blocks, so the candidates are the same as the serial version.
+*/
+template <typename T, typename R>
+void scalable_plusplus_sample_parallel(const matrix_view<T>& data,
+	const std::vector<T>& distances,
+	uint32_t oversampling,
+	R& rand_engine,
+	std::vector<T>& candidates,
+	thread_pool& pool,
+	size_t threads) {
+	const size_t blocks = (data.rows() + scalable_plusplus_block - 1) / scalable_plusplus_block;
+	std::vector<double> block_costs(blocks);
+	parallel_for_blocks(pool, threads, data.rows(), scalable_plusplus_block, [&](size_t begin, size_t end) {
+		block_costs[begin / scalable_plusplus_block] = scalable_plusplus_block_cost(distances, begin, end);
+	});
+	double cost = 0;
+	for (double block_cost : block_costs) {
+		cost += block_cost;
+	}
+	if (cost <= 0) {
+		return;
+	}
+	const auto round_seed = rand_engine();
+	std::vector<std::vector<size_t>> picks(blocks);
+	parallel_for_blocks(pool, threads, data.rows(), scalable_plusplus_block, [&](size_t begin, size_t end) {
+		scalable_plusplus_sample_block(
+			distances, begin, end, cost, oversampling, round_seed, picks[begin / scalable_plusplus_block]);
+	});
+	for (const auto& block_picks : picks) {
+		for (auto i : block_picks) {
+			append_row(candidates, data, i);
+		}
+	}
+}
+
+/*
+This is an alternate initialization method based on the [k-means||](https://arxiv.org/abs/1203.6402)
+initialization algorithm. See `random_scalable_plusplus` for details; the distance updates and the
+sampling of each round are calculated in parallel, on at most threads threads of the pool (or all of them
+if it's 0). Each block of points is sampled with its own seeded engine, so the results are the same as the
+serial version for any number of threads.
+*/
+template <typename T, typename S, size_t N>
+std::vector<T> random_scalable_plusplus_parallel(
+	const matrix_view<T>& data, uint32_t k, S seed, thread_pool& pool = default_thread_pool(), size_t threads = 0) {
+	assert(k > 0);
+	assert(data.rows() > 0);
+
+	// If data is empty then return an empty vector
+	if (data.rows() == 0) {
+		return std::vector<T>();
+	}
+
+	// If all of the data points are identical then the distances will be zero, just fill the starting means with copies
+	// of the first element
+	if (all_rows_equal(data)) {
+		return repeat_first_row(data, k);
+	}
+
+	const size_t cols = data.cols();
+	std::vector<T> candidates;
+	// Using a very simple PRBS generator, parameters selected according to
+	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+	// Select first candidate at random from the set
+	{
+		std::uniform_int_distribution<size_t> uniform_generator(0, data.rows() - 1);
+		append_row(candidates, data, uniform_generator(rand_engine));
+	}
+
+	std::vector<T> distances(data.rows(), std::numeric_limits<T>::max());
+	std::vector<uint32_t> closest(data.rows(), 0);
+	size_t updated = 0;
+	for (int round = 0; round < scalable_plusplus_rounds; ++round) {
+		scalable_plusplus_update_parallel<T, N>(data, view_of(candidates, cols), updated, distances, closest, pool, threads);
+		updated = candidates.size() / cols;
+		scalable_plusplus_sample_parallel(data, distances, scalable_plusplus_oversampling * k, rand_engine, candidates, pool, threads);
+	}
+	// Top up with kmeans++ picks in the unlikely case that too few candidates were sampled
+	std::vector<accumulate_t<T>> sums;
+	while (candidates.size() / cols < k) {
+		scalable_plusplus_update_parallel<T, N>(data, view_of(candidates, cols), updated, distances, closest, pool, threads);
+		updated = candidates.size() / cols;
+		append_row(candidates, data, sample_weights(distances, sums, rand_engine));
+	}
+	scalable_plusplus_update_parallel<T, N>(data, view_of(candidates, cols), updated, distances, closest, pool, threads);
+	return scalable_plusplus_recluster<T, N>(view_of(candidates, cols), closest, k, rand_engine);
+}
+
+/*
+Parallel k-means|| initialization for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::vector<std::array<T, N>> random_scalable_plusplus_parallel(
+	const std::vector<std::array<T, N>>& data, uint32_t k, S seed, thread_pool& pool = default_thread_pool(), size_t threads = 0) {
+	return to_arrays<T, N>(random_scalable_plusplus_parallel<T, S, N>(view_of(data), k, seed, pool, threads));
+}
+
+/*
+Pick the initial means using the method selected in the clustering parameters, writing them to means. As
+with `initial_means`, only kmeans++ reuses the storage in means and scratch.
+*/
+template <typename T, typename S, size_t N>
+void initial_means_parallel(const matrix_view<T>& data,
+	uint32_t k,
+	S seed,
+	initialization method,
+	std::vector<T>& means,
+	seeding_buffers<T>& scratch,
+	thread_pool& pool,
+	size_t threads) {
+	if (method == initialization::scalable_plusplus) {
+		means = random_scalable_plusplus_parallel<T, S, N>(data, k, seed, pool, threads);
+	} else if (method == initialization::afkmc2) {
+		means = random_afkmc2<T, S, N>(data, k, seed);
+	} else {
+		random_plusplus_parallel<T, S, N>(data, k, seed, means, scratch, pool, threads);
+	}
+}
+
+/*
+Pick the initial means using the method selected in the clustering parameters.
+*/
+template <typename T, typename S, size_t N>
+std::vector<T> initial_means_parallel(
+	const matrix_view<T>& data, uint32_t k, S seed, initialization method, thread_pool& pool, size_t threads) {
+	std::vector<T> means;
+	seeding_buffers<T> scratch;
+	initial_means_parallel<T, S, N>(data, k, seed, method, means, scratch, pool, threads);
+	return means;
+}
+
+/*
+Pick the initial means for data held in a vector of fixed-size arrays.
+*/
+template <typename T, typename S, size_t N>
+std::vector<std::array<T, N>> initial_means_parallel(
+	const std::vector<std::array<T, N>>& data, uint32_t k, S seed, initialization method, thread_pool& pool, size_t threads) {
+	return to_arrays<T, N>(initial_means_parallel<T, S, N>(view_of(data), k, seed, method, pool, threads));
+}
+
+/*
+Calculate the index of the mean each data point is closest to (euclidean distance), writing them to
+clusters. Uses the widest SIMD kernel the CPU supports when there are enough means, with the means laid
+out in prepared. At most threads threads of the pool are used, or all of them if it's 0.
+*/
+template <typename T, size_t N>
+void calculate_clusters_parallel(const matrix_view<T>& data,
+	const matrix_view<T>& means,
+	std::vector<uint32_t>& clusters,
+	simd_means<T>& prepared,
+	thread_pool& pool,
+	size_t threads = 0) {
+	clusters.resize(data.rows());
+	const simd_level level = is_simd_type<T>::value ? simd_level_for(means.rows()) : simd_level::none;
+	if (level != simd_level::none) {
+		simd_prepare_means(means, level, prepared);
+	}
+	parallel_for_blocks(pool, threads, data.rows(), parallel_point_block, [&](size_t begin, size_t end) {
+		calculate_clusters_range<T, N>(data, means, prepared, level, begin, end, clusters.data(), nullptr);
+	});
+}
+
+/*
+Calculate the index of the mean each data point is closest to (euclidean distance).
+*/
+template <typename T, size_t N>
+std::vector<uint32_t> calculate_clusters_parallel(
+	const matrix_view<T>& data, const matrix_view<T>& means, thread_pool& pool = default_thread_pool(), size_t threads = 0) {
+	std::vector<uint32_t> clusters;
+	simd_means<T> prepared;
+	calculate_clusters_parallel<T, N>(data, means, clusters, prepared, pool, threads);
+	return clusters;
+}
+
+template <typename T, size_t N>
+std::vector<uint32_t> calculate_clusters_parallel(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	thread_pool& pool = default_thread_pool(),
+	size_t threads = 0) {
+	return calculate_clusters_parallel<T, N>(view_of(data), view_of(means), pool, threads);
+}
+
+/*
+Calculate the index of the mean each data point is closest to with the blocked distance engine, given
+the squared norms of the data points from `point_norms`, writing them to clusters. The means are laid
+out in prepared.
+*/
+template <typename T, size_t N>
+void blocked_calculate_clusters_parallel(const matrix_view<T>& data,
+	const std::vector<blocked_t<T>>& point_norms,
+	const matrix_view<T>& means,
+	std::vector<uint32_t>& clusters,
+	blocked_means<T>& prepared,
+	thread_pool& pool,
+	size_t threads = 0) {
+	clusters.resize(data.rows());
+	blocked_prepare_means<T, N>(means, prepared);
+	parallel_for_blocks(pool, threads, data.rows(), blocked_point_block, [&](size_t begin, size_t end) {
+		blocked_calculate_clusters_range<T, N>(data, point_norms, means, prepared, begin, end, clusters.data());
+	});
+}
+
+template <typename T, size_t N>
+std::vector<uint32_t> blocked_calculate_clusters_parallel(const matrix_view<T>& data,
+	const std::vector<blocked_t<T>>& point_norms,
+	const matrix_view<T>& means,
+	thread_pool& pool = default_thread_pool(),
+	size_t threads = 0) {
+	std::vector<uint32_t> clusters;
+	blocked_means<T> prepared;
+	blocked_calculate_clusters_parallel<T, N>(data, point_norms, means, clusters, prepared, pool, threads);
+	return clusters;
+}
+
+/*
+The number of values in each task of the reduction of the partial sums in `assign_and_accumulate_parallel`.
+*/
+const size_t parallel_sum_block = 4096;
+
+/*
+How the assignment step of `kmeans_lloyd_parallel` is shared out between at most threads threads. The data
+is split into parts, each with its own block of partial sums: with the even schedule each part is a task
+covering a contiguous share of the data, while with the dynamic schedule there is one part per thread,
+adding up whichever chunks of chunk points that thread takes. For deterministic results the parts are
+those of `deterministic_parts`, however many threads there are.
+*/
+struct assignment_split {
+	size_t threads;
+	size_t parts;
+	bool dynamic;
+	size_t chunk;
+};
+
+/*
+Split the assignment step for data with the given number of rows as set in the parameters, on at most
+threads threads. Chunks are rounded up to whole blocks of blocked_point_block points.
+*/
+template <typename T, typename S>
+assignment_split split_assignment(size_t rows, const clustering_parameters<T, S>& parameters, size_t threads) {
+	assignment_split split;
+	split.threads = threads;
+	split.dynamic = parameters.get_schedule() == parallel_schedule::dynamic && !parameters.get_deterministic();
+	const size_t chunk = parameters.get_chunk_size() > 0 ? parameters.get_chunk_size() : parallel_point_block;
+	split.chunk = split.dynamic ? (chunk + blocked_point_block - 1) / blocked_point_block * blocked_point_block
+		: blocked_point_block;
+	const size_t chunks = (rows + split.chunk - 1) / split.chunk;
+	split.parts = parameters.get_deterministic() ? deterministic_parts(rows) : std::max<size_t>(std::min(threads, chunks), 1);
+	return split;
+}
+
+/*
+Assign each point to its closest mean in buffers.old_means, as in `calculate_clusters_parallel`, and add
+the points to the partial sums of their part of the data in buffers.thread_sums in the same pass, while
+they are still in cache. The data is shared out between the threads as described by split, see
+`assignment_split`, and is read from the compact copy in buffers.compact when there is one. With
+changed_only, only the points whose cluster differs from buffers.previous_clusters are accumulated: they
+are subtracted from their old cluster and added to their new one. The partial sums of the parts are then
+added up in order, leaving the total in the first block. If distances isn't null, the squared distance
+from each point to its mean is stored in it as well.
+
+Must be called after `prepare_iteration` with the same number of parts. The tasks run on pool, which is
+either a thread pool or a team of its threads.
+*/
+template <typename T, size_t N, typename P>
+void assign_and_accumulate_parallel(const matrix_view<T>& data,
+	distance_engine engine,
+	simd_level level,
+	bool changed_only,
+	const assignment_split& split,
+	lloyd_buffers<T>& buffers,
+	T* distances,
+	P& pool) {
+	using A = accumulate_t<T>;
+	const matrix_view<T> means = view_of(buffers.old_means, data.cols());
+	const size_t k = means.rows();
+	const size_t cols = data.cols();
+	const size_t stride = thread_block_stride<A>(k, cols);
+	const size_t parts = split.parts;
+	const bool compact = buffers.compact.storage != point_storage::full;
+	std::vector<A>& partial = buffers.thread_sums;
+	uint32_t* clusters = buffers.clusters.data();
+	auto accumulate = [&](size_t part, size_t begin, size_t end, decoded_block<T>& block) {
+		A* sums = &partial[part * stride];
+		if (compact) {
+			compact_assign_and_accumulate<T, N>(engine, level, changed_only, begin, end, buffers, sums, distances, block);
+			return;
+		}
+		if (engine == distance_engine::blocked) {
+			blocked_calculate_clusters_range<T, N>(data, buffers.norms, means, buffers.blocked, begin, end, clusters, distances);
+		} else {
+			calculate_clusters_range<T, N>(data, means, buffers.simd, level, begin, end, clusters, distances);
+		}
+		accumulate_points<A, T, N>(data, clusters, buffers.previous_clusters.data(), changed_only, begin, end, sums, sums + k * cols);
+	};
+	if (split.dynamic) {
+		// Each thread adds the chunks it takes to the partial sums of its slot
+		for (size_t part = 0; part < parts; ++part) {
+			std::fill(&partial[part * stride], &partial[part * stride] + k * cols + k, A());
+		}
+		const size_t chunks = (data.rows() + split.chunk - 1) / split.chunk;
+		pool.parallel_for_slots(chunks, split.threads, [&](size_t chunk, size_t slot) {
+			decoded_block<T> block;
+			const size_t last = std::min((chunk + 1) * split.chunk, data.rows());
+			for (size_t begin = chunk * split.chunk; begin < last; begin += blocked_point_block) {
+				accumulate(slot, begin, std::min(begin + blocked_point_block, last), block);
+			}
+		});
+	} else {
+		pool.parallel_for(parts, split.threads, [&](size_t part) {
+			decoded_block<T> block;
+			std::fill(&partial[part * stride], &partial[part * stride] + k * cols + k, A());
+			const size_t last = part_begin(data.rows(), part + 1, parts);
+			for (size_t begin = part_begin(data.rows(), part, parts); begin < last; begin += blocked_point_block) {
+				accumulate(part, begin, std::min(begin + blocked_point_block, last), block);
+			}
+		});
+	}
+	// Add the other parts to the first, in parallel over the sums. Each sum adds the parts in the same
+	// order however the tasks are run, so the totals don't depend on timing.
+	const size_t values = k * cols + k;
+	parallel_for_blocks(pool, split.threads, values, parallel_sum_block, [&](size_t begin, size_t end) {
+		for (size_t part = 1; part < parts; ++part) {
+			const A* other = &partial[part * stride];
+			for (size_t j = begin; j < end; ++j) {
+				partial[j] += other[j];
+			}
+		}
+	});
+}
+
 /*
-DKM - A k-means implementation that is generic across variable data dimensions.
+Assign each point to its closest mean by calculating every distance, initializing the Hamerly bounds.
 */
-namespace dkm {
+template <typename T, size_t N>
+void hamerly_initialize_parallel(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	hamerly_bounds<T>& bounds,
+	thread_pool& pool,
+	size_t threads) {
+	clusters.assign(data.size(), 0);
+	bounds.upper.assign(data.size(), bound_t<T>());
+	bounds.lower.assign(data.size(), bound_t<T>());
+	parallel_for_blocks(pool, threads, data.size(), parallel_point_block, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			hamerly_assign_point_exact(data[i], means, clusters[i], bounds.upper[i], bounds.lower[i]);
+		}
+	});
+}
 
 /*
-These functions are all private implementation details and shouldn't be referenced outside of this
-file.
+Move the means' shifts into the Hamerly bounds and reassign each point to its closest mean.
 */
-namespace details {
+template <typename T, size_t N>
+void hamerly_calculate_clusters_parallel(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& old_means,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	hamerly_bounds<T>& bounds,
+	thread_pool& pool,
+	size_t threads) {
+	auto shifts = mean_shifts(old_means, means);
+	uint32_t largest_index;
+	bound_t<T> largest, second_largest;
+	largest_shifts(shifts, largest_index, largest, second_largest);
+	auto half_closest = half_closest_mean_distances(means);
+	parallel_for_blocks(pool, threads, data.size(), parallel_point_block, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			hamerly_update_point_bounds(
+				clusters[i], shifts, largest_index, largest, second_largest, bounds.upper[i], bounds.lower[i]);
+			hamerly_assign_point(data[i], means, half_closest, clusters[i], bounds.upper[i], bounds.lower[i]);
+		}
+	});
+}
 
 /*
-This type alias represents the type used for measuring and indexing the length of the point data vector
+Assign each point to its closest mean by calculating every distance, initializing the Yinyang bounds.
 */
 template <typename T, size_t N>
-using point_data_size_t = typename std::vector<std::array<T, N>>::size_type;
+void yinyang_initialize_parallel(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	const yinyang_groups& groups,
+	std::vector<uint32_t>& clusters,
+	yinyang_bounds<T>& bounds,
+	thread_pool& pool,
+	size_t threads) {
+	const size_t t = groups.members.size();
+	clusters.assign(data.size(), 0);
+	bounds.upper.assign(data.size(), bound_t<T>());
+	bounds.lower.assign(data.size() * t, bound_t<T>());
+	parallel_for_blocks(pool, threads, data.size(), parallel_point_block, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			yinyang_assign_point_exact(data[i], means, groups, clusters[i], bounds.upper[i], &bounds.lower[i * t]);
+		}
+	});
+}
+
+/*
+Move the means' shifts into the Yinyang bounds and reassign each point to its closest mean.
+*/
+template <typename T, size_t N>
+void yinyang_calculate_clusters_parallel(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& old_means,
+	const std::vector<std::array<T, N>>& means,
+	const yinyang_groups& groups,
+	std::vector<uint32_t>& clusters,
+	yinyang_bounds<T>& bounds,
+	thread_pool& pool,
+	size_t threads) {
+	const size_t t = groups.members.size();
+	auto shifts = mean_shifts(old_means, means);
+	auto group_shifts = yinyang_group_shifts(shifts, groups);
+	parallel_for_blocks(pool, threads, data.size(), parallel_point_block, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			auto lower = &bounds.lower[i * t];
+			yinyang_update_point_bounds(clusters[i], shifts, group_shifts, bounds.upper[i], lower);
+			yinyang_assign_point(data[i], means, groups, clusters[i], bounds.upper[i], lower);
+		}
+	});
+}
 
+/*
+A shard of the data for NUMA-aware clustering, see `clustering_parameters`: a copy of the rows of the data
+from begin, held in memory first touched by a thread on its node, and the buffers used by that node's
+threads for the assignment step. cores holds the cores of the node, or is empty when it's simulated.
+*/
+template <typename T>
+struct numa_shard {
+	std::vector<int> cores;
+	size_t begin = 0;
+	std::vector<T> points;
+	lloyd_buffers<T> buffers;
+};
 
 /*
-Calculate the smallest distance between each of the data points and any of the input means.
+Split the data into the number of shards set in the parameters (at most one per block of points), each
+copied by a thread pinned to the cores of its node so that the operating system places it in the node's
+memory. The nodes are simulated when the machine has fewer of them than there are shards.
 */
 template <typename T, size_t N>
-std::vector<T> closest_distance_parallel(
-	const std::vector<std::array<T, N>>& means, const std::vector<std::array<T, N>>& data) {
-	std::vector<T> distances(data.size(), T());
-	#pragma omp parallel for
-	for (int i = 0; i < static_cast<int>(data.size()); ++i) {
-		T closest = distance_squared(data[i], means[0]);
-		for (const auto& m : means) {
-			T distance = distance_squared(data[i], m);
-			if (distance < closest)
-				closest = distance;
+void make_numa_shards(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	bool keep_distances,
+	std::vector<numa_shard<T>>& shards,
+	thread_pool& pool) {
+	const size_t cols = data.cols();
+	const size_t blocks = (data.rows() + blocked_point_block - 1) / blocked_point_block;
+	const size_t count = std::max<size_t>(std::min(parameters.get_numa_nodes(), blocks), 1);
+	const std::vector<std::vector<int>>& nodes = numa_nodes();
+	const bool simulated = nodes.size() < std::max<size_t>(count, 2);
+	shards.resize(count);
+	pool.parallel_for(count, [&](size_t node) {
+		numa_shard<T>& shard = shards[node];
+		shard.cores = simulated ? std::vector<int>() : nodes[node];
+		const scoped_affinity pinned(shard.cores);
+		shard.begin = part_begin(data.rows(), node, count);
+		const size_t rows = part_begin(data.rows(), node + 1, count) - shard.begin;
+		shard.points.resize(rows * cols);
+		std::vector<T> scratch;
+		for (size_t first = 0; first < rows; first += gather_block_rows) {
+			const size_t last = std::min(first + gather_block_rows, rows);
+			const matrix_view<T> points = gather_rows(data, shard.begin + first, shard.begin + last, scratch);
+			for (size_t i = first; i < last; ++i) {
+				std::copy(points.row(i - first), points.row(i - first) + cols, &shard.points[i * cols]);
+			}
+		}
+		if (parameters.get_distance_engine() == distance_engine::blocked) {
+			point_norms<T, N>(view_of(shard.points, cols), shard.buffers.norms);
+		}
+		if (keep_distances) {
+			shard.buffers.distances.resize(rows);
+		}
+	});
+}
+
+/*
+Add up the partial sums of the shards (the first values of each shard's buffers.thread_sums) in order into
+total.
+*/
+template <typename T>
+void add_shard_sums(const std::vector<numa_shard<T>>& shards, size_t values, std::vector<accumulate_t<T>>& total) {
+	const std::vector<accumulate_t<T>>& first = shards[0].buffers.thread_sums;
+	total.assign(first.begin(), first.begin() + values);
+	for (size_t node = 1; node < shards.size(); ++node) {
+		const std::vector<accumulate_t<T>>& other = shards[node].buffers.thread_sums;
+		for (size_t j = 0; j < values; ++j) {
+			total[j] += other[j];
 		}
-		distances[i] = closest;
 	}
-	return distances;
 }
 
 /*
-This is an alternate initialization method based on the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
-initialization algorithm.
+The assignment step of `kmeans_lloyd_parallel` on NUMA shards. Each shard is assigned to the means in
+buffers.old_means and added up by the threads of its node (on the pool pinned to the node's cores, or on
+a share of the threads of the pool when the node is simulated), into the node's own partial sums. These
+are then added up in node order into buffers.thread_sums for `means_from_partial_sums`.
 */
-template <typename T, typename S = uint64_t, size_t N>
-std::vector<std::array<T, N>> random_plusplus_parallel(const std::vector<std::array<T, N>>& data, uint32_t k, S seed) {
-	assert(k > 0);
-	assert(data.size() > 0);
+template <typename T, size_t N>
+void numa_assign_and_accumulate(const clustering_parameters<T>& parameters,
+	size_t cols,
+	bool from_scratch,
+	bool keep_distances,
+	std::vector<numa_shard<T>>& shards,
+	lloyd_buffers<T>& buffers,
+	thread_pool& pool,
+	size_t threads) {
+	const bool incremental = parameters.get_mean_update() == mean_update::incremental;
+	const size_t simulated_threads = std::max<size_t>(threads / shards.size(), 1);
+	pool.parallel_for(shards.size(), [&](size_t node) {
+		numa_shard<T>& shard = shards[node];
+		const scoped_affinity pinned(shard.cores);
+		const std::shared_ptr<thread_pool> held = shard.cores.empty() ? borrowed_pool(pool) : affinity_pool(shard.cores);
+		thread_pool& node_pool = *held;
+		const size_t node_threads = shard.cores.empty() ? simulated_threads : node_pool.size();
+		const matrix_view<T> local = view_of(shard.points, cols);
+		lloyd_buffers<T>& local_buffers = shard.buffers;
+		// The threads of the node read the means from a copy in the node's memory
+		local_buffers.old_means.assign(buffers.old_means.begin(), buffers.old_means.end());
+		if (incremental) {
+			local_buffers.previous_clusters.swap(local_buffers.clusters);
+		}
+		const assignment_split split = split_assignment(local.rows(), parameters, node_threads);
+		const simd_level level = prepare_iteration<T, N>(local, parameters, split.parts, local_buffers);
+		T* distances = keep_distances ? local_buffers.distances.data() : nullptr;
+		assign_and_accumulate_parallel<T, N>(local, parameters.get_distance_engine(), level,
+			incremental && !from_scratch, split, local_buffers, distances, node_pool);
+	});
+	add_shard_sums(shards, parameters.get_k() * cols + parameters.get_k(), buffers.thread_sums);
+}
 
-	// If data is empty then return an empty vector
-	if (data.empty()) {
-		return std::vector<std::array<T, N>>();
+/*
+Copy the cluster assignments, and the distances if they are kept, of the shards into buffers.
+*/
+template <typename T>
+void gather_numa_shards(const std::vector<numa_shard<T>>& shards, size_t rows, bool keep_distances, lloyd_buffers<T>& buffers) {
+	buffers.clusters.resize(rows);
+	for (const numa_shard<T>& shard : shards) {
+		std::copy(shard.buffers.clusters.begin(), shard.buffers.clusters.end(), buffers.clusters.begin() + shard.begin);
+		if (keep_distances) {
+			std::copy(shard.buffers.distances.begin(), shard.buffers.distances.end(), buffers.distances.begin() + shard.begin);
+		}
 	}
+}
 
-	// If all of the data points are identical then the distances will be zero, just fill the starting means with copies
-	// of the first element
-	if (std::all_of(data.begin(), data.end(), [&data](const std::array<T, N>& a) { return a == data[0]; })) {
-		return std::vector<std::array<T, N>>(k, data[0]);
+/*
+The iterations of `kmeans_lloyd_parallel`, from the initial means in buffers.means until the clustering
+converges, is abandoned, or reaches the maximum number of iterations. Without NUMA shards the assignment
+steps run on executor, a team of the pool's threads which is kept for all of the iterations, so each
+step only costs a barrier. With them, each step runs on the pool, see `numa_assign_and_accumulate`.
+*/
+template <typename T, size_t N, typename P>
+void kmeans_lloyd_parallel_iterate(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	const assignment_split& split,
+	std::vector<numa_shard<T>>& shards,
+	lloyd_buffers<T>& buffers,
+	bool keep_distances,
+	size_t check_iteration,
+	accumulate_t<T> abandon_above,
+	P& executor,
+	thread_pool& pool,
+	size_t threads) {
+	const size_t cols = data.cols();
+	std::vector<T>& means = buffers.means;
+	std::vector<T>& old_means = buffers.old_means;
+	std::vector<T>& old_old_means = buffers.old_old_means;
+	T* distances = keep_distances ? buffers.distances.data() : nullptr;
+	const bool incremental = parameters.get_mean_update() == mean_update::incremental;
+	const size_t interval = parameters.get_recompute_interval();
+	size_t count = 0;
+	bool converged = false;
+	bool abandoned = false;
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	do {
+		if (incremental) {
+			// Keep the previous assignments to find the points which change cluster
+			buffers.previous_clusters.swap(buffers.clusters);
+		}
+		old_old_means.swap(old_means);
+		old_means.swap(means);
+		const bool from_scratch = !incremental || count == 0 || (interval > 0 && count % interval == 0);
+		if (!shards.empty()) {
+			numa_assign_and_accumulate<T, N>(parameters, cols, from_scratch, keep_distances, shards, buffers, pool, threads);
+		} else {
+			const simd_level level = prepare_iteration<T, N>(data, parameters, split.parts, buffers);
+			assign_and_accumulate_parallel<T, N>(data, parameters.get_distance_engine(), level,
+				incremental && !from_scratch, split, buffers, distances, executor);
+		}
+		means_from_partial_sums<T, N>(parameters, cols, from_scratch, buffers);
+		++count;
+		converged = means == old_means || means == old_old_means
+			|| (parameters.has_min_delta() && deltas_below_limit<T, N>(
+				view_of(old_means, cols), view_of(means, cols), parameters.get_min_delta(), buffers.deltas));
+		if (!converged && count == check_iteration) {
+			if (!shards.empty()) {
+				gather_numa_shards(shards, data.rows(), keep_distances, buffers);
+			}
+			abandoned = kept_inertia(buffers.distances) > abandon_above;
+		}
+	} while (!converged && !abandoned && !(parameters.has_max_iteration() && count == parameters.get_max_iteration()));
+	buffers.iterations = count;
+	buffers.converged = converged;
+	buffers.abandoned = abandoned;
+}
+
+/*
+Lloyd's algorithm on flat data with the assignment and update steps calculated in parallel, behind each
+of the `kmeans_lloyd_parallel` overloads. N is the dimension of the data, or `dynamic_dimension` if it is
+only known at runtime. The means (in a flat, row-major buffer) and the cluster assignments are left in
+buffers.means and buffers.clusters. With keep_distances, the squared distance from each point to the
+returned mean of its cluster is left in buffers.distances.
+
+The parallel steps run on the pool, or on the pool pinned to the CPU cores set in the parameters, using
+at most the number of threads set in them. With the even schedule the assignment step is split into one
+part per thread, and each part of the data keeps its own partial sums, so the means depend on the number
+of threads but not on the timing of the threads that run them. See `parallel_schedule` for the dynamic
+schedule. When the parameters ask for deterministic results the parts are fixed by the number of points,
+and the results are bitwise identical to `kmeans_lloyd` with the same parameters on any number of threads.
+Otherwise, when they set a number of NUMA nodes, the assignment step runs on NUMA shards of the data, see
+`numa_assign_and_accumulate`.
+
+If check_iteration isn't 0, the clustering is abandoned (and buffers.abandoned is set) when its inertia
+after that many iterations, as measured by `kept_inertia`, is above abandon_above. This needs
+keep_distances.
+*/
+template <typename T, typename S, size_t N>
+void kmeans_lloyd_parallel(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	lloyd_buffers<T>& buffers,
+	thread_pool& pool,
+	bool keep_distances = false,
+	size_t check_iteration = 0,
+	accumulate_t<T> abandon_above = std::numeric_limits<accumulate_t<T>>::max()) {
+	assert(check_iteration == 0 || keep_distances);
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.rows() >= parameters.get_k()); // there must be at least k data points
+	const scoped_affinity pinned(parameters.get_cpu_affinity());
+	const std::shared_ptr<thread_pool> held = pool_for(parameters, pool);
+	thread_pool& workers = *held;
+	const size_t threads = thread_count(parameters, workers);
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	initial_means_parallel<T, S, N>(
+		data, parameters.get_k(), seed, parameters.get_initialization(), buffers.means, buffers.seeding, workers, threads);
+
+	buffers.old_means.clear();
+	buffers.old_old_means.clear();
+	if (keep_distances) {
+		buffers.distances.resize(data.rows());
+	}
+	std::vector<numa_shard<T>> shards;
+	if (parameters.get_numa_nodes() > 0 && !parameters.get_deterministic()) {
+		buffers.compact.storage = point_storage::full;
+		make_numa_shards<T, N>(data, parameters, keep_distances, shards, workers);
+	} else if (prepare_compact_points(data, parameters, buffers)) {
+		parallel_for_blocks(workers, threads, data.rows(), parallel_point_block, [&](size_t begin, size_t end) {
+			compress_points(data, begin, end, buffers.compact);
+		});
+	} else if (parameters.get_distance_engine() == distance_engine::blocked) {
+		point_norms<T, N>(data, buffers.norms);
+	}
+	const assignment_split split = split_assignment(data.rows(), parameters, threads);
+	if (!shards.empty()) {
+		// The shards run on the pools of their nodes, so the pool's threads aren't kept in a team
+		kmeans_lloyd_parallel_iterate<T, N>(data, parameters, split, shards, buffers, keep_distances,
+			check_iteration, abandon_above, workers, workers, threads);
+		gather_numa_shards(shards, data.rows(), keep_distances, buffers);
+	} else {
+		workers.run_team(threads, [&](thread_pool::team& team) {
+			kmeans_lloyd_parallel_iterate<T, N>(data, parameters, split, shards, buffers, keep_distances,
+				check_iteration, abandon_above, team, workers, threads);
+		});
 	}
+	if (keep_distances && !buffers.abandoned && buffers.means != buffers.old_means) {
+		// The means moved after the last assignment step, so measure the distances to the returned means
+		parallel_for_blocks(workers, threads, data.rows(), parallel_point_block, [&](size_t begin, size_t end) {
+			distances_to_means<T, N>(data, begin, end, buffers);
+		});
+	}
+}
 
-	using input_size_t = typename std::array<T, N>::size_type;
-	std::vector<std::array<T, N>> means;
-	// Using a very simple PRBS generator, parameters selected according to
-	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
-	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+template <typename T, typename S, size_t N>
+std::tuple<std::vector<T>, std::vector<uint32_t>> kmeans_lloyd_parallel(
+	const matrix_view<T>& data, const clustering_parameters<T>& parameters, thread_pool& pool) {
+	lloyd_buffers<T> buffers;
+	kmeans_lloyd_parallel<T, S, N>(data, parameters, buffers, pool);
+	return std::tuple<std::vector<T>, std::vector<uint32_t>>(std::move(buffers.means), std::move(buffers.clusters));
+}
 
-	// Select first mean at random from the set
-	{
-		std::uniform_int_distribution<input_size_t> uniform_generator(0, data.size() - 1);
-		means.push_back(data[uniform_generator(rand_engine)]);
-	}
-
-	for (uint32_t count = 1; count < k; ++count) {
-		// Calculate the distance to the closest mean for each data point
-		auto distances = details::closest_distance_parallel(means, data);
-		// Pick a random point weighted by the distance from existing means
-		// TODO: This might convert floating point weights to ints, distorting the distribution for small weights
-#if !defined(_MSC_VER) || _MSC_VER >= 1900
-		std::discrete_distribution<input_size_t> generator(distances.begin(), distances.end());
-#else  // MSVC++ older than 14.0
-		input_size_t i = 0;
-		std::discrete_distribution<input_size_t> generator(distances.size(), 0.0, 0.0, [&distances, &i](double) { return distances[i++]; });
-#endif
-		means.push_back(data[generator(rand_engine)]);
+/*
+Parallel Lloyd's algorithm on data with a dimension that is only known at runtime. The common dimensions
+are dispatched to implementations specialized for that dimension.
+*/
+template <typename T, typename S>
+void kmeans_lloyd_parallel_dynamic(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	lloyd_buffers<T>& buffers,
+	thread_pool& pool,
+	bool keep_distances) {
+	switch (data.cols()) {
+	case 1: return kmeans_lloyd_parallel<T, S, 1>(data, parameters, buffers, pool, keep_distances);
+	case 2: return kmeans_lloyd_parallel<T, S, 2>(data, parameters, buffers, pool, keep_distances);
+	case 3: return kmeans_lloyd_parallel<T, S, 3>(data, parameters, buffers, pool, keep_distances);
+	case 4: return kmeans_lloyd_parallel<T, S, 4>(data, parameters, buffers, pool, keep_distances);
+	case 8: return kmeans_lloyd_parallel<T, S, 8>(data, parameters, buffers, pool, keep_distances);
+	case 16: return kmeans_lloyd_parallel<T, S, 16>(data, parameters, buffers, pool, keep_distances);
+	case 32: return kmeans_lloyd_parallel<T, S, 32>(data, parameters, buffers, pool, keep_distances);
+	case 64: return kmeans_lloyd_parallel<T, S, 64>(data, parameters, buffers, pool, keep_distances);
+	case 128: return kmeans_lloyd_parallel<T, S, 128>(data, parameters, buffers, pool, keep_distances);
+	default: return kmeans_lloyd_parallel<T, S, dynamic_dimension>(data, parameters, buffers, pool, keep_distances);
 	}
-	return means;
 }
 
 /*
-Calculate the index of the mean each data point is closest to (euclidean distance).
+The smallest number of points given to each thread of a restart in `best_of_restarts`. With fewer points
+than this per thread, waiting at the barriers of each iteration costs more than splitting the assignment
+step saves, so the threads are better spent running other restarts.
 */
-template <typename T, size_t N>
-std::vector<uint32_t> calculate_clusters_parallel(
-	const std::vector<std::array<T, N>>& data, const std::vector<std::array<T, N>>& means) {
-	std::vector<uint32_t> clusters(data.size(), 0);
-	#pragma omp parallel for
-	for (int i = 0; i < static_cast<int>(data.size()); ++i) {
-		clusters[i] = closest_mean(data[i], means);
+const size_t restart_points_per_thread = 8192;
+
+/*
+The number of restarts run at the same time by `best_of_restarts`, and the number of threads running
+each of them.
+*/
+struct restart_split {
+	int restarts;
+	int threads;
+};
+
+/*
+Split the given number of threads between running n_init restarts at the same time and running each
+restart in parallel, for data with n points. Restarts are independent, so running them at the same time
+needs no synchronization, but they converge after different numbers of iterations and so finish unevenly.
+Each restart is therefore given as many threads as have at least restart_points_per_thread points to
+work on: small data sets run one restart per thread, and large ones run the restarts one after another
+on every thread.
+*/
+inline restart_split split_restart_threads(size_t n, uint32_t n_init, int threads) {
+	restart_split split;
+	const size_t useful = std::max<size_t>(n / restart_points_per_thread, 1);
+	split.threads = static_cast<int>(std::min<size_t>(static_cast<size_t>(threads), useful));
+	split.restarts = std::max(std::min(threads / split.threads, static_cast<int>(n_init)), 1);
+	// Share out the threads left over when there are fewer restarts than threads
+	split.threads = std::max(threads / split.restarts, 1);
+	return split;
+}
+
+/*
+Derive the seed for a restart from the seed of the whole calculation, with the splitmix64 mixing
+function so that neighbouring restarts get unrelated seeds. The seeds don't depend on which thread
+runs each restart.
+*/
+template <typename S>
+S restart_seed(S seed, uint32_t restart) {
+	return derived_seed(seed, restart);
+}
+
+/*
+The buffers used by one of the tasks running restarts in `best_of_restarts`, the best clustering it has
+found so far, and its share of the `restart_report`.
+*/
+template <typename T>
+struct restart_slot {
+	lloyd_buffers<T> buffers;
+	std::vector<T> means;
+	std::vector<uint32_t> clusters;
+	accumulate_t<T> inertia = std::numeric_limits<accumulate_t<T>>::max();
+	uint32_t restart = 0;
+	restart_report report;
+	size_t finished_iterations = 0;
+};
+
+/*
+Run n_init restarts of `kmeans_lloyd_parallel` and leave the means and clusters of the one with the lowest
+inertia in best.means and best.clusters, abandoning restarts as set in the policy. See
+`get_best_means_parallel` for details.
+*/
+template <typename T, typename S, size_t N>
+void best_of_restarts(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	uint32_t n_init,
+	const restart_policy& policy,
+	restart_slot<T>& best,
+	restart_report& report,
+	thread_pool& pool) {
+	assert(n_init > 0);
+	assert(policy.get_abandon_ratio() >= 1);
+	const scoped_affinity pinned(parameters.get_cpu_affinity());
+	const std::shared_ptr<thread_pool> held = pool_for(parameters, pool);
+	thread_pool& workers = *held;
+	std::random_device rand_device;
+	const S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	const restart_split split = split_restart_threads(
+		data.rows(), n_init, static_cast<int>(thread_count(parameters, workers)));
+	const uint32_t restarts = static_cast<uint32_t>(split.restarts);
+	std::vector<restart_slot<T>> slots(restarts);
+	// When restarts can be abandoned they run in waves of at most one per slot, and are only compared with
+	// the restarts finished in earlier waves, so which restarts are abandoned doesn't depend on timing. The
+	// first wave runs at most half of the restarts, so that there is always a finished restart to compare
+	// the rest with, even when there are enough slots to run them all at once
+	const size_t check_iteration = policy.get_check_iteration();
+	const uint32_t first_wave = check_iteration > 0 ? std::min(restarts, std::max<uint32_t>(n_init / 2, 1)) : n_init;
+	accumulate_t<T> best_inertia = std::numeric_limits<accumulate_t<T>>::max();
+	for (uint32_t first = 0; first < n_init;) {
+		const uint32_t last = std::min(first + (first == 0 ? first_wave : restarts), n_init);
+		const accumulate_t<T> abandon_above = best_inertia == std::numeric_limits<accumulate_t<T>>::max()
+			? best_inertia : best_inertia * policy.get_abandon_ratio();
+		// Each slot is a task of the pool running every restarts-th restart of the wave, and each restart
+		// runs its own assignment steps on the same pool
+		workers.parallel_for(restarts, [&](size_t s) {
+			restart_slot<T>& slot = slots[s];
+			for (uint32_t restart = first + static_cast<uint32_t>(s); restart < last; restart += restarts) {
+				clustering_parameters<T> restart_parameters(parameters);
+				restart_parameters.set_random_seed(restart_seed(seed, restart));
+				restart_parameters.set_thread_count(static_cast<size_t>(split.threads));
+				restart_parameters.set_cpu_affinity(std::vector<int>());
+				kmeans_lloyd_parallel<T, S, N>(data, restart_parameters, slot.buffers, workers,
+					true, check_iteration, abandon_above);
+				slot.report.iterations += slot.buffers.iterations;
+				if (slot.buffers.abandoned) {
+					++slot.report.abandoned;
+					continue;
+				}
+				++slot.report.finished;
+				slot.finished_iterations += slot.buffers.iterations;
+				// The distances are to the returned means (see `distances_to_means`), so the inertia is that of
+				// `means_inertia` even when the restart stopped at the maximum iteration count
+				const accumulate_t<T> inertia = kept_inertia(slot.buffers.distances);
+				// Each slot runs its restarts in increasing order, so ties keep the lowest restart
+				if (inertia < slot.inertia) {
+					slot.inertia = inertia;
+					slot.restart = restart;
+					slot.means.swap(slot.buffers.means);
+					slot.clusters.swap(slot.buffers.clusters);
+				}
+			}
+		});
+		for (const restart_slot<T>& slot : slots) {
+			best_inertia = std::min(best_inertia, slot.inertia);
+		}
+		first = last;
 	}
-	return clusters;
+	restart_slot<T>* chosen = &slots[0];
+	size_t finished_iterations = 0;
+	report = restart_report();
+	for (restart_slot<T>& slot : slots) {
+		if (slot.inertia < chosen->inertia || (slot.inertia == chosen->inertia && slot.restart < chosen->restart)) {
+			chosen = &slot;
+		}
+		report.finished += slot.report.finished;
+		report.abandoned += slot.report.abandoned;
+		report.iterations += slot.report.iterations;
+		finished_iterations += slot.finished_iterations;
+	}
+	// Every abandoned restart ran check_iteration iterations, and is assumed to have needed as many as the
+	// average finished restart
+	if (report.abandoned > 0 && report.finished > 0) {
+		const size_t expected = finished_iterations * report.abandoned / report.finished;
+		const size_t run = check_iteration * report.abandoned;
+		report.iterations_saved = expected > run ? expected - run : 0;
+	}
+	best.inertia = chosen->inertia;
+	best.restart = chosen->restart;
+	best.means.swap(chosen->means);
+	best.clusters.swap(chosen->clusters);
 }
 
 } // namespace details
@@ -135,23 +1803,241 @@ Implementation details:
 This implementation of k-means uses [Lloyd's Algorithm](https://en.wikipedia.org/wiki/Lloyd%27s_algorithm)
 with the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
 used for initializing the means.
+
+The parallel parts run on the given pool, see `thread_pool`.
 */
 template <typename T, typename S = uint64_t, size_t N>
 std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd_parallel(
-	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters) {
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters, thread_pool& pool = default_thread_pool()) {
+	auto result = details::kmeans_lloyd_parallel<T, S, N>(details::view_of(data), parameters, pool);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(
+		details::to_arrays<T, N>(std::get<0>(result)), std::move(std::get<1>(result)));
+}
+
+/*
+Parallel implementation of k-means for a vector of fixed-size arrays which runs in the given workspace,
+reusing its buffers from previous calls. See `kmeans_workspace` for details.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+void kmeans_lloyd_parallel(const std::vector<std::array<T, N>>& data,
+	const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace,
+	thread_pool& pool = default_thread_pool()) {
+	details::kmeans_lloyd_parallel<T, S, N>(details::view_of(data), parameters, workspace.buffers(N), pool);
+}
+
+/*
+This overload exists to support legacy code which uses this signature of the kmeans_lloyd function.
+Any code still using this signature should move to the version of this function that uses a
+`clustering_parameters` struct for configuration.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd_parallel(
+	const std::vector<std::array<T, N>>& data, uint32_t k,
+	size_t max_iter = 0, T min_delta = -1.0) {
+	clustering_parameters<T> parameters(k);
+	if (max_iter != 0) {
+		parameters.set_max_iteration(max_iter);
+	}
+	if (min_delta != 0) {
+		parameters.set_min_delta(min_delta);
+	}
+	return kmeans_lloyd_parallel(data, parameters);
+}
+
+/*
+Parallel implementation of k-means for data with a dimension that is only known at runtime, which runs
+in the given workspace, reusing its buffers from previous calls. See `kmeans_workspace` for details.
+*/
+template <typename T, typename S = uint64_t>
+void kmeans_lloyd_parallel(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	kmeans_workspace<T>& workspace,
+	thread_pool& pool = default_thread_pool()) {
+	details::kmeans_lloyd_parallel_dynamic<T, S>(data, parameters, workspace.buffers(data.cols()), pool, false);
+}
+
+/*
+Parallel implementation of k-means for data with a dimension that is only known at runtime, held in a
+row-major buffer. See the runtime dimension overload of `kmeans_lloyd` for details.
+*/
+template <typename T, typename S = uint64_t>
+std::tuple<std::vector<T>, std::vector<uint32_t>> kmeans_lloyd_parallel(
+	const matrix_view<T>& data, const clustering_parameters<T>& parameters, thread_pool& pool = default_thread_pool()) {
+	kmeans_workspace<T> workspace;
+	kmeans_lloyd_parallel<T, S>(data, parameters, workspace, pool);
+	auto& buffers = workspace.buffers(data.cols());
+	return std::tuple<std::vector<T>, std::vector<uint32_t>>(std::move(buffers.means), std::move(buffers.clusters));
+}
+
+template <typename T, typename S = uint64_t>
+std::tuple<std::vector<T>, std::vector<uint32_t>> kmeans_lloyd_parallel(const T* data,
+	size_t rows,
+	size_t cols,
+	const clustering_parameters<T>& parameters,
+	thread_pool& pool = default_thread_pool()) {
+	return kmeans_lloyd_parallel<T, S>(matrix_view<T>(data, rows, cols), parameters, pool);
+}
+
+/*
+Parallel implementation of k-means which also returns the distance from each point to its mean, the
+inertia of the clustering, the number of iterations and whether the means converged. See
+`kmeans_lloyd_result` for details.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+kmeans_result<T, N> kmeans_lloyd_parallel_result(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters, thread_pool& pool = default_thread_pool()) {
+	details::lloyd_buffers<T> buffers;
+	details::kmeans_lloyd_parallel<T, S, N>(details::view_of(data), parameters, buffers, pool, true);
+	return details::take_result<T, N>(buffers);
+}
+
+template <typename T, typename S = uint64_t>
+kmeans_result<T> kmeans_lloyd_parallel_result(
+	const matrix_view<T>& data, const clustering_parameters<T>& parameters, thread_pool& pool = default_thread_pool()) {
+	details::lloyd_buffers<T> buffers;
+	details::kmeans_lloyd_parallel_dynamic<T, S>(data, parameters, buffers, pool, true);
+	return details::take_result<T, details::dynamic_dimension>(buffers);
+}
+
+/*
+Return the best clustering obtained from n_init runs of `kmeans_lloyd_parallel`, like `get_best_means` in
+dkm_utils.hpp. The restarts run at the same time, with the threads split between running several
+restarts and running each restart in parallel depending on the number of points: small data sets run a
+restart on each thread, while large ones give every thread to one restart at a time.
+
+Each restart is seeded with a seed derived from the random seed in the parameters (or a random one if it
+isn't set), so with a fixed seed the restarts, and the choice between them, are repeatable. The restarts
+are compared by their inertia as defined by `means_inertia`, calculated from the distances kept by each
+restart (those of its last assignment step, measured again against the returned means if they moved
+after it) instead of with another pass over the data. When two restarts have the same inertia the
+earlier one is returned.
+
+Restarts which are clearly worse than the best one so far are abandoned as set in the policy, see
+`restart_policy`. When a policy is used, the restarts run in waves of one per thread (or group of
+threads), with at most half of them in the first wave, and each restart is only compared with those
+finished in earlier waves, so the restarts that are abandoned are also repeatable. The report is filled
+in with the number of restarts that finished and were abandoned, and the iterations saved.
+
+The restarts, and the assignment steps within each of them, run as tasks of the given pool.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> get_best_means_parallel(
+	const std::vector<std::array<T, N>>& data,
+	const clustering_parameters<T>& parameters,
+	uint32_t n_init,
+	const restart_policy& policy,
+	restart_report& report,
+	thread_pool& pool = default_thread_pool()) {
+	details::restart_slot<T> best;
+	details::best_of_restarts<T, S, N>(details::view_of(data), parameters, n_init, policy, best, report, pool);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(
+		details::to_arrays<T, N>(best.means), std::move(best.clusters));
+}
+
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> get_best_means_parallel(
+	const std::vector<std::array<T, N>>& data,
+	const clustering_parameters<T>& parameters,
+	uint32_t n_init = 10,
+	thread_pool& pool = default_thread_pool()) {
+	restart_report report;
+	return get_best_means_parallel<T, S, N>(data, parameters, n_init, restart_policy(), report, pool);
+}
+
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> get_best_means_parallel(
+	const std::vector<std::array<T, N>>& data, uint32_t k, uint32_t n_init = 10) {
+	return get_best_means_parallel(data, clustering_parameters<T>(k), n_init);
+}
+
+/*
+Return the best clustering obtained from n_init runs of `kmeans_lloyd_parallel` on data with a dimension
+that is only known at runtime, held in a row-major buffer. See the overload above for details.
+
+Returns a std::tuple containing:
+  0: A flat, row-major vector holding the means for each cluster from 0 to k-1 (k * cols values).
+  1: A vector containing the cluster number (0 to k-1) for each row of the input data.
+*/
+template <typename T, typename S = uint64_t>
+std::tuple<std::vector<T>, std::vector<uint32_t>> get_best_means_parallel(const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	uint32_t n_init,
+	const restart_policy& policy,
+	restart_report& report,
+	thread_pool& pool = default_thread_pool()) {
+	details::restart_slot<T> best;
+	switch (data.cols()) {
+	case 1: details::best_of_restarts<T, S, 1>(data, parameters, n_init, policy, best, report, pool); break;
+	case 2: details::best_of_restarts<T, S, 2>(data, parameters, n_init, policy, best, report, pool); break;
+	case 3: details::best_of_restarts<T, S, 3>(data, parameters, n_init, policy, best, report, pool); break;
+	case 4: details::best_of_restarts<T, S, 4>(data, parameters, n_init, policy, best, report, pool); break;
+	case 8: details::best_of_restarts<T, S, 8>(data, parameters, n_init, policy, best, report, pool); break;
+	case 16: details::best_of_restarts<T, S, 16>(data, parameters, n_init, policy, best, report, pool); break;
+	case 32: details::best_of_restarts<T, S, 32>(data, parameters, n_init, policy, best, report, pool); break;
+	case 64: details::best_of_restarts<T, S, 64>(data, parameters, n_init, policy, best, report, pool); break;
+	case 128: details::best_of_restarts<T, S, 128>(data, parameters, n_init, policy, best, report, pool); break;
+	default: details::best_of_restarts<T, S, details::dynamic_dimension>(data, parameters, n_init, policy, best, report, pool); break;
+	}
+	return std::tuple<std::vector<T>, std::vector<uint32_t>>(std::move(best.means), std::move(best.clusters));
+}
+
+template <typename T, typename S = uint64_t>
+std::tuple<std::vector<T>, std::vector<uint32_t>> get_best_means_parallel(
+	const matrix_view<T>& data,
+	const clustering_parameters<T>& parameters,
+	uint32_t n_init = 10,
+	thread_pool& pool = default_thread_pool()) {
+	restart_report report;
+	return get_best_means_parallel<T, S>(data, parameters, n_init, restart_policy(), report, pool);
+}
+
+template <typename T>
+std::tuple<std::vector<T>, std::vector<uint32_t>> get_best_means_parallel(
+	const matrix_view<T>& data, uint32_t k, uint32_t n_init = 10) {
+	return get_best_means_parallel(data, clustering_parameters<T>(k), n_init);
+}
+
+/*
+Parallel implementation of k-means using Hamerly's algorithm. See `kmeans_hamerly` for details; the
+results are the same as `kmeans_lloyd_parallel`.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_hamerly_parallel(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters, thread_pool& pool = default_thread_pool()) {
 	assert(parameters.get_k() > 0); // k must be greater than zero
 	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	const details::scoped_affinity pinned(parameters.get_cpu_affinity());
+	const std::shared_ptr<thread_pool> held = details::pool_for(parameters, pool);
+	thread_pool& workers = *held;
+	const size_t threads = details::thread_count(parameters, workers);
 	std::random_device rand_device;
 	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
-	std::vector<std::array<T, N>> means = details::random_plusplus_parallel(data, parameters.get_k(), seed);
+	std::vector<std::array<T, N>> means =
+		details::initial_means_parallel(data, parameters.get_k(), seed, parameters.get_initialization(), workers, threads);
 
 	std::vector<std::array<T, N>> old_means;
 	std::vector<std::array<T, N>> old_old_means;
 	std::vector<uint32_t> clusters;
+	details::hamerly_bounds<T> bounds;
 	// Calculate new means until convergence is reached or we hit the maximum iteration count
 	size_t count = 0;
 	do {
-		clusters = details::calculate_clusters_parallel(data, means);
+		if (count == 0) {
+			details::hamerly_initialize_parallel(data, means, clusters, bounds, workers, threads);
+		} else {
+			details::hamerly_calculate_clusters_parallel(data, old_means, means, clusters, bounds, workers, threads);
+		}
 		old_old_means = old_means;
 		old_means = means;
 		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
@@ -164,22 +2050,109 @@ std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd_pa
 }
 
 /*
-This overload exists to support legacy code which uses this signature of the kmeans_lloyd function.
-Any code still using this signature should move to the version of this function that uses a
-`clustering_parameters` struct for configuration.
+Parallel implementation of k-means using the Yinyang algorithm. See `kmeans_yinyang` for details; the
+results are the same as `kmeans_lloyd_parallel`.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector.
 */
-template <typename T, size_t N>
-std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd_parallel(
-	const std::vector<std::array<T, N>>& data, uint32_t k,
-	size_t max_iter = 0, T min_delta = -1.0) {
-	clustering_parameters<T> parameters(k);
-	if (max_iter != 0) {
-		parameters.set_max_iteration(max_iter);
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_yinyang_parallel(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters, thread_pool& pool = default_thread_pool()) {
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	const details::scoped_affinity pinned(parameters.get_cpu_affinity());
+	const std::shared_ptr<thread_pool> held = details::pool_for(parameters, pool);
+	thread_pool& workers = *held;
+	const size_t threads = details::thread_count(parameters, workers);
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::vector<std::array<T, N>> means =
+		details::initial_means_parallel(data, parameters.get_k(), seed, parameters.get_initialization(), workers, threads);
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<uint32_t> clusters;
+	details::yinyang_groups groups = details::yinyang_make_groups(means, seed);
+	details::yinyang_bounds<T> bounds;
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	size_t count = 0;
+	do {
+		if (count == 0) {
+			details::yinyang_initialize_parallel(data, means, groups, clusters, bounds, workers, threads);
+		} else {
+			details::yinyang_calculate_clusters_parallel(data, old_means, means, groups, clusters, bounds, workers, threads);
+		}
+		old_old_means = old_means;
+		old_means = means;
+		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
+		++count;
+	} while ((means != old_means && means != old_old_means)
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+/*
+Parallel implementation of mini-batch k-means. See `kmeans_minibatch` for details; the points in each
+batch and the final full pass over the data are assigned to their closest means in parallel.
+
+Returns a std::tuple containing:
+  0: A vector holding the means for each cluster from 0 to k-1.
+  1: A vector containing the cluster number (0 to k-1) for each corresponding element of the input
+	 data vector, or an empty vector if the full pass is disabled.
+*/
+template <typename T, typename S = uint64_t, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_minibatch_parallel(
+	const std::vector<std::array<T, N>>& data, const minibatch_parameters<T, S>& parameters, thread_pool& pool = default_thread_pool()) {
+	static_assert(std::is_floating_point<T>::value, "kmeans_minibatch_parallel requires a floating point data type");
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	assert(parameters.get_batch_size() > 0); // batches must contain at least one point
+	const details::scoped_affinity pinned(parameters.get_cpu_affinity());
+	const std::shared_ptr<thread_pool> held = details::pool_for(parameters, pool);
+	thread_pool& workers = *held;
+	const size_t threads = details::thread_count(parameters, workers);
+	std::random_device rand_device;
+	S seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::linear_congruential_engine<S, 6364136223846793005, 1442695040888963407, std::numeric_limits<S>::max()> rand_engine(seed);
+	// The batches are drawn into the same buffer, so the memory used doesn't depend on the batch count
+	std::vector<std::array<T, N>> sample;
+	auto sample_size = std::max<size_t>(3 * parameters.get_batch_size(), parameters.get_k());
+	std::vector<std::array<T, N>> means = details::initial_means_parallel(details::random_sample(data, sample_size, rand_engine, sample),
+		parameters.get_k(), seed, parameters.get_initialization(), workers, threads);
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<uint32_t> batch_clusters;
+	details::simd_means<T> prepared;
+	std::vector<T> delta_buffer;
+	std::vector<size_t> counts(parameters.get_k(), 0);
+	std::vector<size_t> window_counts(parameters.get_k(), 0);
+	size_t window_batches = 0;
+	for (size_t count = 0; count < parameters.get_batch_count(); ++count) {
+		const auto& batch = details::random_sample(data, parameters.get_batch_size(), rand_engine, sample);
+		details::calculate_clusters_parallel<T, N>(
+			details::view_of(batch), details::view_of(means), batch_clusters, prepared, workers, threads);
+		old_means = means;
+		details::minibatch_update(batch, batch_clusters, means, counts);
+		if (parameters.get_reassignment_ratio() > 0) {
+			details::minibatch_reassign(batch, batch_clusters, means, counts, window_counts, window_batches,
+				parameters.get_reassignment_ratio(), parameters.get_reassignment_interval(), rand_engine);
+		}
+		if (parameters.has_min_delta() && details::deltas_below_limit<T, N>(details::view_of(old_means),
+				details::view_of(means), parameters.get_min_delta(), delta_buffer)) {
+			break;
+		}
 	}
-	if (min_delta != 0) {
-		parameters.set_min_delta(min_delta);
+
+	std::vector<uint32_t> clusters;
+	if (parameters.get_full_pass()) {
+		clusters = details::calculate_clusters_parallel(data, means, workers, threads);
 	}
-	return kmeans_lloyd_parallel(data, parameters);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
 }
 
 } // namespace dkm
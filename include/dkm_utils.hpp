@@ -11,6 +11,8 @@
 #include <regex>
 #include <numeric>
 #include <cassert>
+#include <cmath>
+#include <utility>
 
 namespace dkm {
 
@@ -125,6 +127,39 @@ T means_inertia(const std::vector<std::array<T, N>>& points,
 }
 
 
+/**
+ * Calculates inertia of a k-means clustering of points held in a matrix_view,
+ * as returned by the runtime dimension overload of dkm::kmeans_lloyd.
+ *
+ * @param points View of the points that were passed to dkm::kmeans_lloyd
+ * @param means  Result of dkm::kmeans_lloyd (flat, row-major means and labels)
+ * @param k      Number of clusters
+ *
+ * @return Total inertia of the given clustering.
+ */
+template <typename T>
+T means_inertia(const matrix_view<T>& points, const std::tuple<std::vector<T>, std::vector<uint32_t>>& means, uint32_t k) {
+	const std::vector<T>& centroids = std::get<0>(means);
+	const std::vector<uint32_t>& labels = std::get<1>(means);
+	assert(centroids.size() == k * points.cols());
+	assert(points.rows() == labels.size() && "Points and labels have different sizes");
+
+	// Sum the distances for each cluster separately, in the same order as the std::array overload
+	std::vector<T> cluster_sums(k, T());
+	std::vector<T> scratch;
+	for (size_t first = 0; first < points.rows(); first += details::gather_block_rows) {
+		const size_t last = std::min(first + details::gather_block_rows, points.rows());
+		const matrix_view<T> block = details::gather_rows(points, first, last, scratch);
+		for (size_t i = first; i < last; ++i) {
+			const T* center = &centroids[labels[i] * points.cols()];
+			cluster_sums[labels[i]] += static_cast<T>(std::sqrt(
+				details::distance_squared<T, details::dynamic_dimension>(block.row(i - first), center, points.cols())));
+		}
+	}
+	return std::accumulate(cluster_sums.begin(), cluster_sums.end(), T());
+}
+
+
 /**
  * Return the best clustering obtained from a given number of k-means
  * calculations.
@@ -153,6 +188,34 @@ std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> get_best_means(
 	return best_means;
 }
 
+/**
+ * Return the best clustering obtained from a given number of k-means
+ * calculations on points held in a matrix_view. The points are not copied.
+ *
+ * @param points  View of the points to be clustered.
+ * @param k		  Number of clusters
+ * @param n_init  Number of times a k-means clustering will be calculated.
+ *
+ * @return Clustering with the lowest inertia (flat, row-major means and labels).
+ */
+template <typename T>
+std::tuple<std::vector<T>, std::vector<uint32_t>> get_best_means(
+	const matrix_view<T>& points, uint32_t k, uint32_t n_init = 10) {
+	clustering_parameters<T> parameters(k);
+	auto best_means = kmeans_lloyd(points, parameters);
+	auto best_inertia = means_inertia(points, best_means, k);
+
+	for (uint32_t i = 0; i < n_init - 1; ++i) {
+		auto curr_means = kmeans_lloyd(points, parameters);
+		auto curr_inertia = means_inertia(points, curr_means, k);
+		if (curr_inertia < best_inertia) {
+			best_inertia = curr_inertia;
+			best_means = std::move(curr_means);
+		}
+	}
+	return best_means;
+}
+
 /**
  * Return the index of the cluster that has the closest centroid to the query
  * @param centroids List of cluster centroids
@@ -173,6 +236,21 @@ size_t predict(const std::vector<std::array<T, N>>& centroids, const std::array<
 	return index;
 }
 
+/**
+ * Return the index of the cluster that has the closest centroid to the query,
+ * with the centroids held in a matrix_view (e.g. the flat means returned by
+ * the runtime dimension overload of dkm::kmeans_lloyd).
+ * @param centroids View of the cluster centroids
+ * @param query Query to which the closest centroid is found (centroids.cols() values)
+ * @return Index of closest centroid (class)
+ */
+template <typename T>
+size_t predict(const matrix_view<T>& centroids, const T* query) {
+	std::vector<T> scratch;
+	return details::closest_mean<T, details::dynamic_dimension>(
+		query, details::gather_rows(centroids, 0, centroids.rows(), scratch));
+}
+
 /**
  * Load a dataset from a CSV file where each row is a point with N values.
  * @param path Location of file on disk to load data from.
@@ -15,7 +15,9 @@ This is just simple benchmarking harness without any external dependencies.
 #include <string>
 #include <iostream>
 #include <chrono>
+#include <limits>
 #include <numeric>
+#include <utility>
 
 template <typename T, size_t N>
 void print_result_dkm(std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>& result) {
@@ -87,6 +89,165 @@ std::chrono::duration<double> profile_dkm_par(const std::vector<std::array<T, N>
 	return (end - start) / 10.0;
 }
 
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_elkan(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_elkan(data, dkm::clustering_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_hamerly(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_hamerly(data, dkm::clustering_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_hamerly_par(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_hamerly_parallel(data, dkm::clustering_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_yinyang(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_yinyang(data, dkm::clustering_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_yinyang_par(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_yinyang_parallel(data, dkm::clustering_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_kdtree(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_kdtree(data, dkm::clustering_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_minibatch(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		auto result = dkm::kmeans_minibatch_parallel(data, dkm::minibatch_parameters<T>(k));
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+template <typename T, size_t N>
+std::chrono::duration<double> profile_dkm_blocked_par(const std::vector<std::array<T, N>>& data, int k) {
+	auto start = std::chrono::high_resolution_clock::now();
+	// run the bench 10 times and take the average
+	for (int i = 0; i < 10; ++i) {
+		std::cout << "." << std::flush;
+		dkm::clustering_parameters<T> parameters(k);
+		parameters.set_distance_engine(dkm::distance_engine::blocked);
+		auto result = dkm::kmeans_lloyd_parallel(data, parameters);
+		(void)result;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return (end - start) / 10.0;
+}
+
+/*
+Lloyd's algorithm as `kmeans_lloyd_parallel` runs it, except that each assignment step is handed to the
+pool as a parallel loop of its own, waking the pool's threads for every iteration, instead of running on
+a team of the threads kept for all of the iterations. This is how the iterations ran before the team was
+added, and is kept here to measure what the team saves.
+*/
+template <typename T, size_t N>
+void kmeans_lloyd_parallel_per_iteration(const std::vector<std::array<T, N>>& data,
+	const dkm::clustering_parameters<T>& parameters,
+	dkm::details::lloyd_buffers<T>& buffers,
+	dkm::thread_pool& pool) {
+	const auto view = dkm::details::view_of(data);
+	const size_t threads = dkm::details::thread_count(parameters, pool);
+	dkm::details::initial_means_parallel<T, uint64_t, N>(view, parameters.get_k(), parameters.get_random_seed(),
+		parameters.get_initialization(), buffers.means, buffers.seeding, pool, threads);
+	buffers.old_means.clear();
+	buffers.old_old_means.clear();
+	dkm::details::prepare_compact_points(view, parameters, buffers);
+	std::vector<dkm::details::numa_shard<T>> shards;
+	const auto split = dkm::details::split_assignment(view.rows(), parameters, threads);
+	dkm::details::kmeans_lloyd_parallel_iterate<T, N>(view, parameters, split, shards, buffers, false, 0,
+		std::numeric_limits<dkm::details::accumulate_t<T>>::max(), pool, pool, threads);
+}
+
+template <typename T, size_t N>
+void bench_team(const std::string& path, uint32_t k) {
+	std::cout << "## Parallel Lloyd iterations " << path << " (k = " << k << ") ##" << std::endl;
+	auto dkm_data = dkm::load_csv<T, N>(path);
+	for (size_t threads : {2, 4, 8}) {
+		dkm::thread_pool pool(threads);
+		dkm::details::lloyd_buffers<T> buffers;
+		// Both versions run the same seeded clusterings, with the same iterations, in reused buffers
+		std::chrono::duration<double> time_team(0), time_loops(0);
+		for (uint64_t seed = 0; seed < 10; ++seed) {
+			dkm::clustering_parameters<T> parameters(k);
+			parameters.set_random_seed(seed);
+			auto start = std::chrono::high_resolution_clock::now();
+			dkm::details::kmeans_lloyd_parallel<T, uint64_t, N>(dkm::details::view_of(dkm_data), parameters, buffers, pool);
+			auto middle = std::chrono::high_resolution_clock::now();
+			kmeans_lloyd_parallel_per_iteration(dkm_data, parameters, buffers, pool);
+			auto end = std::chrono::high_resolution_clock::now();
+			time_team += middle - start;
+			time_loops += end - middle;
+		}
+		std::cout << threads << " threads: team kept for every iteration "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_team / 10.0).count()
+				  << "ms, loop per iteration "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_loops / 10.0).count()
+				  << "ms" << std::endl;
+	}
+	std::cout << std::endl;
+}
+
 template <typename T, size_t N>
 void bench_dataset(const std::string& path, uint32_t k) {
 	std::cout << "## Dataset " << path << " ##" << std::endl;
@@ -99,11 +260,35 @@ void bench_dataset(const std::string& path, uint32_t k) {
 	auto dkm_data = dkm::load_csv<T, N>(path);
 	auto time_dkm = profile_dkm(dkm_data, k);
 	auto time_dkm_par = profile_dkm_par(dkm_data, k);
+	auto time_dkm_blocked_par = profile_dkm_blocked_par(dkm_data, k);
+	auto time_dkm_elkan = profile_dkm_elkan(dkm_data, k);
+	auto time_dkm_hamerly = profile_dkm_hamerly(dkm_data, k);
+	auto time_dkm_hamerly_par = profile_dkm_hamerly_par(dkm_data, k);
+	auto time_dkm_yinyang = profile_dkm_yinyang(dkm_data, k);
+	auto time_dkm_yinyang_par = profile_dkm_yinyang_par(dkm_data, k);
+	auto time_dkm_kdtree = profile_dkm_kdtree(dkm_data, k);
+	auto time_dkm_minibatch = profile_dkm_minibatch(dkm_data, k);
 	std::cout << "\n";
 	std::cout << "DKM: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm).count()
 			  << "ms" << std::endl;
 	std::cout << "DKM parallel: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_par).count()
 			  << "ms" << std::endl;
+	std::cout << "DKM blocked parallel: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_blocked_par).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM Elkan: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_elkan).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM Hamerly: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_hamerly).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM Hamerly parallel: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_hamerly_par).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM Yinyang: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_yinyang).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM Yinyang parallel: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_yinyang_par).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM kd-tree: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_kdtree).count()
+			  << "ms" << std::endl;
+	std::cout << "DKM mini-batch parallel: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_dkm_minibatch).count()
+			  << "ms" << std::endl;
 	std::cout << "OpenCV: ";
 	if (N == 2) {
 		std::cout << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(time_opencv).count() << "ms";
@@ -113,12 +298,85 @@ void bench_dataset(const std::string& path, uint32_t k) {
 	std::cout << "\n" << std::endl;
 }
 
+template <typename T, size_t N>
+void bench_seeding(const std::string& path) {
+	std::cout << "## Seeding " << path << " ##" << std::endl;
+	auto dkm_data = dkm::load_csv<T, N>(path);
+	for (uint32_t k : {10, 100, 500, 1000, 2000}) {
+		auto start = std::chrono::high_resolution_clock::now();
+		auto means = dkm::details::random_plusplus(dkm_data, k, uint64_t(0));
+		auto middle = std::chrono::high_resolution_clock::now();
+		auto means_par = dkm::details::random_plusplus_parallel(dkm_data, k, uint64_t(0));
+		auto end = std::chrono::high_resolution_clock::now();
+		auto means_afkmc2 = dkm::details::random_afkmc2(dkm_data, k, uint64_t(0));
+		auto end_afkmc2 = std::chrono::high_resolution_clock::now();
+		auto means_scalable = dkm::details::random_scalable_plusplus(dkm_data, k, uint64_t(0));
+		auto end_scalable = std::chrono::high_resolution_clock::now();
+		(void)means;
+		(void)means_par;
+		(void)means_afkmc2;
+		(void)means_scalable;
+		std::cout << "k = " << k << ": kmeans++ "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(middle - start).count()
+				  << "ms, kmeans++ parallel "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - middle).count()
+				  << "ms, AFK-MC2 "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end_afkmc2 - end).count()
+				  << "ms, k-means|| "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end_scalable - end_afkmc2).count()
+				  << "ms" << std::endl;
+	}
+	std::cout << std::endl;
+}
+
+template <typename T, size_t N>
+void bench_kernels(const std::string& path, uint32_t k) {
+	std::cout << "## Closest mean kernels " << path << " (k = " << k << ") ##" << std::endl;
+	auto dkm_data = dkm::load_csv<T, N>(path);
+	auto means = dkm::details::random_plusplus(dkm_data, k, uint64_t(0));
+	std::vector<uint32_t> clusters(dkm_data.size());
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < dkm_data.size(); ++i) {
+		clusters[i] = dkm::details::closest_mean(dkm_data[i], means);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "generic: " << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - start).count()
+			  << "ms" << std::endl;
+	const std::pair<dkm::details::simd_level, const char*> levels[] = {
+		{dkm::details::simd_level::sse2, "SSE2"},
+		{dkm::details::simd_level::avx2, "AVX2"},
+		{dkm::details::simd_level::avx512, "AVX-512"}};
+	for (auto& level : levels) {
+		if (level.first > dkm::details::supported_simd_level()) {
+			continue;
+		}
+		start = std::chrono::high_resolution_clock::now();
+		auto prepared = dkm::details::simd_prepare_means(means, level.first);
+		for (size_t i = 0; i < dkm_data.size(); ++i) {
+			clusters[i] = dkm::details::closest_mean_simd(dkm_data[i], prepared, level.first);
+		}
+		end = std::chrono::high_resolution_clock::now();
+		std::cout << level.second << ": "
+				  << std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - start).count()
+				  << "ms" << std::endl;
+	}
+	std::cout << std::endl;
+}
+
 int main() {
 	std::cout << "# BEGINNING PROFILING #\n" << std::endl;
 	bench_dataset<float, 2>("iris.data.csv", 3);
 	bench_dataset<float, 2>("s1.data.csv", 15);
 	bench_dataset<float, 2>("birch3.data.csv", 100);
 	bench_dataset<float, 128>("dim128.data.csv", 16);
+	bench_team<float, 2>("iris.data.csv", 3);
+	bench_team<float, 2>("s1.data.csv", 15);
+	bench_team<float, 2>("birch3.data.csv", 100);
+	bench_team<float, 128>("dim128.data.csv", 16);
+	bench_seeding<float, 2>("birch3.data.csv");
+	bench_kernels<float, 2>("birch3.data.csv", 100);
+	bench_kernels<float, 128>("dim128.data.csv", 100);
+	bench_kernels<double, 2>("birch3.data.csv", 100);
 
 	return 0;
 }
\ No newline at end of file
@@ -17,6 +17,10 @@ This is just simple test harness without any external dependencies.
 #include <algorithm>
 #include <tuple>
 #include <map>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <random>
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wmissing-braces"
@@ -41,6 +45,18 @@ bool means_approx_eq(const std::vector<std::array<T, N>>& means1, const std::vec
 	return true;
 }
 
+// Make a larger data set from shifted copies of the points, with enough points to need several blocks in the
+// blocked and parallel calculations
+std::vector<std::array<float, 2>> shifted_copies(const std::vector<std::array<float, 2>>& points, int copies = 60) {
+	std::vector<std::array<float, 2>> shifted;
+	for (int copy = 0; copy < copies; ++copy) {
+		for (auto& point : points) {
+			shifted.push_back({{point[0] + copy * 0.01f, point[1] - copy * 0.02f}});
+		}
+	}
+	return shifted;
+}
+
 void clusters_normalize_indexes(std::vector<uint32_t>& clusters) {
 	// Normalize the cluster indexes to be in the range [0, k-1] where k is the number of clusters
 	std::map<uint32_t, uint32_t> observed_index_map;
@@ -75,6 +91,16 @@ bool clusters_approx_eq(const std::vector<uint32_t>& clusters1, const std::vecto
 	return result;
 }
 
+// Make random integer points on a small grid, where points are often exactly as far from two means
+std::vector<std::array<uint32_t, 2>> integer_grid_points(size_t count) {
+	std::mt19937 generator(42);
+	std::vector<std::array<uint32_t, 2>> points(count);
+	for (auto& point : points) {
+		point = {{static_cast<uint32_t>(generator() % 201), static_cast<uint32_t>(generator() % 201)}};
+	}
+	return points;
+}
+
 constexpr uint64_t random_seed_value = 7;
 
 const lest::test specification[] = {
@@ -122,6 +148,70 @@ const lest::test specification[] = {
 				EXPECT(means_approx_eq(means, expected_means));
 			}
 			
+			SECTION("Initial means picked correctly via parallel kmeans++") {
+				auto means = dkm::details::random_plusplus(data, parameters.get_k(), parameters.get_random_seed());
+				auto parallel_means = dkm::details::random_plusplus_parallel(data, parameters.get_k(), parameters.get_random_seed());
+				// the prefix sums are added in the same order, so the parallel implementation picks the same means
+				EXPECT(parallel_means == means);
+			}
+
+			SECTION("Weighted sampling keeps the probability of small weights") {
+				std::mt19937_64 rand_engine(random_seed_value);
+				std::vector<float> weights{0.f, 1e-30f, 0.f, 0.f};
+				std::vector<double> sums;
+				dkm::details::weighted_prefix_sums(weights, sums);
+				for (int i = 0; i < 100; ++i) {
+					EXPECT(dkm::details::sample_prefix_sums(sums, rand_engine) == 1u);
+				}
+			}
+
+			SECTION("Initial means picked correctly via k-means||") {
+				auto means = dkm::details::random_scalable_plusplus(data, parameters.get_k(), parameters.get_random_seed());
+				auto parallel_means = dkm::details::random_scalable_plusplus_parallel(data, parameters.get_k(), parameters.get_random_seed());
+				EXPECT(means.size() == 3u);
+				for (const auto& mean : means) {
+					EXPECT(std::find(data.begin(), data.end(), mean) != data.end());
+				}
+				// each block of points is sampled with its own engine, so the parallel implementation picks the same means
+				EXPECT(parallel_means == means);
+			}
+
+			SECTION("Initial means picked correctly via AFK-MC2") {
+				auto means = dkm::details::random_afkmc2(data, parameters.get_k(), parameters.get_random_seed());
+				EXPECT(means.size() == 3u);
+				for (const auto& mean : means) {
+					EXPECT(std::find(data.begin(), data.end(), mean) != data.end());
+				}
+				// deterministic for a given seed
+				EXPECT(dkm::details::random_afkmc2(data, parameters.get_k(), parameters.get_random_seed()) == means);
+			}
+
+			SECTION("K-means converges with AFK-MC2 initialization") {
+				parameters.set_initialization(dkm::initialization::afkmc2);
+				auto means_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto parallel_means_clusters = dkm::kmeans_lloyd_parallel(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				EXPECT(means.size() == 3u);
+				// converged, so every point is labelled with its closest mean
+				EXPECT(clusters == dkm::details::calculate_clusters(data, means));
+				EXPECT(means_approx_eq(std::get<0>(parallel_means_clusters), means));
+				EXPECT(clusters_approx_eq(std::get<1>(parallel_means_clusters), clusters));
+			}
+
+			SECTION("K-means converges with k-means|| initialization") {
+				parameters.set_initialization(dkm::initialization::scalable_plusplus);
+				auto means_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto parallel_means_clusters = dkm::kmeans_lloyd_parallel(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				EXPECT(means.size() == 3u);
+				// converged, so every point is labelled with its closest mean
+				EXPECT(clusters == dkm::details::calculate_clusters(data, means));
+				EXPECT(means_approx_eq(std::get<0>(parallel_means_clusters), means));
+				EXPECT(clusters_approx_eq(std::get<1>(parallel_means_clusters), clusters));
+			}
+
 			SECTION("K-means calculated correctly via Lloyds method") {
 				auto means_clusters = dkm::kmeans_lloyd(data, parameters);
 				auto means = std::get<0>(means_clusters);
@@ -135,6 +225,134 @@ const lest::test specification[] = {
 				EXPECT(clusters_approx_eq(clusters, expected_clusters));
 			}
 
+			SECTION("K-means calculated correctly with the blocked distance engine") {
+				parameters.set_distance_engine(dkm::distance_engine::blocked);
+				auto means_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto parallel_means_clusters = dkm::kmeans_lloyd_parallel(data, parameters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means_approx_eq(std::get<0>(means_clusters), expected_means));
+				EXPECT(clusters_approx_eq(std::get<1>(means_clusters), expected_clusters));
+				EXPECT(means_approx_eq(std::get<0>(parallel_means_clusters), expected_means));
+				EXPECT(clusters_approx_eq(std::get<1>(parallel_means_clusters), expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via Elkan's method") {
+				auto means_clusters = dkm::kmeans_elkan(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means.size() == 3u);
+				EXPECT(means_approx_eq(means, expected_means));
+				EXPECT(clusters.size() == data.size());
+				EXPECT(clusters_approx_eq(clusters, expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via Hamerly's method") {
+				auto means_clusters = dkm::kmeans_hamerly(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means.size() == 3u);
+				EXPECT(means_approx_eq(means, expected_means));
+				EXPECT(clusters.size() == data.size());
+				EXPECT(clusters_approx_eq(clusters, expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via parallel Hamerly's method") {
+				auto means_clusters = dkm::kmeans_hamerly_parallel(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means.size() == 3u);
+				EXPECT(means_approx_eq(means, expected_means));
+				EXPECT(clusters.size() == data.size());
+				EXPECT(clusters_approx_eq(clusters, expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via the Yinyang method") {
+				auto means_clusters = dkm::kmeans_yinyang(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means.size() == 3u);
+				EXPECT(means_approx_eq(means, expected_means));
+				EXPECT(clusters.size() == data.size());
+				EXPECT(clusters_approx_eq(clusters, expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via the parallel Yinyang method") {
+				auto means_clusters = dkm::kmeans_yinyang_parallel(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means.size() == 3u);
+				EXPECT(means_approx_eq(means, expected_means));
+				EXPECT(clusters.size() == data.size());
+				EXPECT(clusters_approx_eq(clusters, expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via the kd-tree filtering method") {
+				auto means_clusters = dkm::kmeans_kdtree(data, parameters);
+				auto means = std::get<0>(means_clusters);
+				auto clusters = std::get<1>(means_clusters);
+				// verify results
+				std::vector<std::array<float, 2>> expected_means{{15.9984f, 23.3856f}, {134.625f, 17.6372f}, {-28.6281f, -11.5276f}};
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(means.size() == 3u);
+				EXPECT(means_approx_eq(means, expected_means));
+				EXPECT(clusters.size() == data.size());
+				EXPECT(clusters_approx_eq(clusters, expected_clusters));
+			}
+
+			SECTION("K-means calculated correctly via mini-batch method") {
+				dkm::minibatch_parameters<float> minibatch_parameters(3);
+				minibatch_parameters.set_random_seed(random_seed_value);
+				minibatch_parameters.set_batch_size(8);
+				minibatch_parameters.set_batch_count(100);
+				auto serial_means_clusters = dkm::kmeans_minibatch(data, minibatch_parameters);
+				auto parallel_means_clusters = dkm::kmeans_minibatch_parallel(data, minibatch_parameters);
+				// the means are only approximated, but the clusters are well separated
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(std::get<0>(serial_means_clusters).size() == 3u);
+				EXPECT(clusters_approx_eq(std::get<1>(serial_means_clusters), expected_clusters));
+				EXPECT(std::get<0>(parallel_means_clusters).size() == 3u);
+				EXPECT(clusters_approx_eq(std::get<1>(parallel_means_clusters), expected_clusters));
+			}
+
+			SECTION("Mini-batch method uses the data in place when a batch covers all of it") {
+				dkm::minibatch_parameters<float> minibatch_parameters(3);
+				minibatch_parameters.set_random_seed(random_seed_value);
+				minibatch_parameters.set_batch_size(data.size() * 2);
+				minibatch_parameters.set_batch_count(20);
+				auto serial_means_clusters = dkm::kmeans_minibatch(data, minibatch_parameters);
+				auto parallel_means_clusters = dkm::kmeans_minibatch_parallel(data, minibatch_parameters);
+				std::vector<uint32_t> expected_clusters = {0, 2, 2, 2, 1, 1, 1, 0, 0, 2, 2, 2, 2, 1, 0, 0, 1};
+				EXPECT(clusters_approx_eq(std::get<1>(serial_means_clusters), expected_clusters));
+				EXPECT(std::get<0>(parallel_means_clusters) == std::get<0>(serial_means_clusters));
+			}
+
+			SECTION("Mini-batch method skips the full pass when disabled") {
+				dkm::minibatch_parameters<float> minibatch_parameters(3);
+				minibatch_parameters.set_random_seed(random_seed_value);
+				minibatch_parameters.set_batch_size(8);
+				minibatch_parameters.set_full_pass(false);
+				auto means_clusters = dkm::kmeans_minibatch(data, minibatch_parameters);
+				EXPECT(std::get<0>(means_clusters).size() == 3u);
+				EXPECT(std::get<1>(means_clusters).empty());
+			}
+
 			SECTION("K-means calculated correctly via parallel Lloyds method") {
 				auto means_clusters = dkm::kmeans_lloyd_parallel(data, parameters);
 				auto means = std::get<0>(means_clusters);
@@ -200,6 +418,643 @@ const lest::test specification[] = {
 				// not checking clusters here because there are too many points
 			}
 
+			SECTION("Segmentation with Elkan's method matches Lloyd's method") {
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto elkan_clusters = dkm::kmeans_elkan(data, parameters);
+
+				EXPECT(std::get<0>(elkan_clusters).size() == 3u);
+				EXPECT(means_approx_eq(std::get<0>(elkan_clusters), std::get<0>(lloyd_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(elkan_clusters), std::get<1>(lloyd_clusters)));
+			}
+
+			SECTION("Segmentation with Hamerly's method matches Lloyd's method") {
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto hamerly_clusters = dkm::kmeans_hamerly(data, parameters);
+				auto hamerly_parallel_clusters = dkm::kmeans_hamerly_parallel(data, parameters);
+
+				EXPECT(means_approx_eq(std::get<0>(hamerly_clusters), std::get<0>(lloyd_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(hamerly_clusters), std::get<1>(lloyd_clusters)));
+				EXPECT(means_approx_eq(std::get<0>(hamerly_parallel_clusters), std::get<0>(lloyd_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(hamerly_parallel_clusters), std::get<1>(lloyd_clusters)));
+			}
+
+			SECTION("Segmentation with the Yinyang method matches Lloyd's method") {
+				// Enough clusters that the means are split between several groups
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto yinyang_clusters = dkm::kmeans_yinyang(data, many_parameters);
+				auto yinyang_parallel_clusters = dkm::kmeans_yinyang_parallel(data, many_parameters);
+
+				EXPECT(means_approx_eq(std::get<0>(yinyang_clusters), std::get<0>(lloyd_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(yinyang_clusters), std::get<1>(lloyd_clusters)));
+				EXPECT(means_approx_eq(std::get<0>(yinyang_parallel_clusters), std::get<0>(lloyd_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(yinyang_parallel_clusters), std::get<1>(lloyd_clusters)));
+			}
+
+			SECTION("Segmentation with the kd-tree filtering method matches Lloyd's method") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto kdtree_clusters = dkm::kmeans_kdtree(data, parameters);
+				auto lloyd_many_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto kdtree_many_clusters = dkm::kmeans_kdtree(data, many_parameters);
+
+				EXPECT(means_approx_eq(std::get<0>(kdtree_clusters), std::get<0>(lloyd_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(kdtree_clusters), std::get<1>(lloyd_clusters)));
+				EXPECT(means_approx_eq(std::get<0>(kdtree_many_clusters), std::get<0>(lloyd_many_clusters)));
+				EXPECT(clusters_approx_eq(std::get<1>(kdtree_many_clusters), std::get<1>(lloyd_many_clusters)));
+			}
+
+			SECTION("Segmentation with the mini-batch method is close to Lloyd's method") {
+				dkm::minibatch_parameters<float> minibatch_parameters(3);
+				minibatch_parameters.set_random_seed(random_seed_value);
+				minibatch_parameters.set_batch_size(32);
+				minibatch_parameters.set_batch_count(200);
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto minibatch_clusters = dkm::kmeans_minibatch(data, minibatch_parameters);
+
+				EXPECT(std::get<1>(minibatch_clusters).size() == data.size());
+				EXPECT(dkm::means_inertia(data, minibatch_clusters, 3) < 1.1f * dkm::means_inertia(data, lloyd_clusters, 3));
+			}
+
+			SECTION("Mini-batch method keeps the kmeans++ means in early batches when k is close to the batch size") {
+				// Most means miss the first batches, which mustn't be taken as a sign that they're unused
+				dkm::minibatch_parameters<float> minibatch_parameters(30);
+				minibatch_parameters.set_random_seed(random_seed_value);
+				minibatch_parameters.set_batch_size(32);
+				minibatch_parameters.set_batch_count(9);
+				auto reassigned_clusters = dkm::kmeans_minibatch(data, minibatch_parameters);
+				auto parallel_reassigned_clusters = dkm::kmeans_minibatch_parallel(data, minibatch_parameters);
+				minibatch_parameters.set_reassignment_ratio(0.0f);
+				auto kept_clusters = dkm::kmeans_minibatch(data, minibatch_parameters);
+				EXPECT(std::get<0>(reassigned_clusters) == std::get<0>(kept_clusters));
+				EXPECT(std::get<0>(parallel_reassigned_clusters) == std::get<0>(kept_clusters));
+			}
+
+			SECTION("Mini-batch method only reassigns means unused over a window of batches") {
+				// Two batches of 15 points fill the window with ten points for each of the three means
+				std::vector<std::array<float, 1>> batch(15, {{1.0f}});
+				std::vector<std::array<float, 1>> means{{{0.0f}}, {{1.0f}}, {{5.0f}}};
+				std::vector<uint32_t> batch_clusters(15, 1);
+				batch_clusters[0] = 0;
+				std::vector<size_t> counts{10, 20, 3};
+				std::vector<size_t> window_counts;
+				size_t window_batches = 0;
+				std::mt19937 rand_engine(random_seed_value);
+				dkm::details::minibatch_reassign(batch, batch_clusters, means, counts, window_counts, window_batches, 0.05f, 2, rand_engine);
+				EXPECT(means[2][0] == 5.0f);
+				EXPECT(window_batches == 1u);
+				dkm::details::minibatch_reassign(batch, batch_clusters, means, counts, window_counts, window_batches, 0.05f, 2, rand_engine);
+				EXPECT(means[2][0] == 1.0f);
+				EXPECT(counts[2] == 10u);
+				EXPECT(window_batches == 0u);
+			}
+
+			SECTION("Segmentation with the blocked distance engine matches the direct engine") {
+				// Enough clusters to need more than one tile of means
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto lloyd_parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				many_parameters.set_distance_engine(dkm::distance_engine::blocked);
+				auto blocked_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto blocked_parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+
+				EXPECT(std::get<0>(blocked_clusters) == std::get<0>(lloyd_clusters));
+				EXPECT(std::get<1>(blocked_clusters) == std::get<1>(lloyd_clusters));
+				EXPECT(std::get<0>(blocked_parallel_clusters) == std::get<0>(lloyd_parallel_clusters));
+				EXPECT(std::get<1>(blocked_parallel_clusters) == std::get<1>(lloyd_parallel_clusters));
+			}
+
+			SECTION("Blocked distance engine settles near ties in float far from the origin") {
+				// The norms are around 2e8, so the expansion cancels away most of its precision
+				std::vector<std::array<float, 2>> far_points;
+				for (const auto& point : data) {
+					far_points.push_back({{point[0] + 10000.0f, point[1] - 10000.0f}});
+				}
+				auto far_view = dkm::details::view_of(far_points);
+				auto means = dkm::details::random_plusplus(far_points, 30, random_seed_value);
+				auto norms = dkm::details::point_norms<float, 2>(far_view);
+				auto blocked = dkm::details::blocked_calculate_clusters<float, 2>(far_view, norms, dkm::details::view_of(means));
+				EXPECT(blocked == dkm::details::calculate_clusters(far_points, means));
+			}
+
+			SECTION("Parallel mean updates match the serial calculation") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				EXPECT(std::get<1>(parallel_clusters) == std::get<1>(lloyd_clusters));
+				EXPECT(means_approx_eq(std::get<0>(parallel_clusters), std::get<0>(lloyd_clusters)));
+			}
+
+			SECTION("Segmentation with incremental mean updates matches full updates") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				auto full_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				many_parameters.set_mean_update(dkm::mean_update::incremental);
+				auto incremental_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto parallel_incremental_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				many_parameters.set_recompute_interval(3);
+				auto recomputed_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				EXPECT(std::get<1>(incremental_clusters) == std::get<1>(full_clusters));
+				EXPECT(std::get<1>(parallel_incremental_clusters) == std::get<1>(full_clusters));
+				EXPECT(std::get<1>(recomputed_clusters) == std::get<1>(full_clusters));
+				EXPECT(means_approx_eq(std::get<0>(incremental_clusters), std::get<0>(full_clusters)));
+				EXPECT(means_approx_eq(std::get<0>(parallel_incremental_clusters), std::get<0>(full_clusters)));
+				EXPECT(means_approx_eq(std::get<0>(recomputed_clusters), std::get<0>(full_clusters)));
+			}
+
+			SECTION("Segmentation of a flat buffer matches the std::array overloads") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				std::vector<float> flat_data;
+				// Also build a five dimensional copy of the data, which has no specialized implementation
+				std::vector<std::array<float, 5>> wide_data;
+				std::vector<float> flat_wide_data;
+				for (auto& point : data) {
+					flat_data.insert(flat_data.end(), point.begin(), point.end());
+					std::array<float, 5> wide_point{{point[0], point[1], point[0] + point[1], point[0] - point[1], 2 * point[0]}};
+					wide_data.push_back(wide_point);
+					flat_wide_data.insert(flat_wide_data.end(), wide_point.begin(), wide_point.end());
+				}
+				auto flatten = [](const std::vector<std::array<float, 5>>& points) {
+					std::vector<float> values;
+					for (auto& point : points) {
+						values.insert(values.end(), point.begin(), point.end());
+					}
+					return values;
+				};
+
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto view_clusters = dkm::kmeans_lloyd(dkm::matrix_view<float>(flat_data.data(), data.size(), 2), many_parameters);
+				auto pointer_clusters = dkm::kmeans_lloyd_parallel(flat_data.data(), data.size(), 2, many_parameters);
+				std::vector<float> lloyd_means;
+				for (auto& mean : std::get<0>(lloyd_clusters)) {
+					lloyd_means.insert(lloyd_means.end(), mean.begin(), mean.end());
+				}
+				std::vector<float> lloyd_parallel_means;
+				auto lloyd_parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				for (auto& mean : std::get<0>(lloyd_parallel_clusters)) {
+					lloyd_parallel_means.insert(lloyd_parallel_means.end(), mean.begin(), mean.end());
+				}
+				EXPECT(std::get<0>(view_clusters) == lloyd_means);
+				EXPECT(std::get<1>(view_clusters) == std::get<1>(lloyd_clusters));
+				EXPECT(std::get<0>(pointer_clusters) == lloyd_parallel_means);
+				EXPECT(std::get<1>(pointer_clusters) == std::get<1>(lloyd_parallel_clusters));
+
+				auto wide_clusters = dkm::kmeans_lloyd(wide_data, many_parameters);
+				auto wide_parallel_clusters = dkm::kmeans_lloyd_parallel(wide_data, many_parameters);
+				auto flat_wide_clusters = dkm::kmeans_lloyd(flat_wide_data.data(), wide_data.size(), 5, many_parameters);
+				auto flat_wide_parallel_clusters = dkm::kmeans_lloyd_parallel(flat_wide_data.data(), wide_data.size(), 5, many_parameters);
+				EXPECT(std::get<0>(flat_wide_clusters) == flatten(std::get<0>(wide_clusters)));
+				EXPECT(std::get<1>(flat_wide_clusters) == std::get<1>(wide_clusters));
+				EXPECT(std::get<0>(flat_wide_parallel_clusters) == flatten(std::get<0>(wide_parallel_clusters)));
+				EXPECT(std::get<1>(flat_wide_parallel_clusters) == std::get<1>(wide_parallel_clusters));
+			}
+
+			SECTION("Segmentation of a strided view matches the std::array overloads") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				// Store each point with three extra columns, and view only the first two
+				std::vector<float> padded_data;
+				for (auto& point : data) {
+					padded_data.insert(padded_data.end(), {point[0], point[1], -1.f, -2.f, -3.f});
+				}
+				dkm::matrix_view<float> strided(padded_data.data(), data.size(), 2, 5);
+				std::vector<float> lloyd_means;
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				for (auto& mean : std::get<0>(lloyd_clusters)) {
+					lloyd_means.insert(lloyd_means.end(), mean.begin(), mean.end());
+				}
+
+				auto strided_clusters = dkm::kmeans_lloyd(strided, many_parameters);
+				auto strided_parallel_clusters = dkm::kmeans_lloyd_parallel(strided, many_parameters);
+				auto lloyd_parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				std::vector<float> lloyd_parallel_means;
+				for (auto& mean : std::get<0>(lloyd_parallel_clusters)) {
+					lloyd_parallel_means.insert(lloyd_parallel_means.end(), mean.begin(), mean.end());
+				}
+				EXPECT(std::get<0>(strided_clusters) == lloyd_means);
+				EXPECT(std::get<1>(strided_clusters) == std::get<1>(lloyd_clusters));
+				EXPECT(std::get<0>(strided_parallel_clusters) == lloyd_parallel_means);
+				EXPECT(std::get<1>(strided_parallel_clusters) == std::get<1>(lloyd_parallel_clusters));
+
+				many_parameters.set_distance_engine(dkm::distance_engine::blocked);
+				auto strided_blocked_clusters = dkm::kmeans_lloyd(strided, many_parameters);
+				EXPECT(std::get<1>(strided_blocked_clusters) == std::get<1>(lloyd_clusters));
+			}
+
+			SECTION("Segmentation of a column-major view matches the std::array overloads") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				// Store the first column of every point, then the second, and cluster them in place
+				std::vector<float> column_data(data.size() * 2);
+				for (size_t i = 0; i < data.size(); ++i) {
+					column_data[i] = data[i][0];
+					column_data[data.size() + i] = data[i][1];
+				}
+				dkm::matrix_view<float> columns(column_data.data(), data.size(), 2, 1, data.size());
+				EXPECT(!columns.contiguous_rows());
+				EXPECT(columns.value(3, 1) == data[3][1]);
+				std::vector<float> lloyd_means;
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				for (auto& mean : std::get<0>(lloyd_clusters)) {
+					lloyd_means.insert(lloyd_means.end(), mean.begin(), mean.end());
+				}
+				std::vector<float> lloyd_parallel_means;
+				auto lloyd_parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				for (auto& mean : std::get<0>(lloyd_parallel_clusters)) {
+					lloyd_parallel_means.insert(lloyd_parallel_means.end(), mean.begin(), mean.end());
+				}
+
+				auto column_clusters = dkm::kmeans_lloyd(columns, many_parameters);
+				auto column_parallel_clusters = dkm::kmeans_lloyd_parallel(columns, many_parameters);
+				EXPECT(std::get<0>(column_clusters) == lloyd_means);
+				EXPECT(std::get<1>(column_clusters) == std::get<1>(lloyd_clusters));
+				EXPECT(std::get<0>(column_parallel_clusters) == lloyd_parallel_means);
+				EXPECT(std::get<1>(column_parallel_clusters) == std::get<1>(lloyd_parallel_clusters));
+				EXPECT(dkm::means_inertia(columns, column_clusters, 30) == dkm::means_inertia(data, lloyd_clusters, 30));
+
+				many_parameters.set_mean_update(dkm::mean_update::incremental);
+				auto incremental_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto column_incremental_clusters = dkm::kmeans_lloyd(columns, many_parameters);
+				EXPECT(std::get<1>(column_incremental_clusters) == std::get<1>(incremental_clusters));
+				many_parameters.set_mean_update(dkm::mean_update::full);
+
+				many_parameters.set_distance_engine(dkm::distance_engine::blocked);
+				auto column_blocked_clusters = dkm::kmeans_lloyd(columns, many_parameters);
+				auto column_blocked_parallel_clusters = dkm::kmeans_lloyd_parallel(columns, many_parameters);
+				EXPECT(std::get<1>(column_blocked_clusters) == std::get<1>(lloyd_clusters));
+				EXPECT(std::get<1>(column_blocked_parallel_clusters) == std::get<1>(lloyd_parallel_clusters));
+				many_parameters.set_distance_engine(dkm::distance_engine::direct);
+
+				for (auto method : {dkm::initialization::scalable_plusplus, dkm::initialization::afkmc2}) {
+					many_parameters.set_initialization(method);
+					auto row_clusters = dkm::kmeans_lloyd(data, many_parameters);
+					EXPECT(std::get<1>(dkm::kmeans_lloyd(columns, many_parameters)) == std::get<1>(row_clusters));
+					auto row_parallel_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+					EXPECT(std::get<1>(dkm::kmeans_lloyd_parallel(columns, many_parameters)) == std::get<1>(row_parallel_clusters));
+				}
+				many_parameters.set_initialization(dkm::initialization::plusplus);
+
+				many_parameters.set_point_storage(dkm::point_storage::half);
+				auto half_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				EXPECT(std::get<1>(dkm::kmeans_lloyd(columns, many_parameters)) == std::get<1>(half_clusters));
+				many_parameters.set_point_storage(dkm::point_storage::full);
+
+				many_parameters.set_numa_nodes(dkm::numa_node_count() + 1);
+				auto numa_clusters = dkm::kmeans_lloyd_parallel(data, many_parameters);
+				EXPECT(std::get<1>(dkm::kmeans_lloyd_parallel(columns, many_parameters)) == std::get<1>(numa_clusters));
+			}
+
+			SECTION("Segmentation in a reused workspace matches the std::array overloads") {
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				auto flatten = [](const std::vector<std::array<float, 2>>& points) {
+					std::vector<float> values;
+					for (auto& point : points) {
+						values.insert(values.end(), point.begin(), point.end());
+					}
+					return values;
+				};
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, many_parameters);
+				auto parallel_clusters = dkm::kmeans_lloyd_parallel(data, parameters);
+
+				dkm::kmeans_workspace<float, 2> workspace;
+				dkm::kmeans_lloyd(data, many_parameters, workspace);
+				const uint32_t* labels = workspace.clusters().data();
+				// The means are seeded in place and rotated between the three means buffers
+				auto& buffers = workspace.buffers(2);
+				std::vector<const float*> means_storage{buffers.means.data(), buffers.old_means.data(), buffers.old_old_means.data()};
+				const float* seeding_distances = buffers.seeding.distances.data();
+				auto in_means_storage = [&means_storage](const std::vector<float>& means) {
+					return std::find(means_storage.begin(), means_storage.end(), means.data()) != means_storage.end();
+				};
+				// Reuse the workspace for a smaller k, then for the original clustering again
+				dkm::kmeans_lloyd_parallel(data, parameters, workspace);
+				EXPECT(workspace.means().rows() == 3u);
+				EXPECT(std::vector<float>(workspace.means().data(), workspace.means().data() + 6) == flatten(std::get<0>(parallel_clusters)));
+				EXPECT(workspace.clusters() == std::get<1>(parallel_clusters));
+				dkm::kmeans_lloyd(data, many_parameters, workspace);
+				EXPECT(workspace.clusters().data() == labels);
+				EXPECT(buffers.seeding.distances.data() == seeding_distances);
+				EXPECT(in_means_storage(buffers.means));
+				EXPECT(in_means_storage(buffers.old_means));
+				EXPECT(in_means_storage(buffers.old_old_means));
+				EXPECT(std::vector<float>(workspace.means().data(), workspace.means().data() + 60) == flatten(std::get<0>(lloyd_clusters)));
+				EXPECT(workspace.clusters() == std::get<1>(lloyd_clusters));
+
+				std::vector<float> flat_data = flatten(data);
+				dkm::matrix_view<float> view(flat_data.data(), data.size(), 2);
+				dkm::kmeans_workspace<float> flat_workspace;
+				dkm::kmeans_lloyd(view, many_parameters, flat_workspace);
+				EXPECT(flat_workspace.means().cols() == 2u);
+				EXPECT(flat_workspace.clusters() == std::get<1>(lloyd_clusters));
+				dkm::kmeans_lloyd_parallel(view, parameters, flat_workspace);
+				EXPECT(flat_workspace.clusters() == std::get<1>(parallel_clusters));
+			}
+
+			SECTION("Clustering results hold the distances and inertia of the final assignment") {
+				auto lloyd_clusters = dkm::kmeans_lloyd(data, parameters);
+				auto result = dkm::kmeans_lloyd_result(data, parameters);
+				EXPECT(result.means == std::get<0>(lloyd_clusters));
+				EXPECT(result.clusters == std::get<1>(lloyd_clusters));
+				EXPECT(result.converged);
+				EXPECT(result.iterations > 0u);
+				EXPECT(result.distances.size() == data.size());
+				for (size_t i = 0; i < data.size(); ++i) {
+					EXPECT(result.distances[i] == lest::approx(dkm::details::distance_squared(data[i], result.means[result.clusters[i]])));
+				}
+				EXPECT(result.inertia == lest::approx(dkm::means_inertia(data, lloyd_clusters, 3)));
+
+				auto parallel_clusters = dkm::kmeans_lloyd_parallel(data, parameters);
+				auto parallel_result = dkm::kmeans_lloyd_parallel_result(data, parameters);
+				EXPECT(parallel_result.clusters == std::get<1>(parallel_clusters));
+				EXPECT(parallel_result.inertia == lest::approx(dkm::means_inertia(data, parallel_clusters, 3)));
+
+				std::vector<float> flat_data;
+				for (auto& point : data) {
+					flat_data.insert(flat_data.end(), point.begin(), point.end());
+				}
+				dkm::matrix_view<float> view(flat_data.data(), data.size(), 2);
+				auto flat_result = dkm::kmeans_lloyd_result(view, parameters);
+				EXPECT(flat_result.means.size() == 6u);
+				EXPECT(flat_result.clusters == result.clusters);
+				EXPECT(flat_result.inertia == lest::approx(result.inertia));
+
+				dkm::clustering_parameters<float> limited_parameters(3);
+				limited_parameters.set_random_seed(random_seed_value);
+				limited_parameters.set_max_iteration(1);
+				auto limited = dkm::kmeans_lloyd_result(data, limited_parameters);
+				EXPECT(limited.iterations == 1u);
+				EXPECT(!limited.converged);
+				// The means moved after the last assignment, and the distances are to the returned means
+				for (size_t i = 0; i < data.size(); ++i) {
+					EXPECT(limited.distances[i] == lest::approx(dkm::details::distance_squared(data[i], limited.means[limited.clusters[i]])));
+				}
+				auto limited_clusters = std::make_tuple(limited.means, limited.clusters);
+				EXPECT(limited.clusters == std::get<1>(dkm::kmeans_lloyd(data, limited_parameters)));
+				EXPECT(limited.inertia == lest::approx(dkm::means_inertia(data, limited_clusters, 3)));
+				auto parallel_limited = dkm::kmeans_lloyd_parallel_result(data, limited_parameters);
+				EXPECT(parallel_limited.inertia == lest::approx(dkm::means_inertia(
+					data, std::make_tuple(parallel_limited.means, parallel_limited.clusters), 3)));
+			}
+
+			SECTION("Restarts stopped at the maximum iteration count are ranked by the inertia of their means") {
+				dkm::clustering_parameters<float> restart_parameters(5);
+				restart_parameters.set_random_seed(random_seed_value);
+				restart_parameters.set_max_iteration(1);
+				restart_parameters.set_deterministic(true);
+				// Pick the best of the same restarts one after another, ranked like get_best_means. Ranked by
+				// the distances to the means before their last update, a different restart would win
+				decltype(dkm::kmeans_lloyd(data, restart_parameters)) best;
+				float best_inertia = std::numeric_limits<float>::max();
+				for (uint32_t restart = 0; restart < 20; ++restart) {
+					dkm::clustering_parameters<float> serial_parameters(restart_parameters);
+					serial_parameters.set_random_seed(dkm::details::restart_seed<uint64_t>(random_seed_value, restart));
+					auto current = dkm::kmeans_lloyd(data, serial_parameters);
+					const float inertia = dkm::means_inertia(data, current, 5);
+					if (inertia < best_inertia) {
+						best_inertia = inertia;
+						best = current;
+					}
+				}
+				auto parallel_best = dkm::get_best_means_parallel(data, restart_parameters, 20);
+				EXPECT(std::get<0>(parallel_best) == std::get<0>(best));
+				EXPECT(std::get<1>(parallel_best) == std::get<1>(best));
+			}
+
+			SECTION("Restarts that are clearly worse than the best so far are abandoned") {
+				dkm::clustering_parameters<float> restart_parameters(10);
+				restart_parameters.set_random_seed(random_seed_value);
+				dkm::restart_report full_report;
+				auto full = dkm::get_best_means_parallel(data, restart_parameters, 20, dkm::restart_policy(), full_report);
+				EXPECT(full_report.finished == 20u);
+				EXPECT(full_report.abandoned == 0u);
+				EXPECT(full_report.iterations_saved == 0u);
+
+				// An explicit pool, so the number of restarts run at once doesn't depend on the machine
+				dkm::thread_pool pool(4);
+				dkm::restart_policy policy;
+				policy.set_check_iteration(1);
+				policy.set_abandon_ratio(1.0);
+				dkm::restart_report report;
+				auto raced = dkm::get_best_means_parallel(data, restart_parameters, 20, policy, report, pool);
+				EXPECT(report.finished + report.abandoned == 20u);
+				EXPECT(report.finished >= 1u);
+				EXPECT(report.abandoned >= 1u);
+				EXPECT(report.iterations < full_report.iterations);
+				EXPECT(std::get<1>(raced).size() == data.size());
+				// The abandoned restarts don't depend on timing, so the result is repeatable
+				dkm::restart_report repeated_report;
+				auto repeated = dkm::get_best_means_parallel(data, restart_parameters, 20, policy, repeated_report, pool);
+				EXPECT(std::get<0>(repeated) == std::get<0>(raced));
+				EXPECT(repeated_report.abandoned == report.abandoned);
+
+				// With a thread for every restart, the first half still finish before the rest are checked
+				dkm::thread_pool wide_pool(32);
+				dkm::restart_report wide_report;
+				dkm::get_best_means_parallel(data, restart_parameters, 20, policy, wide_report, wide_pool);
+				EXPECT(wide_report.finished + wide_report.abandoned == 20u);
+				EXPECT(wide_report.abandoned >= 1u);
+
+				// A ratio nothing can exceed abandons nothing, so the result is the same as without a policy
+				policy.set_abandon_ratio(1e30);
+				auto relaxed = dkm::get_best_means_parallel(data, restart_parameters, 20, policy, report);
+				EXPECT(report.abandoned == 0u);
+				EXPECT(std::get<0>(relaxed) == std::get<0>(full));
+			}
+
+			SECTION("Parallel kmeans++ picks the same means as the serial version over several blocks") {
+				// Enough points to need several blocks of prefix sums
+				auto many_points = shifted_copies(data);
+				auto means = dkm::details::random_plusplus(many_points, 50, random_seed_value);
+				auto parallel_means = dkm::details::random_plusplus_parallel(many_points, 50, random_seed_value);
+				EXPECT(parallel_means == means);
+			}
+
+			SECTION("Parallel k-means|| picks the same means as the serial version on any number of threads") {
+				// Enough points to be sampled in several blocks
+				auto many_points = shifted_copies(data);
+				auto means = dkm::details::random_scalable_plusplus(many_points, 50, random_seed_value);
+				for (size_t threads : {1, 2, 3, 8}) {
+					dkm::thread_pool pool(threads);
+					EXPECT(dkm::details::random_scalable_plusplus_parallel(many_points, 50, random_seed_value, pool) == means);
+				}
+			}
+
+			SECTION("Concurrent clusterings sharing a thread pool match a single clustering") {
+				auto many_points = shifted_copies(data);
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				dkm::thread_pool pool(4);
+				auto expected = dkm::kmeans_lloyd_parallel(many_points, many_parameters, pool);
+				std::vector<std::tuple<std::vector<std::array<float, 2>>, std::vector<uint32_t>>> results(3);
+				std::vector<std::thread> callers;
+				for (auto& result : results) {
+					callers.emplace_back([&] { result = dkm::kmeans_lloyd_parallel(many_points, many_parameters, pool); });
+				}
+				for (auto& caller : callers) {
+					caller.join();
+				}
+				for (auto& result : results) {
+					EXPECT(std::get<0>(result) == std::get<0>(expected));
+					EXPECT(std::get<1>(result) == std::get<1>(expected));
+				}
+				// A pool of one thread runs everything on the calling thread
+				dkm::thread_pool serial_pool(1);
+				auto serial = dkm::kmeans_lloyd_parallel(many_points, many_parameters, serial_pool);
+				EXPECT(std::get<1>(serial) == std::get<1>(dkm::kmeans_lloyd(many_points, many_parameters)));
+			}
+
+			SECTION("Thread count, schedule and CPU affinity settings are honoured") {
+				auto many_points = shifted_copies(data);
+				dkm::clustering_parameters<float> many_parameters(30);
+				many_parameters.set_random_seed(random_seed_value);
+				dkm::thread_pool pool(4);
+				auto serial = dkm::kmeans_lloyd(many_points, many_parameters);
+				// One thread runs the whole assignment step as a single part, like the serial version
+				many_parameters.set_thread_count(1);
+				auto one_thread = dkm::kmeans_lloyd_parallel(many_points, many_parameters, pool);
+				EXPECT(std::get<1>(one_thread) == std::get<1>(serial));
+				// A single pinned core is a pool of one thread
+				many_parameters.set_thread_count(0);
+				many_parameters.set_cpu_affinity({0});
+				auto pinned = dkm::kmeans_lloyd_parallel(many_points, many_parameters, pool);
+				EXPECT(std::get<1>(pinned) == std::get<1>(serial));
+				// Pools for core lists that are no longer used are evicted rather than kept forever
+				for (int core = 0; core < 40; ++core) {
+					many_parameters.set_cpu_affinity({0, core});
+					dkm::kmeans_lloyd_parallel(data, many_parameters, pool);
+				}
+				EXPECT(dkm::details::affinity_pool_count()
+					<= dkm::details::affinity_pool_cache_size + dkm::details::numa_nodes().size());
+				many_parameters.set_cpu_affinity({});
+				// Chunks taken by the threads as they come free sum in a different order to even parts
+				auto even = dkm::kmeans_lloyd_parallel(many_points, many_parameters, pool);
+				many_parameters.set_schedule(dkm::parallel_schedule::dynamic);
+				many_parameters.set_chunk_size(100);
+				auto dynamic = dkm::kmeans_lloyd_parallel(many_points, many_parameters, pool);
+				EXPECT(means_approx_eq(std::get<0>(dynamic), std::get<0>(even)));
+				EXPECT(clusters_approx_eq(std::get<1>(dynamic), std::get<1>(even)));
+			}
+
+			SECTION("Deterministic results are the same as the serial version on any number of threads") {
+				auto many_points = shifted_copies(data);
+				dkm::thread_pool pool(16);
+				for (auto update : {dkm::mean_update::full, dkm::mean_update::incremental}) {
+					dkm::clustering_parameters<float> many_parameters(30);
+					many_parameters.set_random_seed(random_seed_value);
+					many_parameters.set_mean_update(update);
+					many_parameters.set_recompute_interval(3);
+					many_parameters.set_deterministic(true);
+					many_parameters.set_schedule(dkm::parallel_schedule::dynamic);
+					auto serial = dkm::kmeans_lloyd_result(many_points, many_parameters);
+					for (size_t threads : {1, 2, 3, 5, 16}) {
+						many_parameters.set_thread_count(threads);
+						auto parallel = dkm::kmeans_lloyd_parallel_result(many_points, many_parameters, pool);
+						EXPECT(parallel.means == serial.means);
+						EXPECT(parallel.clusters == serial.clusters);
+						EXPECT(parallel.distances == serial.distances);
+						EXPECT(parallel.iterations == serial.iterations);
+					}
+				}
+				// The restarts are seeded and chosen in the same way however the threads are split between them
+				dkm::clustering_parameters<float> restart_parameters(30);
+				restart_parameters.set_random_seed(random_seed_value);
+				restart_parameters.set_deterministic(true);
+				restart_parameters.set_thread_count(1);
+				auto one_thread = dkm::get_best_means_parallel(many_points, restart_parameters, 4, pool);
+				restart_parameters.set_thread_count(16);
+				auto all_threads = dkm::get_best_means_parallel(many_points, restart_parameters, 4, pool);
+				EXPECT(std::get<0>(all_threads) == std::get<0>(one_thread));
+				EXPECT(std::get<1>(all_threads) == std::get<1>(one_thread));
+			}
+
+			SECTION("Simulated NUMA shards give the same clustering as the data in place") {
+				auto many_points = shifted_copies(data);
+				dkm::thread_pool pool(4);
+				for (auto engine : {dkm::distance_engine::direct, dkm::distance_engine::blocked}) {
+					dkm::clustering_parameters<float> many_parameters(30);
+					many_parameters.set_random_seed(random_seed_value);
+					many_parameters.set_distance_engine(engine);
+					auto in_place = dkm::kmeans_lloyd_parallel_result(many_points, many_parameters, pool);
+					// A single shard is split between the threads in the same way as the data in place
+					many_parameters.set_numa_nodes(1);
+					auto one_node = dkm::kmeans_lloyd_parallel_result(many_points, many_parameters, pool);
+					EXPECT(one_node.means == in_place.means);
+					EXPECT(one_node.clusters == in_place.clusters);
+					EXPECT(one_node.distances == in_place.distances);
+					// More nodes than the machine has are simulated
+					many_parameters.set_numa_nodes(dkm::numa_node_count() + 2);
+					auto sharded = dkm::kmeans_lloyd_parallel_result(many_points, many_parameters, pool);
+					EXPECT(means_approx_eq(sharded.means, in_place.means));
+					EXPECT(clusters_approx_eq(sharded.clusters, in_place.clusters));
+					EXPECT(sharded.distances.size() == many_points.size());
+					EXPECT(std::abs(sharded.inertia - in_place.inertia) < in_place.inertia * 1e-3f);
+					many_parameters.set_mean_update(dkm::mean_update::incremental);
+					auto incremental = dkm::kmeans_lloyd_parallel_result(many_points, many_parameters, pool);
+					EXPECT(means_approx_eq(incremental.means, in_place.means));
+				}
+			}
+
+			SECTION("SIMD kernels find the same closest means as the generic calculation") {
+				// A number of means that isn't a multiple of any vector width
+				auto means = dkm::details::random_plusplus(data, 37, random_seed_value);
+				std::vector<std::array<double, 2>> double_data;
+				std::vector<std::array<double, 2>> double_means;
+				for (auto& point : data) {
+					double_data.push_back({point[0], point[1]});
+				}
+				for (auto& mean : means) {
+					double_means.push_back({mean[0], mean[1]});
+				}
+				auto supported = dkm::details::supported_simd_level();
+				for (auto level : {dkm::details::simd_level::sse2, dkm::details::simd_level::avx2, dkm::details::simd_level::avx512}) {
+					if (level > supported) {
+						continue;
+					}
+					auto prepared = dkm::details::simd_prepare_means(means, level);
+					auto double_prepared = dkm::details::simd_prepare_means(double_means, level);
+					for (size_t i = 0; i < data.size(); ++i) {
+						EXPECT(dkm::details::closest_mean_simd(data[i], prepared, level) == dkm::details::closest_mean(data[i], means));
+						EXPECT(dkm::details::closest_mean_simd(double_data[i], double_prepared, level) ==
+							dkm::details::closest_mean(double_data[i], double_means));
+					}
+				}
+			}
+
+			SECTION("Blocked SIMD kernels calculate the same dot products as the generic kernel") {
+				auto means = dkm::details::random_plusplus(data, 37, random_seed_value);
+				auto data_view = dkm::details::view_of(data);
+				auto prepared = dkm::details::blocked_prepare_means<float, 2>(dkm::details::view_of(means));
+				auto supported = dkm::details::supported_simd_level();
+				for (auto level : {dkm::details::simd_level::avx2, dkm::details::simd_level::avx512}) {
+					if (level > supported) {
+						continue;
+					}
+					// The last tile of points is short
+					for (size_t p0 = 0; p0 < data.size(); p0 += dkm::details::blocked_point_tile) {
+						const size_t rows = std::min(dkm::details::blocked_point_tile, data.size() - p0);
+						for (size_t c0 = 0; c0 < prepared.padded_k; c0 += dkm::details::blocked_mean_tile) {
+							double generic[dkm::details::blocked_point_tile][dkm::details::blocked_mean_tile];
+							double simd[dkm::details::blocked_point_tile][dkm::details::blocked_mean_tile];
+							dkm::details::blocked_dot_tile<float, 2>(data_view, p0, rows, &prepared.transposed[c0],
+								prepared.padded_k, dkm::details::simd_level::none, generic);
+							dkm::details::blocked_dot_tile<float, 2>(data_view, p0, rows, &prepared.transposed[c0],
+								prepared.padded_k, level, simd);
+							for (size_t p = 0; p < rows; ++p) {
+								for (size_t c = 0; c < dkm::details::blocked_mean_tile; ++c) {
+									EXPECT(std::abs(simd[p][c] - generic[p][c]) <= 1e-12 * (1.0 + std::abs(generic[p][c])));
+								}
+							}
+						}
+					}
+				}
+			}
+
 			SECTION("Segmentation completes early because iteration limit is reached") {
 				parameters.set_max_iteration(5);
 				auto means_clusters = dkm::kmeans_lloyd(data, parameters);
@@ -263,6 +1118,33 @@ const lest::test specification[] = {
 				EXPECT(means_clusters.size() == 1u);
 				EXPECT(means_clusters == expected_means);
 			}
+
+			SECTION("AFK-MC2 doesn't throw an exception on uniform data") {
+				auto means_clusters = dkm::details::random_afkmc2(data, parameters.get_k(), parameters.get_random_seed());
+
+				std::vector<std::array<float, 2>> expected_means{{5.0f, 5.0f}};
+				EXPECT(means_clusters.size() == 1u);
+				EXPECT(means_clusters == expected_means);
+			}
+
+			SECTION("K-means|| picks means when there are fewer distinct points than means") {
+				data[0] = {{1.0f, 1.0f}};
+				auto means = dkm::details::random_scalable_plusplus(data, 3, parameters.get_random_seed());
+				auto parallel_means = dkm::details::random_scalable_plusplus_parallel(data, 3, parameters.get_random_seed());
+				EXPECT(means.size() == 3u);
+				for (const auto& mean : means) {
+					EXPECT(std::find(data.begin(), data.end(), mean) != data.end());
+				}
+				EXPECT(parallel_means == means);
+			}
+
+			SECTION("K-means|| doesn't throw an exception on uniform data") {
+				auto means_clusters = dkm::details::random_scalable_plusplus(data, parameters.get_k(), parameters.get_random_seed());
+
+				std::vector<std::array<float, 2>> expected_means{{5.0f, 5.0f}};
+				EXPECT(means_clusters.size() == 1u);
+				EXPECT(means_clusters == expected_means);
+			}
 		}
 	},
 
@@ -299,6 +1181,34 @@ const lest::test specification[] = {
 				EXPECT(clusters_approx_eq(clusters, expected_clusters));
 				EXPECT(means_approx_eq(means, expected_means));
 			}
+
+			SECTION("The accelerated methods break ties between means like Lloyd's method") {
+				// The means are truncated to integers, so many points are exactly as far from two means
+				auto grid = integer_grid_points(5000);
+				for (uint64_t seed = 0; seed < 30; ++seed) {
+					dkm::clustering_parameters<uint32_t> grid_parameters(16);
+					grid_parameters.set_random_seed(seed);
+					auto lloyd_clusters = std::get<1>(dkm::kmeans_lloyd(grid, grid_parameters));
+					EXPECT(std::get<1>(dkm::kmeans_elkan(grid, grid_parameters)) == lloyd_clusters);
+					EXPECT(std::get<1>(dkm::kmeans_hamerly(grid, grid_parameters)) == lloyd_clusters);
+					EXPECT(std::get<1>(dkm::kmeans_hamerly_parallel(grid, grid_parameters)) == lloyd_clusters);
+					EXPECT(std::get<1>(dkm::kmeans_yinyang(grid, grid_parameters)) == lloyd_clusters);
+					EXPECT(std::get<1>(dkm::kmeans_yinyang_parallel(grid, grid_parameters)) == lloyd_clusters);
+				}
+			}
+
+			SECTION("The blocked distance engine breaks ties between means like the direct engine") {
+				auto grid = integer_grid_points(5000);
+				auto grid_view = dkm::details::view_of(grid);
+				auto norms = dkm::details::point_norms<uint32_t, 2>(grid_view);
+				for (uint64_t seed = 0; seed < 10; ++seed) {
+					// Several tiles of means, so ties fall both within and between lanes of a tile
+					auto means = dkm::details::random_plusplus(grid, 40, seed);
+					auto blocked = dkm::details::blocked_calculate_clusters<uint32_t, 2>(
+						grid_view, norms, dkm::details::view_of(means));
+					EXPECT(blocked == dkm::details::calculate_clusters(grid, means));
+				}
+			}
 		}
 	},
 
@@ -474,6 +1384,21 @@ const lest::test specification[] = {
 				EXPECT(lest::approx(inertia) == dkm::means_inertia(points, means, k));
 			}
 
+			SECTION("Strided view of the points gives the same inertia") {
+				std::vector<double> padded_points;
+				for (auto& point : points) {
+					padded_points.insert(padded_points.end(), {point[0], point[1], 0.0});
+				}
+				std::vector<double> flat_centroids;
+				for (auto& centroid : centroids) {
+					flat_centroids.insert(flat_centroids.end(), centroid.begin(), centroid.end());
+				}
+				std::tuple<std::vector<std::array<double, 2>>, std::vector<uint32_t>> means{centroids, labels};
+				std::tuple<std::vector<double>, std::vector<uint32_t>> flat_means{flat_centroids, labels};
+				dkm::matrix_view<double> strided(padded_points.data(), points.size(), 2, 3);
+				EXPECT(dkm::means_inertia(strided, flat_means, k) == dkm::means_inertia(points, means, k));
+			}
+
 			SECTION("Two sets of clearly separate points give large inertia") {
 				std::vector<std::array<double, 2>> data{
 					{1, 1},
@@ -522,6 +1447,244 @@ const lest::test specification[] = {
 					EXPECT(expected_center[1] == lest::approx(returned_center[1]));
 				}
 			}
+
+			SECTION("Test if we get the clustering with the least inertia from a strided view") {
+				std::vector<double> padded_points;
+				for (auto& point : points) {
+					padded_points.insert(padded_points.end(), {point[0], point[1], 100.0, 100.0});
+				}
+				auto means = dkm::get_best_means(dkm::matrix_view<double>(padded_points.data(), points.size(), 2, 4), k, 20);
+				std::vector<double> returned_centroids;
+				std::vector<uint32_t> returned_labels;
+				std::tie(returned_centroids, returned_labels) = means;
+				EXPECT(returned_centroids.size() == k * 2);
+				for (uint32_t i = 0; i < points.size(); ++i) {
+					auto expected_center = centroids[labels[i]];
+					EXPECT(expected_center[0] == lest::approx(returned_centroids[returned_labels[i] * 2]));
+					EXPECT(expected_center[1] == lest::approx(returned_centroids[returned_labels[i] * 2 + 1]));
+				}
+			}
+
+			SECTION("Test if concurrent restarts get the clustering with the least inertia") {
+				dkm::clustering_parameters<double> parameters(k);
+				parameters.set_random_seed(random_seed_value);
+				auto means = dkm::get_best_means_parallel(points, parameters, 20);
+				std::vector<std::array<double, 2>> returned_centroids;
+				std::vector<uint32_t> returned_labels;
+				std::tie(returned_centroids, returned_labels) = means;
+				for (uint32_t i = 0; i < points.size(); ++i) {
+					auto expected_center = centroids[labels[i]];
+					auto returned_center = returned_centroids[returned_labels[i]];
+					EXPECT(expected_center[0] == lest::approx(returned_center[0]));
+					EXPECT(expected_center[1] == lest::approx(returned_center[1]));
+				}
+				// The restarts are seeded from the parameters, so they are repeatable
+				auto repeated_means = dkm::get_best_means_parallel(points, parameters, 20);
+				EXPECT(std::get<0>(repeated_means) == returned_centroids);
+				EXPECT(std::get<1>(repeated_means) == returned_labels);
+				auto flat_means = dkm::get_best_means_parallel(dkm::details::view_of(points), parameters, 20);
+				EXPECT((dkm::details::to_arrays<double, 2>(std::get<0>(flat_means)) == returned_centroids));
+				EXPECT(std::get<1>(flat_means) == returned_labels);
+			}
+
+			SECTION("Concurrent restarts are split between threads depending on the number of points") {
+				auto small = dkm::details::split_restart_threads(1000, 10, 8);
+				EXPECT(small.restarts == 8);
+				EXPECT(small.threads == 1);
+				auto medium = dkm::details::split_restart_threads(4 * dkm::details::restart_points_per_thread, 10, 8);
+				EXPECT(medium.restarts == 2);
+				EXPECT(medium.threads == 4);
+				auto large = dkm::details::split_restart_threads(100 * dkm::details::restart_points_per_thread, 10, 8);
+				EXPECT(large.restarts == 1);
+				EXPECT(large.threads == 8);
+				auto few = dkm::details::split_restart_threads(1000, 2, 8);
+				EXPECT(few.restarts == 2);
+				EXPECT(few.threads == 4);
+			}
+		}
+	},
+	CASE("Test dkm::thread_pool",) {
+		SETUP("thread_pool") {
+			dkm::thread_pool pool(4);
+			EXPECT(pool.size() == 4u);
+
+			SECTION("Every task is run once") {
+				std::vector<std::atomic<int>> runs(1000);
+				for (auto& count : runs) {
+					count = 0;
+				}
+				pool.parallel_for(runs.size(), [&](size_t task) { ++runs[task]; });
+				EXPECT(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int>& count) { return count == 1; }));
+			}
+
+			SECTION("Tasks can run parallel loops of their own") {
+				std::atomic<size_t> total(0);
+				pool.parallel_for(8, [&](size_t) {
+					pool.parallel_for(100, [&](size_t task) { total += task; });
+				});
+				EXPECT(total == 8u * 4950u);
+			}
+
+			SECTION("Tasks sharing a slot never run at the same time") {
+				std::vector<std::atomic<int>> running(2);
+				std::atomic<bool> overlapped(false);
+				for (auto& count : running) {
+					count = 0;
+				}
+				pool.parallel_for_slots(1000, 2, [&](size_t, size_t slot) {
+					if (slot >= running.size() || ++running[slot] != 1) {
+						overlapped = true;
+					}
+					if (slot < running.size()) {
+						--running[slot];
+					}
+				});
+				EXPECT(!overlapped);
+			}
+
+			SECTION("A team runs a sequence of loops on the same threads") {
+				std::vector<std::atomic<int>> runs(100);
+				for (auto& count : runs) {
+					count = 0;
+				}
+				std::atomic<bool> bad_slot(false);
+				pool.run_team(3, [&](dkm::thread_pool::team& team) {
+					EXPECT(team.size() == 3u);
+					for (int loop = 0; loop < 50; ++loop) {
+						team.parallel_for_slots(runs.size(), 0, [&](size_t task, size_t slot) {
+							if (slot >= 3) {
+								bad_slot = true;
+							}
+							++runs[task];
+						});
+					}
+				});
+				EXPECT(!bad_slot);
+				EXPECT(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int>& count) { return count == 50; }));
+			}
+
+			SECTION("Teams with more threads than tasks run loops of different widths") {
+				// Several teams share a pool with more threads than most loops have ranges, so threads join
+				// the teams late and wake after the loops they were woken for have finished
+				dkm::thread_pool wide_pool(8);
+				std::atomic<bool> failed(false);
+				auto run_loops = [&] {
+					wide_pool.run_team(0, [&](dkm::thread_pool::team& team) {
+						std::vector<std::atomic<int>> running(8);
+						for (auto& count : running) {
+							count = 0;
+						}
+						for (size_t loop = 0; loop < 500; ++loop) {
+							const size_t width = 1 + loop % 8;
+							const size_t tasks = loop % 13;
+							std::atomic<size_t> runs(0);
+							team.parallel_for_slots(tasks, width, [&](size_t task, size_t slot) {
+								if (task >= tasks || slot >= width || ++running[slot] != 1) {
+									failed = true;
+									return;
+								}
+								++runs;
+								--running[slot];
+							});
+							if (runs != tasks) {
+								failed = true;
+							}
+						}
+					});
+				};
+				std::thread first(run_loops);
+				std::thread second(run_loops);
+				run_loops();
+				first.join();
+				second.join();
+				EXPECT(!failed);
+			}
+
+			SECTION("An exception thrown by a task is rethrown, and the pool can still be used") {
+				EXPECT_THROWS_AS(pool.parallel_for(1000, [](size_t task) {
+					if (task == 500) {
+						throw std::runtime_error("task failed");
+					}
+				}), std::runtime_error);
+				EXPECT_THROWS_AS(pool.parallel_for(1000, [](size_t task) {
+					if (task == 0) {
+						throw std::runtime_error("task failed");
+					}
+				}), std::runtime_error);
+				std::atomic<size_t> total(0);
+				pool.parallel_for(100, [&](size_t task) { total += task; });
+				EXPECT(total == 4950u);
+			}
+		}
+	},
+	CASE("Test mixed precision storage and accumulation",) {
+		SETUP("mixed precision") {
+			SECTION("Means are summed in double precision for float points") {
+				// A float sum can't add 1 to 2^24, so a float accumulator would lose every point after the first
+				std::vector<std::array<float, 1>> data(1001, {{1.0f}});
+				data[0][0] = 16777216.0f;
+				std::vector<uint32_t> clusters(data.size(), 0);
+				std::vector<std::array<float, 1>> old_means{{{0.0f}}};
+				auto means = dkm::details::calculate_means(data, clusters, old_means, 1);
+				EXPECT(means[0][0] == lest::approx((16777216.0f + 1000.0f) / 1001.0f));
+			}
+
+			SECTION("Means are summed in double precision by the kd-tree filtering method") {
+				std::vector<std::array<float, 1>> data(1001, {{1.0f}});
+				data[0][0] = 16777216.0f;
+				auto tree = dkm::details::kd_tree_build(data);
+				std::vector<std::array<float, 1>> old_means{{{0.0f}}};
+				std::vector<uint32_t> clusters;
+				auto means = dkm::details::kd_tree_calculate_means(tree, data, old_means, clusters);
+				EXPECT(means[0][0] == lest::approx((16777216.0f + 1000.0f) / 1001.0f));
+			}
+
+			SECTION("Half and bfloat16 conversions round to nearest even") {
+				using namespace dkm::details;
+				for (float value : {0.0f, 1.0f, -2.5f, 0.333251953125f, 65504.0f, 6.103515625e-05f, 5.9604644775390625e-08f}) {
+					EXPECT(half_to_float(float_to_half(value)) == value);
+				}
+				EXPECT(float_to_half(65520.0f) == 0x7c00);
+				EXPECT(float_to_half(1.0f + 1.0f / 2048.0f) == float_to_half(1.0f));
+				EXPECT(float_to_half(1.0f + 3.0f / 2048.0f) == float_to_half(1.0f + 2.0f / 1024.0f));
+				EXPECT(half_to_float(float_to_half(2.0e-08f)) == 0.0f);
+				for (float value : {0.0f, 1.0f, -2.5f, 3.0e38f, 1.0e-38f}) {
+					EXPECT(bfloat16_to_float(float_to_bfloat16(value)) == lest::approx(value).epsilon(0.01));
+				}
+				EXPECT(bfloat16_to_float(float_to_bfloat16(1.0f + 1.0f / 256.0f)) == 1.0f);
+				EXPECT(bfloat16_to_float(float_to_bfloat16(1.0f + 3.0f / 256.0f)) == 1.0f + 4.0f / 256.0f);
+			}
+
+			SECTION("Points stored in reduced precision give nearly the same clustering") {
+				auto float_data = dkm::load_csv<float, 2>("iris.data.csv");
+				std::vector<std::array<double, 2>> data;
+				for (auto& point : float_data) {
+					data.push_back({{point[0], point[1]}});
+				}
+				dkm::clustering_parameters<double> parameters(3);
+				parameters.set_random_seed(random_seed_value);
+				auto full = dkm::kmeans_lloyd_result(data, parameters);
+				dkm::thread_pool pool(4);
+				for (auto storage : {dkm::point_storage::single, dkm::point_storage::half, dkm::point_storage::bfloat16}) {
+					for (auto engine : {dkm::distance_engine::direct, dkm::distance_engine::blocked}) {
+						parameters.set_point_storage(storage);
+						parameters.set_distance_engine(engine);
+						auto stored = dkm::kmeans_lloyd_result(data, parameters);
+						for (size_t i = 0; i < full.means.size(); ++i) {
+							for (size_t d = 0; d < 2; ++d) {
+								EXPECT(std::abs(stored.means[i][d] - full.means[i][d]) < 0.05);
+							}
+						}
+						// The parallel version decodes the same blocks of points
+						parameters.set_thread_count(1);
+						auto parallel = dkm::kmeans_lloyd_parallel_result(data, parameters, pool);
+						EXPECT(parallel.means == stored.means);
+						EXPECT(parallel.clusters == stored.clusters);
+						EXPECT(parallel.distances == stored.distances);
+						parameters.set_thread_count(0);
+					}
+				}
+			}
 		}
 	},
 	CASE("Test dkm::predict",) {
@@ -543,6 +1706,15 @@ const lest::test specification[] = {
 				auto res = dkm::predict(centroids, query);
 				EXPECT(res == 2u);
 			}
+
+			SECTION("Test if we get the actual closest centroid from a flat buffer of centroids") {
+				std::vector<double> flat_centroids;
+				for (auto& centroid : centroids) {
+					flat_centroids.insert(flat_centroids.end(), centroid.begin(), centroid.end());
+				}
+				auto res = dkm::predict(dkm::matrix_view<double>(flat_centroids.data(), centroids.size(), 2), query.data());
+				EXPECT(res == 2u);
+			}
 		}
 	}
 };